@@ -0,0 +1,45 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// default frament shader for solid colours using uniform buffers (OpenGL 3.1)
+//
+
+#version 140
+
+// per-frame parameters (see visual_scene::update_frame_block)
+layout(std140) uniform octet_frame {
+  mat4 cameraToProjection;
+  mat4 worldToCamera;
+  vec4 lighting[17];
+  int num_lights;
+};
+
+// per-material parameters, uploaded only when they change
+layout(std140) uniform octet_material {
+  vec4 diffuse;
+};
+
+// inputs
+in vec2 uv_;
+in vec3 normal_;
+in vec3 camera_pos_;
+in vec4 color_;
+
+// output
+out vec4 frag_color;
+
+void main() {
+  vec3 nnormal = normalize(normal_);
+  vec3 npos = camera_pos_;
+  vec3 diffuse_light = lighting[0].xyz;
+  for (int i = 0; i != num_lights; ++i) {
+    vec3 light_pos = lighting[i * 4 + 1].xyz;
+    vec3 light_direction = lighting[i * 4 + 2].xyz;
+    vec3 light_color = lighting[i * 4 + 3].xyz;
+    vec3 light_atten = lighting[i * 4 + 4].xyz;
+    float diffuse_factor = max(dot(light_direction, nnormal), 0.0);
+    diffuse_light += diffuse_factor * light_color;
+  }
+  frag_color = vec4(diffuse.xyz * diffuse_light, 1.0);
+
+}
+
@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Default vertex shader for materials using uniform buffers (OpenGL 3.1).
+//
+// Camera and lights come from the per-frame block, set once by visual_scene
+// (or by material::render for a material drawn outside a scene).
+// Only the two model matrices are set per draw.
+//
+
+#version 140
+
+// per-frame parameters (see visual_scene::update_frame_block)
+layout(std140) uniform octet_frame {
+  mat4 cameraToProjection;
+  mat4 worldToCamera;
+  vec4 lighting[17];
+  int num_lights;
+};
+
+// matrices
+uniform mat4 modelToProjection;
+uniform mat4 modelToCamera;
+
+// attributes from vertex buffer
+in vec4 pos;
+in vec2 uv;
+in vec3 normal;
+in vec4 color;
+
+// outputs
+out vec3 normal_;
+out vec2 uv_;
+out vec4 color_;
+out vec3 model_pos_;
+out vec3 camera_pos_;
+
+void main() {
+  gl_Position = modelToProjection * pos;
+  vec3 tnormal = (modelToCamera * vec4(normal, 0.0)).xyz;
+  vec3 tpos = (modelToCamera * pos).xyz;
+  normal_ = tnormal;
+  uv_ = uv;
+  color_ = color;
+  camera_pos_ = tpos;
+  model_pos_ = pos.xyz;
+}
+
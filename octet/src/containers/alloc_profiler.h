@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Allocation profiler
+//
+// Containers that use tagged_allocator<my_tag> have their allocations
+// counted under "my_tag": live blocks and bytes, peak bytes and the number
+// of allocations made in the last frame. A subsystem that allocates every
+// frame shows up as churn, even if its live total never changes.
+// Reallocations are counted on their own, so a growing array shows up as
+// reallocs rather than as a free and a malloc.
+//
+// The counting is compiled in when OCTET_ALLOC_PROFILE is set. Otherwise
+// tagged_allocator is the same as its base allocator.
+//
+// The report is served at http://localhost:8888/alloc by http_server
+// and can be printed at exit with alloc_profiler::dump_on_exit().
+//
+
+namespace octet { namespace containers {
+  /// Counters for one allocation tag.
+  struct alloc_tag_stats {
+    const char *name;
+    std::atomic<size_t> live_bytes;
+    std::atomic<size_t> live_allocs;
+    std::atomic<size_t> peak_bytes;
+    std::atomic<size_t> total_allocs;
+    std::atomic<size_t> total_reallocs;
+    std::atomic<size_t> frame_allocs;   // allocations so far this frame
+    std::atomic<size_t> frame_reallocs;
+    std::atomic<size_t> frame_bytes;
+    size_t last_frame_allocs;           // allocations in the last complete frame
+    size_t last_frame_reallocs;
+    size_t last_frame_bytes;
+    alloc_tag_stats *next;
+
+    alloc_tag_stats(const char *name) {
+      this->name = name;
+      live_bytes = 0;
+      live_allocs = 0;
+      peak_bytes = 0;
+      total_allocs = 0;
+      total_reallocs = 0;
+      frame_allocs = 0;
+      frame_reallocs = 0;
+      frame_bytes = 0;
+      last_frame_allocs = 0;
+      last_frame_reallocs = 0;
+      last_frame_bytes = 0;
+      next = 0;
+    }
+
+    void update_peak(size_t live) {
+      size_t peak = peak_bytes.load(std::memory_order_relaxed);
+      while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+      }
+    }
+
+    void on_malloc(size_t size) {
+      size_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+      live_allocs.fetch_add(1, std::memory_order_relaxed);
+      total_allocs.fetch_add(1, std::memory_order_relaxed);
+      frame_allocs.fetch_add(1, std::memory_order_relaxed);
+      frame_bytes.fetch_add(size, std::memory_order_relaxed);
+      update_peak(live);
+    }
+
+    // the block stays live, only its size changes.
+    void on_realloc(size_t old_size, size_t size) {
+      size_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size - old_size;
+      live_bytes.fetch_sub(old_size, std::memory_order_relaxed);
+      total_reallocs.fetch_add(1, std::memory_order_relaxed);
+      frame_reallocs.fetch_add(1, std::memory_order_relaxed);
+      frame_bytes.fetch_add(size, std::memory_order_relaxed);
+      update_peak(live);
+    }
+
+    void on_free(size_t size) {
+      live_bytes.fetch_sub(size, std::memory_order_relaxed);
+      live_allocs.fetch_sub(1, std::memory_order_relaxed);
+    }
+  };
+
+  /// Collects the tags and reports on them.
+  class alloc_profiler {
+    // singleton state, a bit like an old-world global variable
+    struct state_t {
+      std::mutex mutex;
+      alloc_tag_stats *tags;
+      unsigned num_frames;
+      size_t frame_start_calls;       // allocator::get_num_calls() at the start of the frame
+      size_t last_frame_calls;
+      size_t peak_bytes;              // allocator::get_num_bytes() sampled each frame
+
+      state_t() {
+        tags = 0;
+        num_frames = 0;
+        frame_start_calls = 0;
+        last_frame_calls = 0;
+        peak_bytes = 0;
+      }
+    };
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    static void at_exit() {
+      string text;
+      report(text);
+      fputs(text.c_str(), stdout);
+    }
+
+  public:
+    /// add a tag to the report. Called once by each tagged_allocator.
+    static void register_tag(alloc_tag_stats *stats) {
+      state_t &s = state();
+      std::lock_guard<std::mutex> lock(s.mutex);
+      stats->next = s.tags;
+      s.tags = stats;
+    }
+
+    /// Call once per frame, when no other threads are running kernels.
+    static void end_frame() {
+      #if OCTET_ALLOC_PROFILE
+        state_t &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (alloc_tag_stats *t = s.tags; t; t = t->next) {
+          t->last_frame_allocs = t->frame_allocs.exchange(0, std::memory_order_relaxed);
+          t->last_frame_reallocs = t->frame_reallocs.exchange(0, std::memory_order_relaxed);
+          t->last_frame_bytes = t->frame_bytes.exchange(0, std::memory_order_relaxed);
+        }
+        size_t calls = allocator::get_num_calls();
+        s.last_frame_calls = calls - s.frame_start_calls;
+        s.frame_start_calls = calls;
+        size_t bytes = allocator::get_num_bytes();
+        if (bytes > s.peak_bytes) s.peak_bytes = bytes;
+        s.num_frames++;
+      #endif
+    }
+
+    /// Append a table of allocations to "text", busiest tags in the last frame first.
+    static void report(string &text) {
+      state_t &s = state();
+      std::lock_guard<std::mutex> lock(s.mutex);
+
+      dynarray<alloc_tag_stats*> tags;
+      for (alloc_tag_stats *t = s.tags; t; t = t->next) {
+        tags.push_back(t);
+      }
+      std::sort(tags.data(), tags.data() + tags.size(), [](alloc_tag_stats *a, alloc_tag_stats *b) {
+        size_t a_calls = a->last_frame_allocs + a->last_frame_reallocs;
+        size_t b_calls = b->last_frame_allocs + b->last_frame_reallocs;
+        return a_calls != b_calls ?
+          a_calls > b_calls :
+          a->live_bytes.load(std::memory_order_relaxed) > b->live_bytes.load(std::memory_order_relaxed);
+      });
+
+      #if !OCTET_ALLOC_PROFILE
+        text.printf("allocation profiling is off: build with OCTET_ALLOC_PROFILE=1\n");
+      #endif
+      text.printf("frames %u\n", s.num_frames);
+      text.printf(
+        "allocator: live %zu bytes in %zu blocks, peak %zu bytes, slabs %zu bytes, large %zu bytes, %zu allocs last frame\n\n",
+        allocator::get_num_bytes(), allocator::get_num_allocs(), s.peak_bytes,
+        allocator::get_num_slab_bytes(), allocator::get_num_large_bytes(), s.last_frame_calls
+      );
+      text.printf(
+        "%-32s %12s %10s %12s %12s %12s %12s %14s %12s\n",
+        "tag", "live bytes", "live", "peak bytes", "total", "reallocs", "frame allocs", "frame reallocs", "frame bytes"
+      );
+      for (unsigned i = 0; i != tags.size(); ++i) {
+        alloc_tag_stats *t = tags[i];
+        text.printf(
+          "%-32s %12zu %10zu %12zu %12zu %12zu %12zu %14zu %12zu\n",
+          t->name,
+          t->live_bytes.load(std::memory_order_relaxed),
+          t->live_allocs.load(std::memory_order_relaxed),
+          t->peak_bytes.load(std::memory_order_relaxed),
+          t->total_allocs.load(std::memory_order_relaxed),
+          t->total_reallocs.load(std::memory_order_relaxed),
+          t->last_frame_allocs,
+          t->last_frame_reallocs,
+          t->last_frame_bytes
+        );
+      }
+    }
+
+    /// print the report to stdout when the program exits.
+    static void dump_on_exit() {
+      static bool registered = false;
+      if (!registered) {
+        registered = true;
+        // make the state first, so that it outlives the exit handler.
+        state();
+        atexit(at_exit);
+      }
+    }
+  };
+
+  /// Allocator that counts its allocations under a tag. Use as the allocator_t of a container.
+  ///
+  /// Example
+  ///
+  ///     OCTET_ALLOC_TAG(physics_contacts)
+  ///     dynarray<contact, tagged_allocator<physics_contacts> > contacts;
+  template <class tag_t, class base_allocator_t=allocator> class tagged_allocator {
+  public:
+    /// counters for this tag
+    static alloc_tag_stats &stats() {
+      struct registered_t : alloc_tag_stats {
+        registered_t() : alloc_tag_stats(tag_t::get_name()) {
+          alloc_profiler::register_tag(this);
+        }
+      };
+      static registered_t instance;
+      return instance;
+    }
+
+    static void *malloc(size_t size) {
+      #if OCTET_ALLOC_PROFILE
+        stats().on_malloc(size);
+      #endif
+      return base_allocator_t::malloc(size);
+    }
+
+    static void free(void *ptr, size_t size) {
+      #if OCTET_ALLOC_PROFILE
+        if (ptr) stats().on_free(size);
+      #endif
+      base_allocator_t::free(ptr, size);
+    }
+
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      #if OCTET_ALLOC_PROFILE
+        if (ptr) {
+          stats().on_realloc(old_size, size);
+        } else {
+          stats().on_malloc(size);
+        }
+      #endif
+      return base_allocator_t::realloc(ptr, old_size, size);
+    }
+  };
+} }
+
+/// declare a tag for tagged_allocator, named after the subsystem or call site.
+#define OCTET_ALLOC_TAG(name) \
+  struct name { static const char *get_name() { return #name; } };
@@ -6,14 +6,22 @@
 //
 // game-style memory allocator
 //
-// this is a placeholder for a game-style memory allocator
 // using malloc and free is frowned upon in grown-up circles.
 //
-// these functions are poor for the following reasons:
+// the system functions are poor for the following reasons:
 //
 // 1) free() has to compute the size of the block to free
 // 2) these functions use heavy weight locks to guard the heap.
 // 3) implementations are quite variable
+//
+// Small blocks come from size classes carved out of 64k slabs.
+// Each thread keeps its own free list per class, so most calls take no lock at all.
+// The shared pool is only locked to move a batch of blocks to or from a thread.
+// Large blocks still go to the system heap.
+//
+// Slabs are cut from 1MB chunks aligned to their size. free() finds out whether a
+// block is small by looking its chunk up in a table, so a wrong size can only
+// upset the statistics, never send a block to the wrong heap.
 
 // this is a dummy class used to customise the placement new and delete
 struct dynarray_dummy_t {};
@@ -50,9 +58,84 @@ void operator delete(void *ptr, void *place, dynarray_dummy_t x) {}
 
 namespace octet { namespace containers {
   class allocator {
+  public:
+    enum {
+      alignment = 16,           // every block is at least 16 byte aligned
+      max_small = 4096,         // larger blocks come from the system heap
+      num_classes = 28,         // 16..128 in steps of 16, then four classes per power of two
+      slab_size = 0x10000,      // slabs are aligned to their size so a block can find its slab
+      slabs_per_chunk = 16,     // slabs taken from the system at a time
+      chunk_size = slab_size * slabs_per_chunk,
+      max_chunks = 4096,        // 4GB of small blocks; beyond that they come from the system heap
+    };
+
+  private:
+    // a free block, linked into a free list
+    struct block_t {
+      block_t *next;
+    };
+
+    // start of every slab. Padded so that blocks stay aligned.
+    struct slab_t {
+      unsigned size_class;
+      unsigned pad[alignment / sizeof(unsigned) - 1];
+    };
+
+    // blocks shared between threads for one size class
+    struct central_t {
+      std::mutex mutex;
+      block_t *free_list;
+      uint8_t *carve;
+      uint8_t *carve_end;
+    };
+
     // singleton state, a bit like an old-world global variable
     struct state_t {
-      size_t num_bytes;
+      central_t central[num_classes];
+      unsigned class_size[num_classes];
+      unsigned batch_size[num_classes];
+      uint8_t size_to_class[max_small / alignment + 1];
+
+      std::mutex slab_mutex;
+      uint8_t *slab_next;
+      uint8_t *slab_end;
+
+      // open addressed set of chunk addresses, written under slab_mutex and read without a lock.
+      std::atomic<uintptr_t> chunks[max_chunks];
+      unsigned num_chunks;
+
+      std::atomic<size_t> num_bytes;
+      std::atomic<size_t> num_allocs;
+      std::atomic<size_t> num_slabs;
+      std::atomic<size_t> num_large_bytes;
+      std::atomic<size_t> num_calls;
+
+      state_t() {
+        for (unsigned c = 0; c != num_classes; ++c) {
+          unsigned size = c < 8 ? (c + 1) * 16 : (5 + (c - 8) % 4) << ((c - 8) / 4 + 5);
+          class_size[c] = size;
+          // move about 8k at a time between a thread and the shared pool
+          unsigned batch = 8192 / size;
+          batch_size[c] = batch < 2 ? 2 : batch > 64 ? 64 : batch;
+          central[c].free_list = 0;
+          central[c].carve = central[c].carve_end = 0;
+        }
+        unsigned c = 0;
+        for (unsigned i = 0; i <= max_small / alignment; ++i) {
+          while (class_size[c] < i * alignment) ++c;
+          size_to_class[i] = (uint8_t)c;
+        }
+        slab_next = slab_end = 0;
+        for (unsigned i = 0; i != max_chunks; ++i) {
+          chunks[i].store(0, std::memory_order_relaxed);
+        }
+        num_chunks = 0;
+        num_bytes = 0;
+        num_allocs = 0;
+        num_slabs = 0;
+        num_large_bytes = 0;
+        num_calls = 0;
+      }
     };
 
     static state_t &state() {
@@ -60,49 +143,278 @@ namespace octet { namespace containers {
       return instance;
     }
 
-  public:
-    // todo: implement this from scratch using a pool allocator
-    static void *malloc(size_t size) {
-      state().num_bytes += size;
-      #if OCTET_MAC
-        void *res = 0;
-        posix_memalign(&res, 16, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_malloc(size, 16);
+    // per thread free lists. Plain data so that it can live in thread local storage.
+    struct thread_cache_t {
+      block_t *free_list[num_classes];
+      unsigned count[num_classes];
+      bool exit_registered;
+    };
+
+    #if OCTET_THREAD_EXIT
+      // gives the thread's blocks back when the thread exits.
+      struct thread_exit_t {
+        ~thread_exit_t() {
+          release_thread_cache();
+        }
+      };
+    #endif
+
+    // make sure this thread's cached blocks are not lost when it exits.
+    static void register_thread_exit(thread_cache_t &tc) {
+      tc.exit_registered = true;
+      #if OCTET_THREAD_EXIT
+        // the destructor is registered the first time each thread gets here.
+        static thread_local thread_exit_t on_exit;
+        (void)&on_exit;
+      #endif
+    }
+
+    static thread_cache_t &cache() {
+      static OCTET_THREAD_LOCAL thread_cache_t instance;
+      return instance;
+    }
+
+    static void *system_malloc(size_t size, size_t align) {
+      #if OCTET_SSE && !OCTET_MAC
+        return ::_aligned_malloc(size, align);
       #elif OCTET_VITA
-        void *res = ::memalign(size, 16);
+        return ::memalign(align, size);
       #else
-        void *res = ::malloc(size);
+        void *res = 0;
+        if (posix_memalign(&res, align, size)) return 0;
+        return res;
       #endif
-      //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
-      return res;
     }
 
-    static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
-      //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
-      #if OCTET_MAC
-        return ::free(ptr);
-      #elif OCTET_SSE
-        return ::_aligned_free(ptr);
+    static void system_free(void *ptr) {
+      #if OCTET_SSE && !OCTET_MAC
+        ::_aligned_free(ptr);
       #else
-        return ::free(ptr);
+        ::free(ptr);
       #endif
     }
 
-    static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
-      #if OCTET_MAC
-        void *res = ::realloc(ptr, size);
-      #elif OCTET_SSE
-        void *res = ::_aligned_realloc(ptr, size, 16);
-      #else
-        void *res = ::realloc(ptr, size);
+    static unsigned chunk_hash(uintptr_t chunk) {
+      return (unsigned)((chunk / chunk_size) * 2654435761u) & (max_chunks - 1);
+    }
+
+    // true if the block was carved from one of our slabs.
+    static bool is_small_block(state_t &s, void *ptr) {
+      uintptr_t chunk = (uintptr_t)ptr & ~(uintptr_t)(chunk_size - 1);
+      for (unsigned i = chunk_hash(chunk); ; i = (i + 1) & (max_chunks - 1)) {
+        uintptr_t value = s.chunks[i].load(std::memory_order_acquire);
+        if (value == chunk) return true;
+        if (value == 0) return false;
+      }
+    }
+
+    // slabs are cut from larger aligned chunks to limit the cost of aligning them.
+    static slab_t *new_slab(state_t &s) {
+      std::lock_guard<std::mutex> lock(s.slab_mutex);
+      if (s.slab_next == s.slab_end) {
+        // keep the table at most half full so that lookups stay short.
+        if (s.num_chunks == max_chunks / 2) return 0;
+        uint8_t *chunk = (uint8_t*)system_malloc(chunk_size, chunk_size);
+        if (!chunk) return 0;
+        unsigned i = chunk_hash((uintptr_t)chunk);
+        while (s.chunks[i].load(std::memory_order_relaxed)) i = (i + 1) & (max_chunks - 1);
+        s.chunks[i].store((uintptr_t)chunk, std::memory_order_release);
+        s.num_chunks++;
+        s.slab_next = chunk;
+        s.slab_end = chunk + chunk_size;
+      }
+      slab_t *slab = (slab_t*)s.slab_next;
+      s.slab_next += slab_size;
+      s.num_slabs.fetch_add(1, std::memory_order_relaxed);
+      return slab;
+    }
+
+    // get a batch of blocks from the shared pool into this thread's list.
+    static block_t *refill(state_t &s, thread_cache_t &tc, unsigned c) {
+      if (!tc.exit_registered) register_thread_exit(tc);
+      central_t &cen = s.central[c];
+      unsigned size = s.class_size[c];
+      unsigned batch = s.batch_size[c];
+      block_t *head = 0;
+      unsigned n = 0;
+
+      std::lock_guard<std::mutex> lock(cen.mutex);
+      while (n != batch && cen.free_list) {
+        block_t *b = cen.free_list;
+        cen.free_list = b->next;
+        b->next = head;
+        head = b;
+        n++;
+      }
+      while (n != batch) {
+        if (cen.carve + size > cen.carve_end) {
+          slab_t *slab = new_slab(s);
+          if (!slab) break;
+          slab->size_class = c;
+          cen.carve = (uint8_t*)slab + sizeof(slab_t);
+          cen.carve_end = (uint8_t*)slab + slab_size;
+        }
+        block_t *b = (block_t*)cen.carve;
+        cen.carve += size;
+        b->next = head;
+        head = b;
+        n++;
+      }
+      tc.free_list[c] = head;
+      tc.count[c] = n;
+      return head;
+    }
+
+    // give back the blocks of a class beyond "keep" to the shared pool.
+    static void release(state_t &s, thread_cache_t &tc, unsigned c, unsigned keep) {
+      if (tc.count[c] <= keep) return;
+      block_t *head = tc.free_list[c];
+      block_t *tail = head;
+      for (unsigned i = 1; i < tc.count[c] - keep; ++i) {
+        tail = tail->next;
+      }
+      tc.free_list[c] = tail->next;
+      tc.count[c] = keep;
+
+      central_t &cen = s.central[c];
+      std::lock_guard<std::mutex> lock(cen.mutex);
+      tail->next = cen.free_list;
+      cen.free_list = head;
+    }
+
+    // size class of the slab containing a small block.
+    static unsigned block_class(void *ptr) {
+      return ((slab_t*)((uintptr_t)ptr & ~(uintptr_t)(slab_size - 1)))->size_class;
+    }
+
+  public:
+    /// allocate "size" bytes, 16 byte aligned.
+    static void *malloc(size_t size) {
+      state_t &s = state();
+      s.num_bytes.fetch_add(size, std::memory_order_relaxed);
+      s.num_allocs.fetch_add(1, std::memory_order_relaxed);
+      #if OCTET_ALLOC_PROFILE
+        s.num_calls.fetch_add(1, std::memory_order_relaxed);
       #endif
-      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
+      if (size > max_small) {
+        s.num_large_bytes.fetch_add(size, std::memory_order_relaxed);
+        return system_malloc(size, alignment);
+      }
+
+      unsigned c = s.size_to_class[(size + alignment - 1) / alignment];
+      thread_cache_t &tc = cache();
+      block_t *b = tc.free_list[c];
+      if (!b) {
+        b = refill(s, tc, c);
+        if (!b) {
+          // out of slabs: free() will find that this block is not in a chunk.
+          s.num_large_bytes.fetch_add(size, std::memory_order_relaxed);
+          return system_malloc(size, alignment);
+        }
+      }
+      tc.free_list[c] = b->next;
+      tc.count[c]--;
+      //printf("malloc %p[%d] -> %d\n", b, size, s.num_bytes);
+      return (void*)b;
+    }
+
+    /// free a block. "size" should be the size it was allocated with; it is only used for statistics.
+    static void free(void *ptr, size_t size) {
+      if (!ptr) return;
+      state_t &s = state();
+      s.num_bytes.fetch_sub(size, std::memory_order_relaxed);
+      s.num_allocs.fetch_sub(1, std::memory_order_relaxed);
+      //printf("free %p[%d] -> %d\n", ptr, size, s.num_bytes);
+      if (!is_small_block(s, ptr)) {
+        s.num_large_bytes.fetch_sub(size, std::memory_order_relaxed);
+        return system_free(ptr);
+      }
+
+      // blocks may be freed by a different thread; they join that thread's list.
+      unsigned c = block_class(ptr);
+      thread_cache_t &tc = cache();
+      if (!tc.exit_registered) register_thread_exit(tc);
+      block_t *b = (block_t*)ptr;
+      b->next = tc.free_list[c];
+      tc.free_list[c] = b;
+      if (++tc.count[c] > s.batch_size[c] * 2) {
+        release(s, tc, c, s.batch_size[c]);
+      }
+    }
+
+    /// change the size of a block, keeping its contents.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      if (!ptr) return malloc(size);
+      state_t &s = state();
+      bool small = is_small_block(s, ptr);
+      if (!small && size > max_small) {
+        s.num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        s.num_large_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+        #if OCTET_SSE && !OCTET_MAC
+          return ::_aligned_realloc(ptr, size, alignment);
+        #elif OCTET_VITA
+          void *res = system_malloc(size, alignment);
+          if (res) memcpy(res, ptr, old_size < size ? old_size : size);
+          system_free(ptr);
+          return res;
+        #else
+          return ::realloc(ptr, size);
+        #endif
+      }
+
+      // still in the same size class
+      size_t capacity = old_size;
+      if (small) {
+        unsigned c = block_class(ptr);
+        capacity = s.class_size[c];
+        if (size <= max_small && s.size_to_class[(size + alignment - 1) / alignment] == c) {
+          s.num_bytes.fetch_add(size - old_size, std::memory_order_relaxed);
+          return ptr;
+        }
+      }
+
+      void *res = malloc(size);
+      if (res) memcpy(res, ptr, capacity < size ? capacity : size);
+      free(ptr, old_size);
+      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, s.num_bytes);
       return res;
     }
 
+    /// return this thread's cached blocks to the shared pool.
+    /// This happens by itself when a thread exits, unless OCTET_THREAD_EXIT is 0.
+    static void release_thread_cache() {
+      state_t &s = state();
+      thread_cache_t &tc = cache();
+      for (unsigned c = 0; c != num_classes; ++c) {
+        release(s, tc, c, 0);
+      }
+    }
+
+    /// bytes currently allocated by callers
+    static size_t get_num_bytes() {
+      return state().num_bytes.load(std::memory_order_relaxed);
+    }
+
+    /// number of blocks currently allocated
+    static size_t get_num_allocs() {
+      return state().num_allocs.load(std::memory_order_relaxed);
+    }
+
+    /// bytes taken from the system for small blocks. Slabs are never given back.
+    static size_t get_num_slab_bytes() {
+      return state().num_slabs.load(std::memory_order_relaxed) * slab_size;
+    }
+
+    /// bytes currently allocated from the system heap as large blocks
+    static size_t get_num_large_bytes() {
+      return state().num_large_bytes.load(std::memory_order_relaxed);
+    }
+
+    /// number of calls to malloc since the start. Only counted when OCTET_ALLOC_PROFILE is set.
+    static size_t get_num_calls() {
+      return state().num_calls.load(std::memory_order_relaxed);
+    }
+
     // crude check of stack integrity
     static void test(const char *label) {
       printf("test %s\n", label);
@@ -26,13 +26,20 @@
 #define OCTET_CONTAINERS_INCLUDED
 
 #include "../containers/allocator.h"
+#include "../containers/frame_allocator.h"
+#include "../containers/string_key.h"
 #include "../containers/dictionary.h"
 #include "../containers/hash_map.h"
 #include "../containers/double_list.h"
+#include "../containers/intrusive_list.h"
 #include "../containers/dynarray.h"
+#include "../containers/small_dynarray.h"
+#include "../containers/object_pool.h"
 #include "../containers/string.h"
+#include "../containers/alloc_profiler.h"
 #include "../containers/ref.h"
 #include "../containers/bitset.h"
+#include "../containers/dynamic_bitset.h"
 
 namespace octet {
   using namespace containers;
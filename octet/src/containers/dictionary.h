@@ -4,6 +4,9 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
+// Keys are copied into blocks owned by the dictionary, so adding a key
+// does not call the allocator every time.
+//
 namespace octet { namespace containers {
   /// Map strings to objects and object references.
   ///
@@ -20,36 +23,54 @@ namespace octet { namespace containers {
   ///
   ///     int annes_age = my_dict["anne"];
   ///
+  /// Keys are hashed with string_hash. Use a string_key to look up the same name
+  /// many times without hashing it again.
+  ///
   template <class value_t, class allocator_t=allocator> class dictionary {
-    struct entry_t { const char *key; unsigned hash; value_t value; };
+    struct entry_t { const char *key; uint64_t hash; unsigned length; value_t value; };
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
-  
-    // hash is a compromise between fewer collisions and
-    // faster hash calculation.
-    unsigned calc_hash( const char *key ) {
-      unsigned hash = 0;
-      for (int i = 0; key[i]; ++i) {
-        hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
-      }
-      return hash;
-    }
-  
+
+    // keys live in a chain of blocks, freed together in release()
+    struct key_block_t { key_block_t *next; size_t size; };
+    enum { key_block_size = 4096 };
+    key_block_t *key_blocks;
+    char *key_ptr;
+    char *key_end;
+
     // internal method to find an entry for a key
-    entry_t *find( const char *key, unsigned hash ) {
+    entry_t *find( const char *key, unsigned length, uint64_t hash ) {
       unsigned mask = max_entries - 1;
       for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
+        entry_t *entry = &entries[ ( i + (unsigned)hash ) & mask ];
         if (!entry->key) {
           return entry;
         }
-        if (entry->hash == hash && !strcmp(entry->key, key)) {
+        if (entry->hash == hash && entry->length == length && !memcmp(entry->key, key, length)) {
           return entry;
         }
       }
       return 0;
     }
+
+    // copy a key into the key blocks, adding a terminator.
+    const char *store_key(const char *key, unsigned length) {
+      if ((size_t)(key_end - key_ptr) < length + 1) {
+        size_t size = sizeof(key_block_t) + (length + 1 > key_block_size ? length + 1 : key_block_size);
+        key_block_t *block = (key_block_t*)allocator_t::malloc(size);
+        block->next = key_blocks;
+        block->size = size;
+        key_blocks = block;
+        key_ptr = (char*)(block + 1);
+        key_end = (char*)block + size;
+      }
+      char *result = key_ptr;
+      memcpy(result, key, length);
+      result[length] = 0;
+      key_ptr += length + 1;
+      return result;
+    }
   
     // grow the dictionary when needed
     void expand() {
@@ -61,7 +82,7 @@ namespace octet { namespace containers {
       for (unsigned i = 0; i != old_max_entries; ++i) {
         entry_t *old_entry = &old_entries[i];
         if (old_entry->key) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
+          entry_t *new_entry = find(old_entry->key, old_entry->length, old_entry->hash);
           *new_entry = *old_entry;
         }
       }
@@ -69,12 +90,12 @@ namespace octet { namespace containers {
     }
 
     void release() {
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[i];
-        if (entry->key ) {
-          allocator_t::free((void*)entry->key, strlen(entry->key)+1);
-        }
+      while (key_blocks) {
+        key_block_t *block = key_blocks;
+        key_blocks = block->next;
+        allocator_t::free(block, block->size);
       }
+      key_ptr = key_end = 0;
       allocator_t::free(entries, sizeof(entry_t) * max_entries);
       entries = 0;
       num_entries = 0;
@@ -86,6 +107,8 @@ namespace octet { namespace containers {
       max_entries = 4;
       entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
       memset(entries, 0, sizeof(entry_t) * max_entries);
+      key_blocks = 0;
+      key_ptr = key_end = 0;
     }
   public:
     /// make a new dictionary
@@ -97,29 +120,35 @@ namespace octet { namespace containers {
     /// This will create a new element if one does not exist.
     /// For more detail, use get_index(), get_key() and get_value()
     value_t &operator[]( const char *key ) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      return (*this)[string_key(key)];
+    }
+
+    /// Access an element by a pre-hashed key.
+    value_t &operator[]( const string_key &key ) {
+      entry_t *entry = find( key.data(), key.size(), key.get_hash() );
       if (!entry || !entry->key) {
         // reducing this ratio decreases hot search time at the
         // expense of size (cold search time).
         if (num_entries > max_entries * 3 / 4) {
           expand();
-          entry = find(key, hash);
+          entry = find( key.data(), key.size(), key.get_hash() );
         }
         num_entries++;
-        size_t bytes = strlen(key) + 1;
-        entry->key = (char *)allocator_t::malloc(bytes);
-        entry->hash = hash;
-        memcpy((void*)entry->key, key, bytes);
+        entry->key = store_key(key.data(), key.size());
+        entry->hash = key.get_hash();
+        entry->length = key.size();
       }
       return entry->value;
     }
 
     /// Return true if the dictionary contains key.
     bool contains(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      return entry && entry->key;
+      return get_index(string_key(key)) != -1;
+    }
+
+    /// Return true if the dictionary contains a pre-hashed key.
+    bool contains(const string_key &key) {
+      return get_index(key) != -1;
     }
 
     /// Return the number of entries stored in the dictionary.
@@ -146,8 +175,12 @@ namespace octet { namespace containers {
 
     /// Get the index for a certain key, or -1 if the key is not found.
     int get_index(const char *key) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
+      return get_index(string_key(key));
+    }
+
+    /// Get the index for a pre-hashed key, or -1 if the key is not found.
+    int get_index(const string_key &key) {
+      entry_t *entry = find( key.data(), key.size(), key.get_hash() );
       return entry && entry->key ? (int)(entry - entries) : -1;
     }
 
@@ -159,7 +192,7 @@ namespace octet { namespace containers {
   
     /// Bye bye dictionary. Use the allocator to free up memory.
     ~dictionary() {
-      reset();
+      release();
     }
   };
 } }
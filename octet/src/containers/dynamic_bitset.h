@@ -0,0 +1,360 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Resizable bit set
+//
+// The bits are kept in 64 bit words. Whole-set operations work on four
+// words at a time with AVX2 when the compiler targets it, two with SSE2,
+// otherwise one. Set bits are found by scanning for non-zero words and
+// using the count-trailing-zeros instruction, so sparse sets are cheap
+// to walk.
+//
+// Bits past size() are always zero.
+//
+
+namespace octet { namespace containers {
+  /// Resizable bit set for masks such as visibility, occupancy and culling results.
+  ///
+  /// Example
+  ///
+  ///     dynamic_bitset<> visible(num_instances);
+  ///     visible.set(3);
+  ///     visible &= in_frustum;
+  ///     for (int i = visible.find_first(); i != -1; i = visible.find_next(i)) {
+  ///       draw(i);
+  ///     }
+  template <class allocator_t=allocator> class dynamic_bitset {
+    typedef unsigned int_size_t;
+
+    dynarray<uint64_t, allocator_t> words_;
+    int_size_t size_;
+
+    static int_size_t words_for(int_size_t num_bits) {
+      return (num_bits + 63) / 64;
+    }
+
+    // zero the unused bits of the last word.
+    void trim() {
+      if (size_ & 63) {
+        words_[size_ / 64] &= ~(uint64_t)0 >> (64 - (size_ & 63));
+      }
+    }
+
+    // mask of bits [b, e) in one word, 0 <= b < e <= 64.
+    static uint64_t range_mask(unsigned b, unsigned e) {
+      uint64_t hi = e == 64 ? ~(uint64_t)0 : ((uint64_t)1 << e) - 1;
+      return hi & ~(((uint64_t)1 << b) - 1);
+    }
+
+    // apply a mask to bits [b, e).
+    template <class op_t> void range_op(int_size_t b, int_size_t e, op_t op) {
+      assert(b <= e && e <= size_);
+      if (b == e) return;
+      int_size_t wb = b / 64, we = (e - 1) / 64;
+      if (wb == we) {
+        op(words_[wb], range_mask(b & 63, ((e - 1) & 63) + 1));
+        return;
+      }
+      op(words_[wb], range_mask(b & 63, 64));
+      for (int_size_t i = wb + 1; i != we; ++i) {
+        op(words_[i], ~(uint64_t)0);
+      }
+      op(words_[we], range_mask(0, ((e - 1) & 63) + 1));
+    }
+
+  public:
+    /// number of 1 bits in an array of words
+    static uint64_t pop_count_words(const uint64_t *words, size_t num_words) {
+      uint64_t total = 0;
+      size_t i = 0;
+      #if OCTET_AVX2
+        // nibble lookup with pshufb, summed per 64 bit lane with psadbw.
+        const __m256i lookup = _mm256_setr_epi8(
+          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+        );
+        const __m256i low_mask = _mm256_set1_epi8(0x0f);
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 4 <= num_words; i += 4) {
+          __m256i v = _mm256_loadu_si256((const __m256i*)(words + i));
+          __m256i lo = _mm256_and_si256(v, low_mask);
+          __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+          __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+          acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+      #endif
+      for (; i != num_words; ++i) {
+        total += math::pop_count64(words[i]);
+      }
+      return total;
+    }
+
+    /// make a set of "num_bits" bits, all zero.
+    dynamic_bitset(int_size_t num_bits=0) {
+      size_ = 0;
+      resize(num_bits);
+    }
+
+    /// change the number of bits. New bits are set to "value".
+    void resize(int_size_t num_bits, bool value=false) {
+      int_size_t old_size = size_;
+      int_size_t old_words = words_.size();
+      int_size_t new_words = words_for(num_bits);
+      words_.resize(new_words);
+      for (int_size_t i = old_words; i < new_words; ++i) {
+        words_[i] = 0;
+      }
+      size_ = num_bits;
+      if (num_bits > old_size && value) {
+        set_range(old_size, num_bits);
+      }
+      trim();
+    }
+
+    /// number of bits
+    int_size_t size() const { return size_; }
+
+    /// number of 64 bit words
+    int_size_t num_words() const { return words_.size(); }
+
+    /// the words, for passing to shaders or saving. Bit i is bit (i & 63) of word i / 64.
+    const uint64_t *words() const { return words_.data(); }
+
+    /// Return true if a bit is set.
+    bool operator[](int_size_t i) const {
+      return test(i);
+    }
+
+    /// Return true if a bit is set.
+    bool test(int_size_t i) const {
+      assert(i < size_);
+      return (words_[i / 64] >> (i & 63)) & 1;
+    }
+
+    /// Set a bit to one.
+    void set(int_size_t i) {
+      assert(i < size_);
+      words_[i / 64] |= (uint64_t)1 << (i & 63);
+    }
+
+    /// Reset a bit to zero.
+    void clear(int_size_t i) {
+      assert(i < size_);
+      words_[i / 64] &= ~((uint64_t)1 << (i & 63));
+    }
+
+    /// Set a bit to a value.
+    void assign(int_size_t i, bool value) {
+      if (value) set(i); else clear(i);
+    }
+
+    /// Invert a bit.
+    void flip(int_size_t i) {
+      assert(i < size_);
+      words_[i / 64] ^= (uint64_t)1 << (i & 63);
+    }
+
+    /// Set bits [b, e) to one.
+    void set_range(int_size_t b, int_size_t e) {
+      range_op(b, e, [](uint64_t &w, uint64_t m) { w |= m; });
+    }
+
+    /// Reset bits [b, e) to zero.
+    void clear_range(int_size_t b, int_size_t e) {
+      range_op(b, e, [](uint64_t &w, uint64_t m) { w &= ~m; });
+    }
+
+    /// Invert bits [b, e).
+    void flip_range(int_size_t b, int_size_t e) {
+      range_op(b, e, [](uint64_t &w, uint64_t m) { w ^= m; });
+    }
+
+    /// Set every bit to one.
+    void set_all() {
+      if (size_ == 0) return;
+      memset(words_.data(), 0xff, words_.size() * sizeof(uint64_t));
+      trim();
+    }
+
+    /// Reset every bit to zero.
+    void clear_all() {
+      if (size_ == 0) return;
+      memset(words_.data(), 0, words_.size() * sizeof(uint64_t));
+    }
+
+    /// number of 1 bits
+    uint64_t count() const {
+      return pop_count_words(words_.data(), words_.size());
+    }
+
+    /// number of 1 bits in [b, e)
+    uint64_t count_range(int_size_t b, int_size_t e) const {
+      assert(b <= e && e <= size_);
+      if (b == e) return 0;
+      int_size_t wb = b / 64, we = (e - 1) / 64;
+      if (wb == we) {
+        return math::pop_count64(words_[wb] & range_mask(b & 63, ((e - 1) & 63) + 1));
+      }
+      return
+        math::pop_count64(words_[wb] & range_mask(b & 63, 64)) +
+        pop_count_words(words_.data() + wb + 1, we - wb - 1) +
+        math::pop_count64(words_[we] & range_mask(0, ((e - 1) & 63) + 1))
+      ;
+    }
+
+    /// true if any bit is set
+    bool any() const {
+      for (int_size_t i = 0; i != words_.size(); ++i) {
+        if (words_[i]) return true;
+      }
+      return false;
+    }
+
+    /// true if no bit is set
+    bool none() const {
+      return !any();
+    }
+
+    /// index of the first 1 bit, or -1
+    int find_first() const {
+      return find_from(0);
+    }
+
+    /// index of the first 1 bit after "i", or -1
+    int find_next(int_size_t i) const {
+      return find_from(i + 1);
+    }
+
+    /// index of the first 1 bit at or after "i", or -1
+    int find_from(int_size_t i) const {
+      if (i >= size_) return -1;
+      int_size_t w = i / 64;
+      uint64_t bits = words_[w] & (~(uint64_t)0 << (i & 63));
+      for (;;) {
+        if (bits) return (int)(w * 64 + math::ctz64(bits));
+        if (++w == words_.size()) return -1;
+        bits = words_[w];
+      }
+    }
+
+    /// call fn(i) for every 1 bit, in order
+    template <class fn_t> void for_each_set(fn_t fn) const {
+      for (int_size_t w = 0; w != words_.size(); ++w) {
+        for (uint64_t bits = words_[w]; bits; bits &= bits - 1) {
+          fn(w * 64 + math::ctz64(bits));
+        }
+      }
+    }
+
+    /// this = this & rhs. The sets must be the same size.
+    dynamic_bitset &operator&=(const dynamic_bitset &rhs) {
+      assert(size_ == rhs.size_);
+      uint64_t *d = words_.data();
+      const uint64_t *s = rhs.words_.data();
+      int_size_t n = words_.size(), i = 0;
+      #if OCTET_AVX2
+        for (; i + 4 <= n; i += 4) {
+          _mm256_storeu_si256((__m256i*)(d + i), _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(d + i)), _mm256_loadu_si256((const __m256i*)(s + i))));
+        }
+      #elif OCTET_SSE2
+        for (; i + 2 <= n; i += 2) {
+          _mm_storeu_si128((__m128i*)(d + i), _mm_and_si128(_mm_loadu_si128((const __m128i*)(d + i)), _mm_loadu_si128((const __m128i*)(s + i))));
+        }
+      #endif
+      for (; i != n; ++i) d[i] &= s[i];
+      return *this;
+    }
+
+    /// this = this | rhs. The sets must be the same size.
+    dynamic_bitset &operator|=(const dynamic_bitset &rhs) {
+      assert(size_ == rhs.size_);
+      uint64_t *d = words_.data();
+      const uint64_t *s = rhs.words_.data();
+      int_size_t n = words_.size(), i = 0;
+      #if OCTET_AVX2
+        for (; i + 4 <= n; i += 4) {
+          _mm256_storeu_si256((__m256i*)(d + i), _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(d + i)), _mm256_loadu_si256((const __m256i*)(s + i))));
+        }
+      #elif OCTET_SSE2
+        for (; i + 2 <= n; i += 2) {
+          _mm_storeu_si128((__m128i*)(d + i), _mm_or_si128(_mm_loadu_si128((const __m128i*)(d + i)), _mm_loadu_si128((const __m128i*)(s + i))));
+        }
+      #endif
+      for (; i != n; ++i) d[i] |= s[i];
+      return *this;
+    }
+
+    /// this = this ^ rhs. The sets must be the same size.
+    dynamic_bitset &operator^=(const dynamic_bitset &rhs) {
+      assert(size_ == rhs.size_);
+      uint64_t *d = words_.data();
+      const uint64_t *s = rhs.words_.data();
+      int_size_t n = words_.size(), i = 0;
+      #if OCTET_AVX2
+        for (; i + 4 <= n; i += 4) {
+          _mm256_storeu_si256((__m256i*)(d + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(d + i)), _mm256_loadu_si256((const __m256i*)(s + i))));
+        }
+      #elif OCTET_SSE2
+        for (; i + 2 <= n; i += 2) {
+          _mm_storeu_si128((__m128i*)(d + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(d + i)), _mm_loadu_si128((const __m128i*)(s + i))));
+        }
+      #endif
+      for (; i != n; ++i) d[i] ^= s[i];
+      return *this;
+    }
+
+    /// this = this & ~rhs: remove the members of rhs. The sets must be the same size.
+    dynamic_bitset &and_not(const dynamic_bitset &rhs) {
+      assert(size_ == rhs.size_);
+      uint64_t *d = words_.data();
+      const uint64_t *s = rhs.words_.data();
+      int_size_t n = words_.size(), i = 0;
+      #if OCTET_AVX2
+        for (; i + 4 <= n; i += 4) {
+          // note: andnot inverts its first argument
+          _mm256_storeu_si256((__m256i*)(d + i), _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(s + i)), _mm256_loadu_si256((const __m256i*)(d + i))));
+        }
+      #elif OCTET_SSE2
+        for (; i + 2 <= n; i += 2) {
+          _mm_storeu_si128((__m128i*)(d + i), _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(s + i)), _mm_loadu_si128((const __m128i*)(d + i))));
+        }
+      #endif
+      for (; i != n; ++i) d[i] &= ~s[i];
+      return *this;
+    }
+
+    /// Return true if the sets have a bit in common.
+    bool intersects(const dynamic_bitset &rhs) const {
+      assert(size_ == rhs.size_);
+      for (int_size_t i = 0; i != words_.size(); ++i) {
+        if (words_[i] & rhs.words_[i]) return true;
+      }
+      return false;
+    }
+
+    /// number of bits set in both sets, without making a temporary set.
+    uint64_t count_and(const dynamic_bitset &rhs) const {
+      assert(size_ == rhs.size_);
+      uint64_t total = 0;
+      for (int_size_t i = 0; i != words_.size(); ++i) {
+        total += math::pop_count64(words_[i] & rhs.words_[i]);
+      }
+      return total;
+    }
+
+    /// true if the sets have the same bits
+    bool operator==(const dynamic_bitset &rhs) const {
+      return size_ == rhs.size_ && (size_ == 0 || !memcmp(words_.data(), rhs.words_.data(), words_.size() * sizeof(uint64_t)));
+    }
+
+    bool operator!=(const dynamic_bitset &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+} }
@@ -7,6 +7,16 @@
 
 
 namespace octet { namespace containers {
+  /// Types that can be moved in memory with memcpy.
+  ///
+  /// dynarray uses realloc to grow arrays of these, instead of constructing copies.
+  /// Classes that only hold pointers to other memory (ref, string) can say so:
+  ///
+  ///     template <> struct is_relocatable<my_class> { enum { value = 1 }; };
+  template <class item_t> struct is_relocatable {
+    enum { value = std::is_trivially_copyable<item_t>::value };
+  };
+
   /// Dynamic array class similar to std::vector.
   ///
   /// Example
@@ -33,6 +43,18 @@ namespace octet { namespace containers {
     int_size_t capacity_;
     enum { min_capacity = 8 };
 
+    // can we copy items with memcpy?
+    enum { is_trivial = std::is_trivially_copyable<item_t>::value || !use_new_delete };
+
+    // make room for "new_size" items, doubling the capacity to keep push_back cheap.
+    void grow(int_size_t new_size) {
+      if (new_size > capacity_) {
+        int_size_t new_capacity = capacity_ == 0 ? min_capacity : capacity_ * 2;
+        while (new_capacity < new_size) new_capacity *= 2;
+        reserve(new_capacity);
+      }
+    }
+
   public:
     /// Create a new, empty, dynamic array
     dynarray() {
@@ -43,7 +65,7 @@ namespace octet { namespace containers {
 
     /// Create a new dynamic array of a certain size.
     dynarray(int_size_t size) {
-      data_ = (item_t*)allocator::malloc(size * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(size * sizeof(item_t));
       size_ = capacity_ = size;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -57,7 +79,7 @@ namespace octet { namespace containers {
     ///
     /// Note: this is very slow and will happen frequently in naive code.
     dynarray(const dynarray &rhs) {
-      data_ = (item_t*)allocator::malloc(rhs.size_ * sizeof(item_t));
+      data_ = (item_t*)allocator_t::malloc(rhs.size_ * sizeof(item_t));
       size_ = capacity_ = rhs.size_;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -69,6 +91,37 @@ namespace octet { namespace containers {
       }
     }
 
+    /// Take the contents of another dynamic array, leaving it empty.
+    dynarray(dynarray &&rhs) {
+      data_ = rhs.data_;
+      size_ = rhs.size_;
+      capacity_ = rhs.capacity_;
+      rhs.data_ = 0;
+      rhs.size_ = rhs.capacity_ = 0;
+    }
+
+    /// Replace the contents with a copy of another array.
+    dynarray &operator=(const dynarray &rhs) {
+      if (this != &rhs) {
+        resize(0);
+        append(rhs.data_, rhs.size_);
+      }
+      return *this;
+    }
+
+    /// Replace the contents with those of another array, leaving it empty.
+    dynarray &operator=(dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        data_ = rhs.data_;
+        size_ = rhs.size_;
+        capacity_ = rhs.capacity_;
+        rhs.data_ = 0;
+        rhs.size_ = rhs.capacity_ = 0;
+      }
+      return *this;
+    }
+
     /// Destroy the array and its contents.
     ~dynarray() {
       reset();
@@ -111,7 +164,7 @@ namespace octet { namespace containers {
       int_size_t old_length = size_;
       resize(size_+1);
       for (int_size_t i = old_length; i != it.elem; --i) {
-        data_[i] = data_[i-1];
+        data_[i] = std::move(data_[i-1]);
       }
       data_[it.elem] = new_item;
       return it;
@@ -120,7 +173,7 @@ namespace octet { namespace containers {
     /// iterator erase for STL compatibility
     iterator erase(iterator it) {
       for (int_size_t i = it.elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+        data_[i] = std::move(data_[i+1]);
       }
       resize(size_-1);
       return it;
@@ -129,16 +182,97 @@ namespace octet { namespace containers {
     /// Erase an item; move subsequent items down to fill the gap.
     void erase(unsigned elem) {
       for (int_size_t i = elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+        data_[i] = std::move(data_[i+1]);
       }
       resize(size_-1);
     }
 
     /// Add an item at the back of the array.
     void push_back(const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      data_[old_length] = new_item;
+      dynarray_dummy_t x;
+      if (size_ == capacity_) {
+        // new_item may be in this array.
+        item_t tmp(new_item);
+        grow(size_ + 1);
+        new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        new (data_ + size_, x) item_t(new_item);
+      }
+      size_++;
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      dynarray_dummy_t x;
+      if (size_ == capacity_) {
+        item_t tmp(std::move(new_item));
+        grow(size_ + 1);
+        new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        new (data_ + size_, x) item_t(std::move(new_item));
+      }
+      size_++;
+    }
+
+    /// Construct an item at the back of the array from constructor arguments.
+    ///
+    ///     dynarray<string> names;
+    ///     names.emplace_back("fred");
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      dynarray_dummy_t x;
+      item_t *result;
+      if (size_ == capacity_) {
+        // the arguments may refer to our own items, so build before growing.
+        item_t tmp(std::forward<args_t>(args)...);
+        grow(size_ + 1);
+        result = new (data_ + size_, x) item_t(std::move(tmp));
+      } else {
+        result = new (data_ + size_, x) item_t(std::forward<args_t>(args)...);
+      }
+      size_++;
+      return *result;
+    }
+
+    /// Add "num" items copied from "src" to the back of the array, growing it once.
+    void append(const item_t *src, int_size_t num) {
+      if (num == 0) return;
+      assert(src + num <= data_ || src >= data_ + capacity_);
+      grow(size_ + num);
+      if (is_trivial) {
+        memcpy(data_ + size_, src, num * sizeof(item_t));
+      } else {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != num; ++i) {
+          new (data_ + size_ + i, x) item_t(src[i]);
+        }
+      }
+      size_ += num;
+    }
+
+    /// Insert "num" items copied from "src" at position "pos", growing the array once.
+    void insert(int_size_t pos, const item_t *src, int_size_t num) {
+      assert(pos <= size_);
+      if (num == 0) return;
+      assert(src + num <= data_ || src >= data_ + capacity_);
+      grow(size_ + num);
+      dynarray_dummy_t x;
+      if (is_relocatable<item_t>::value || !use_new_delete) {
+        memmove(data_ + pos + num, data_ + pos, (size_ - pos) * sizeof(item_t));
+      } else {
+        // move the tail up, last item first.
+        for (int_size_t i = size_ + num; i-- > pos + num; ) {
+          new (data_ + i, x) item_t(std::move(data_[i - num]));
+          data_[i - num].~item_t();
+        }
+      }
+      if (is_trivial) {
+        memcpy(data_ + pos, src, num * sizeof(item_t));
+      } else {
+        for (int_size_t i = 0; i != num; ++i) {
+          new (data_ + pos + i, x) item_t(src[i]);
+        }
+      }
+      size_ += num;
     }
 
     /// Get the last element in the array.
@@ -222,16 +356,25 @@ namespace octet { namespace containers {
     /// Reserve an amount of memory to use with this array.
     /// Use this before you start a loop with push_back calls, for example.
     void reserve(int_size_t new_capacity) {
-      if (new_capacity >= size_) {
+      if (new_capacity >= size_ && new_capacity != capacity_) {
+        if (is_relocatable<item_t>::value || !use_new_delete) {
+          // items can be moved with memcpy, so the allocator may be able to grow in place.
+          if (data_) {
+            data_ = (item_t *)allocator_t::realloc(data_, capacity_ * sizeof(item_t), sizeof(item_t) * new_capacity);
+          } else {
+            data_ = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+          }
+          capacity_ = new_capacity;
+          return;
+        }
+
         dynarray_dummy_t x;
         item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
       
-        if (use_new_delete) {
-          // initialize new data_ elements from old ones
-          for (int_size_t i = 0; i != size_; ++i) {
-            new (new_data + i, x) item_t(data_[i]);
-            data_[i].~item_t();
-          }
+        // move the items to the new memory
+        for (int_size_t i = 0; i != size_; ++i) {
+          new (new_data + i, x) item_t(std::move(data_[i]));
+          data_[i].~item_t();
         }
 
         // free up data_
@@ -248,6 +391,9 @@ namespace octet { namespace containers {
     void pop_back() {
       assert(size_ != 0);
       size_--;
+      if (use_new_delete) {
+        data_[size_].~item_t();
+      }
     }
 
     /// Reset the array to zero size, freeing up the data.
@@ -267,6 +413,9 @@ namespace octet { namespace containers {
     }
   };
 
+  /// arrays only hold a pointer to their items, so arrays of arrays can grow with realloc.
+  template <class item_t, class allocator_t, bool use_new_delete> struct is_relocatable<dynarray<item_t, allocator_t, use_new_delete> > { enum { value = 1 }; };
+
   inline void vformat(dynarray <char> &ary, const char *fmt, va_list v) {
     unsigned old_size = ary.size();
     #ifdef WIN32
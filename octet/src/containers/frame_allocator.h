@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Frame-scoped linear allocator
+//
+// Temporary arrays that only live for one frame do not need a heap.
+// Each thread bumps a pointer through its own arena. reset_all() starts a
+// new frame by bumping a frame number; each thread empties its own arena the
+// next time it allocates, so no thread ever touches another thread's arena.
+// If a frame overflows its arena, the arena grows to fit at the next reset,
+// so steady-state frames do not touch the heap at all.
+//
+
+namespace octet { namespace containers {
+  /// Allocator for per-frame temporaries. Use it as the allocator_t of a container.
+  ///
+  /// Memory from this allocator is only valid until the end of the frame.
+  /// Do not keep containers that use it in classes.
+  ///
+  /// Example
+  ///
+  ///     dynarray<vec3, frame_allocator> lines;
+  ///     hash_map<int, int, hash_map_cmp, frame_allocator> seen;
+  class frame_allocator {
+  public:
+    enum {
+      alignment = 16,
+      default_size = 0x40000,   // starting size of each thread's arena
+    };
+
+  private:
+    // extra memory used when the arena is full. Freed at the next reset.
+    struct chunk_t {
+      chunk_t *next;
+      size_t size;
+    };
+
+    // one arena per thread
+    struct arena_t {
+      uint8_t *base;        // the main block
+      size_t capacity;
+      uint8_t *ptr;         // next free byte in the current block
+      uint8_t *end;
+      uint8_t *last;        // most recent allocation, which can grow or shrink in place
+      chunk_t *chunks;      // overflow blocks, most recent first
+      size_t used;          // bytes allocated this frame, including overflow
+      unsigned epoch;       // frame this arena was last emptied in
+    };
+
+    // singleton state, a bit like an old-world global variable
+    struct state_t {
+      std::atomic<unsigned> epoch;
+      std::atomic<size_t> peak_bytes;
+
+      state_t() {
+        epoch = 0;
+        peak_bytes = 0;
+      }
+    };
+
+    #if OCTET_THREAD_EXIT
+      // frees the thread's arena when the thread exits.
+      struct thread_exit_t {
+        ~thread_exit_t() {
+          release_thread_arena();
+        }
+      };
+    #endif
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    static arena_t *&current() {
+      static OCTET_THREAD_LOCAL arena_t *instance;
+      return instance;
+    }
+
+    static size_t round_up(size_t size) {
+      return (size + alignment - 1) & ~(size_t)(alignment - 1);
+    }
+
+    static unsigned get_epoch() {
+      return state().epoch.load(std::memory_order_acquire);
+    }
+
+    // this thread's arena, emptied first if reset_all() has been called since it was last used.
+    static arena_t *get_arena() {
+      arena_t *a = current();
+      unsigned epoch = get_epoch();
+      if (!a) {
+        a = (arena_t*)allocator::malloc(sizeof(arena_t));
+        a->capacity = default_size;
+        a->base = (uint8_t*)allocator::malloc(a->capacity);
+        a->ptr = a->base;
+        a->end = a->base + a->capacity;
+        a->last = 0;
+        a->chunks = 0;
+        a->used = 0;
+        a->epoch = epoch;
+        current() = a;
+        #if OCTET_THREAD_EXIT
+          // the destructor is registered the first time each thread gets here.
+          static thread_local thread_exit_t on_exit;
+          (void)&on_exit;
+        #endif
+      } else if (a->epoch != epoch) {
+        reset_arena(a);
+        a->epoch = epoch;
+      }
+      return a;
+    }
+
+    // this thread's arena if it is in use this frame.
+    static arena_t *get_live_arena() {
+      arena_t *a = current();
+      return a && a->epoch == get_epoch() ? a : 0;
+    }
+
+    // empty an arena. The main block is resized to fit everything allocated this frame.
+    static void reset_arena(arena_t *a) {
+      state_t &s = state();
+      size_t peak = s.peak_bytes.load(std::memory_order_relaxed);
+      if (a->used > peak) s.peak_bytes.store(a->used, std::memory_order_relaxed);
+
+      size_t wanted = a->capacity;
+      if (a->chunks) {
+        // overflowed: grow so that the next frame fits in one block.
+        wanted = round_up(a->used + a->used / 2);
+      } else if (a->capacity > default_size && a->used < a->capacity / 4) {
+        // a loading spike should not pin a huge block for ever.
+        wanted = a->used * 2 > default_size ? round_up(a->used * 2) : default_size;
+      }
+
+      while (a->chunks) {
+        chunk_t *c = a->chunks;
+        a->chunks = c->next;
+        allocator::free(c, c->size);
+      }
+
+      if (wanted != a->capacity) {
+        allocator::free(a->base, a->capacity);
+        a->capacity = wanted;
+        a->base = (uint8_t*)allocator::malloc(wanted);
+      }
+      a->ptr = a->base;
+      a->end = a->base + a->capacity;
+      a->last = 0;
+      a->used = 0;
+    }
+
+  public:
+    /// allocate "size" bytes from this thread's arena.
+    static void *malloc(size_t size) {
+      arena_t *a = get_arena();
+      size = round_up(size);
+      if ((size_t)(a->end - a->ptr) < size) {
+        // arena full: chain an overflow block
+        size_t chunk_size = round_up(sizeof(chunk_t)) + (size > a->capacity ? size : a->capacity);
+        chunk_t *c = (chunk_t*)allocator::malloc(chunk_size);
+        c->next = a->chunks;
+        c->size = chunk_size;
+        a->chunks = c;
+        a->ptr = (uint8_t*)c + round_up(sizeof(chunk_t));
+        a->end = (uint8_t*)c + chunk_size;
+      }
+      uint8_t *res = a->ptr;
+      a->ptr += size;
+      a->used += size;
+      a->last = res;
+      return (void*)res;
+    }
+
+    /// memory is not reused until the end of the frame unless this is the most recent block.
+    static void free(void *ptr, size_t size) {
+      arena_t *a = get_live_arena();
+      if (a && ptr && ptr == a->last) {
+        a->used -= a->ptr - a->last;
+        a->ptr = a->last;
+        a->last = 0;
+      }
+    }
+
+    /// the most recent block grows in place if there is room.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      arena_t *a = get_arena();
+      if (ptr && ptr == a->last && (size_t)(a->end - a->last) >= round_up(size)) {
+        a->used += round_up(size) - (a->ptr - a->last);
+        a->ptr = a->last + round_up(size);
+        return ptr;
+      }
+      void *res = malloc(size);
+      if (ptr) {
+        memcpy(res, ptr, old_size < size ? old_size : size);
+      }
+      return res;
+    }
+
+    /// empty this thread's arena. Everything allocated from it is invalid afterwards.
+    static void reset() {
+      if (arena_t *a = current()) {
+        reset_arena(a);
+        a->epoch = get_epoch();
+      }
+    }
+
+    /// start a new frame. Call at the end of the frame.
+    /// Each thread's arena is emptied the next time that thread allocates, so memory a
+    /// thread allocated last frame stays valid until it allocates again.
+    static void reset_all() {
+      state().epoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    /// free this thread's arena.
+    /// This happens by itself when a thread exits, unless OCTET_THREAD_EXIT is 0.
+    static void release_thread_arena() {
+      arena_t *a = current();
+      if (!a) return;
+      reset_arena(a);
+      allocator::free(a->base, a->capacity);
+      allocator::free(a, sizeof(arena_t));
+      current() = 0;
+    }
+
+    /// bytes used by this thread's arena this frame.
+    static size_t get_num_bytes() {
+      arena_t *a = get_live_arena();
+      return a ? a->used : 0;
+    }
+
+    /// largest number of bytes any arena has used in one frame.
+    static size_t get_peak_bytes() {
+      return state().peak_bytes.load(std::memory_order_relaxed);
+    }
+  };
+} }
@@ -6,7 +6,10 @@
 //
 // map key_t to value_t.
 //
-// strings and values are owned by the dictionary.
+// Open addressing with a byte of control data per slot, probed sixteen at a time.
+// The control byte holds seven bits of the hash, so most slots are rejected
+// without looking at the key at all. Keys and values live in separate arrays
+// so probing does not pull values into the cache.
 //
 namespace octet { namespace containers {
 
@@ -34,73 +37,186 @@ namespace octet { namespace containers {
   /// Do not use for strings, use %dictionary instead.
   ///
   /// A hash map is like a dictionary in JavaScript or Python, but works with only one type of key and value.
+  /// Keys and values are plain data: they are copied bitwise and new values start as zero.
   ///
   /// Example:
   ///
   ///     hash_map<int, int> int_to_int;
   ///     int_to_int[5] = 7;
   ///     int_to_int[9] = 11;
+  ///     int_to_int.erase(9);
   ///     printf("[5]=%d [9]=%d\n", int_to_int[5], int_to_int[9]);
   ///
   ///     for (unsigned i = 0; i != int_to_int.size(); ++i) {
-  ///       printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///       if (int_to_int.is_used(i)) {
+  ///         printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///       }
   ///     }
   template <typename key_t, typename value_t, class cmp_t=hash_map_cmp, class allocator_t=allocator> class hash_map {
-    // internal gubbins to implement the hash map
-    struct entry_t { key_t key; unsigned hash; value_t value; };
+    enum {
+      group_size = 16,      // slots probed at a time
+      ctrl_empty = 0x80,    // never used
+      ctrl_deleted = 0xfe,  // erased, keep probing
+      // a used slot has the low seven bits of the hash as its control byte
+    };
 
-    entry_t *entries;
+    // one allocation: control bytes (with a copy of the first group at the end), keys, values.
+    uint8_t *ctrl;
+    key_t *keys;
+    value_t *values;
+    unsigned capacity;
     unsigned num_entries;
-    unsigned max_entries;
-
-    // internal method to find an existing key in the map
-    entry_t *find( const key_t &key, unsigned hash ) {
-      unsigned mask = max_entries - 1;
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
-        if (cmp_t::is_empty(entry->key)) {
-          return entry;
+    unsigned num_deleted;
+
+    // cmp_t hashes can be weak in the low bits, eg. for pointers.
+    static unsigned mix(unsigned h) {
+      h ^= h >> 16; h *= 0x85ebca6b;
+      h ^= h >> 13; h *= 0xc2b2ae35;
+      h ^= h >> 16;
+      return h;
+    }
+
+    static unsigned lowest_bit(unsigned bits) {
+      #if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return (unsigned)index;
+      #else
+        return (unsigned)__builtin_ctz(bits);
+      #endif
+    }
+
+    // bit i is set if control byte i of the group equals "value".
+    static unsigned match(const uint8_t *group, uint8_t value) {
+      #if OCTET_SSE2
+        __m128i g = _mm_loadu_si128((const __m128i*)group);
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)value)));
+      #else
+        unsigned bits = 0;
+        for (unsigned i = 0; i != group_size; ++i) {
+          bits |= (group[i] == value) << i;
+        }
+        return bits;
+      #endif
+    }
+
+    // bit i is set if slot i of the group is empty or deleted.
+    static unsigned match_free(const uint8_t *group) {
+      #if OCTET_SSE2
+        return (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+      #else
+        unsigned bits = 0;
+        for (unsigned i = 0; i != group_size; ++i) {
+          bits |= (group[i] >> 7) << i;
         }
-        if (entry->hash == hash && entry->key == key) {
-          return entry;
+        return bits;
+      #endif
+    }
+
+    static size_t ctrl_bytes(unsigned cap) {
+      return (cap + group_size + 15) & ~15;
+    }
+
+    static size_t keys_bytes(unsigned cap) {
+      return (sizeof(key_t) * cap + 15) & ~15;
+    }
+
+    static size_t alloc_bytes(unsigned cap) {
+      return ctrl_bytes(cap) + keys_bytes(cap) + sizeof(value_t) * cap;
+    }
+
+    void set_ctrl(unsigned index, uint8_t value) {
+      ctrl[index] = value;
+      if (index < group_size) ctrl[capacity + index] = value;
+    }
+
+    // internal method to find an existing key in the map. Returns -1 if absent.
+    int find(const key_t &key, unsigned hash) const {
+      if (!capacity) return -1;
+      unsigned mask = capacity - 1;
+      uint8_t h2 = (uint8_t)(hash & 0x7f);
+      unsigned pos = (hash >> 7) & mask;
+      for (unsigned step = group_size; ; step += group_size) {
+        const uint8_t *group = ctrl + pos;
+        for (unsigned bits = match(group, h2); bits; bits &= bits - 1) {
+          unsigned index = (pos + lowest_bit(bits)) & mask;
+          if (keys[index] == key) return (int)index;
         }
+        if (match(group, ctrl_empty)) return -1;
+        pos = (pos + step) & mask;
       }
-      assert(0 && "hash_map: all entries are used. expand() did not get called");
-      return 0;
     }
-  
-    // increase the size of the map if we have run out of space
-    void expand() {
-      entry_t *old_entries = entries;
-      unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
-      max_entries *= 2;
-      for (unsigned i = 0; i != old_max_entries; ++i) {
-        entry_t *old_entry = &old_entries[i];
-        if (!cmp_t::is_empty(old_entry->key)) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+
+    // find a slot to insert a key that is not in the map.
+    unsigned find_free(unsigned hash) const {
+      unsigned mask = capacity - 1;
+      unsigned pos = (hash >> 7) & mask;
+      for (unsigned step = group_size; ; step += group_size) {
+        unsigned bits = match_free(ctrl + pos);
+        if (bits) return (pos + lowest_bit(bits)) & mask;
+        pos = (pos + step) & mask;
+      }
+    }
+
+    // move everything to a new table, dropping deleted slots.
+    void rehash(unsigned new_capacity) {
+      uint8_t *old_ctrl = ctrl;
+      key_t *old_keys = keys;
+      value_t *old_values = values;
+      unsigned old_capacity = capacity;
+
+      uint8_t *block = (uint8_t*)allocator_t::malloc(alloc_bytes(new_capacity));
+      memset(block, ctrl_empty, ctrl_bytes(new_capacity));
+      memset(block + ctrl_bytes(new_capacity), 0, alloc_bytes(new_capacity) - ctrl_bytes(new_capacity));
+      ctrl = block;
+      keys = (key_t*)(block + ctrl_bytes(new_capacity));
+      values = (value_t*)(block + ctrl_bytes(new_capacity) + keys_bytes(new_capacity));
+      capacity = new_capacity;
+      num_deleted = 0;
+
+      for (unsigned i = 0; i != old_capacity; ++i) {
+        if (!(old_ctrl[i] & 0x80)) {
+          unsigned hash = mix(cmp_t::get_hash(old_keys[i]));
+          unsigned index = find_free(hash);
+          set_ctrl(index, (uint8_t)(hash & 0x7f));
+          memcpy(&keys[index], &old_keys[i], sizeof(key_t));
+          memcpy(&values[index], &old_values[i], sizeof(value_t));
         }
       }
-      allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
+
+      if (old_ctrl) {
+        allocator_t::free(old_ctrl, alloc_bytes(old_capacity));
+      }
+    }
+
+    // smallest table that holds "count" keys below the maximum load of 7/8.
+    static unsigned capacity_for(unsigned count) {
+      unsigned cap = group_size;
+      while (cap - cap / 8 < count) cap *= 2;
+      return cap;
     }
 
     void release() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
-      entries = 0;
-      num_entries = 0;
-      max_entries = 0;
+      if (ctrl) {
+        allocator_t::free(ctrl, alloc_bytes(capacity));
+      }
+      init();
     }
 
     void init() {
+      ctrl = 0;
+      keys = 0;
+      values = 0;
+      capacity = 0;
       num_entries = 0;
-      max_entries = 4;
-      entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
-      memset(entries, 0, sizeof(entry_t) * max_entries);
+      num_deleted = 0;
     }
+
+    // do not define this!
+    hash_map(const hash_map &rhs);
+    void operator=(const hash_map &rhs);
   public:
-    // Create an empty map.
+    // Create an empty map. No memory is allocated until the first key is added.
     hash_map() {
       init();
     }
@@ -108,71 +224,95 @@ namespace octet { namespace containers {
     /// Remove all keys and values from the hash map.
     void clear() {
       release();
-      init();
+    }
+
+    /// Make room for "count" keys without growing again.
+    void reserve(unsigned count) {
+      unsigned cap = capacity_for(count);
+      if (cap > capacity) rehash(cap);
     }
   
-    /// Access the map by key
+    /// Access the map by key. New values are zero.
     value_t &operator[]( const key_t &key ) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      if (cmp_t::is_empty(entry->key)) {
-        // reducing this ratio decreases hot search time at the
-        // expense of size (cold search time).
-        if (num_entries >= max_entries * 3 / 4) {
-          expand();
-          entry = find(key, hash);
-        }
-        num_entries++;
-        entry->key = key;
-        entry->hash = hash;
+      unsigned hash = mix(cmp_t::get_hash(key));
+      int index = find(key, hash);
+      if (index >= 0) {
+        return values[index];
+      }
+
+      // keep at least one empty slot in every probe sequence.
+      if (num_entries + num_deleted + 1 > capacity - capacity / 8) {
+        rehash(num_entries + 1 > capacity / 2 ? capacity_for(num_entries + 1) : capacity);
       }
-      return entry->value;
+      unsigned slot = find_free(hash);
+      num_deleted -= ctrl[slot] == ctrl_deleted;
+      num_entries++;
+      set_ctrl(slot, (uint8_t)(hash & 0x7f));
+      keys[slot] = key;
+      return values[slot];
+    }
+
+    /// Remove a key and its value. Returns false if the key was not there.
+    bool erase(const key_t &key) {
+      int index = find(key, mix(cmp_t::get_hash(key)));
+      if (index < 0) return false;
+      set_ctrl(index, ctrl_deleted);
+      memset(&keys[index], 0, sizeof(key_t));
+      memset(&values[index], 0, sizeof(value_t));
+      num_entries--;
+      num_deleted++;
+      return true;
     }
 
     /// Does the map have this key?
-    bool contains(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return !cmp_t::is_empty(entry->key);
+    bool contains(const key_t &key) const {
+      return find(key, mix(cmp_t::get_hash(key))) >= 0;
     }
 
-    /// Get an integer that represents the position in the map of this key.
+    /// Get an integer that represents the position in the map of this key, or -1 if absent.
     ///
     /// Note: only valid if the map does not change size.
-    int get_index(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return entry ? (int)(entry - entries) : -1;
+    int get_index(const key_t &key) const {
+      return find(key, mix(cmp_t::get_hash(key)));
+    }
+
+    /// True if this index holds a key.
+    bool is_used(int index) const {
+      assert((unsigned)index < capacity);
+      return !(ctrl[index] & 0x80);
     }
 
-    /// For a specfic index, get the key.
+    /// For a specfic index, get the key. Unused slots have zero keys.
     ///
     /// Used for iterating through the map or if using find()
     const key_t &get_key(int index) const {
-      assert((unsigned)index < max_entries);
-      return entries[index].key;
+      assert((unsigned)index < capacity);
+      return keys[index];
     }
 
     /// For a specific index, get the value
     const value_t &get_value(int index) const {
-      assert((unsigned)index < max_entries);
-      return entries[index].value;
+      assert((unsigned)index < capacity);
+      return values[index];
+    }
+
+    /// For a specific index, get a modifiable value
+    value_t &access_value(int index) {
+      assert((unsigned)index < capacity);
+      return values[index];
     }
 
     /// bye bye hash map
     ~hash_map() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
-      entries = 0;
-      num_entries = 0;
-      max_entries = 0;
+      release();
     }
 
-    /// Get the maximum number of keys and values in the map.
+    /// Get the number of slots in the map.
     ///
     /// Used for iteration.
-    unsigned size() { return max_entries; }
-    
-    //key_t key(unsigned i) { return entries[i].key; }
-    //value_t value(unsigned i) { return entries[i].value; }
+    unsigned size() const { return capacity; }
+
+    /// Get the number of keys in the map.
+    unsigned get_num_entries() const { return num_entries; }
   };
 } }
@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Double linked list using links stored in the items
+//
+// Unlike double_list, adding an item does not allocate a node: the links
+// live inside the item. An item can be on as many lists as it has links.
+//
+
+namespace octet { namespace containers {
+  /// Links for one intrusive_list. Put one of these in your class for every list it can be on.
+  class intrusive_list_node {
+    template <class item_t, intrusive_list_node item_t::*node> friend class intrusive_list;
+    intrusive_list_node *next;
+    intrusive_list_node *prev;
+
+    // do not define this!
+    intrusive_list_node(const intrusive_list_node &rhs);
+  public:
+    intrusive_list_node() {
+      next = prev = 0;
+    }
+
+    /// true if the item is on a list.
+    bool is_linked() const {
+      return next != 0;
+    }
+
+    /// take the item off its list, if it is on one.
+    void unlink() {
+      if (next) {
+        next->prev = prev;
+        prev->next = next;
+        next = prev = 0;
+      }
+    }
+
+    /// items are taken off their lists when they die.
+    ~intrusive_list_node() {
+      unlink();
+    }
+  };
+
+  /// Double linked list of items that hold their own links. The list does not own the items.
+  ///
+  /// Example
+  ///
+  ///     struct job {
+  ///       intrusive_list_node queue_link;
+  ///       ...
+  ///     };
+  ///
+  ///     intrusive_list<job, &job::queue_link> queue;
+  ///     queue.push_back(&my_job);
+  ///     job *next = queue.pop_front();
+  template <class item_t, intrusive_list_node item_t::*node> class intrusive_list {
+    intrusive_list_node head;
+
+    static intrusive_list_node *link(item_t *item) { return &(item->*node); }
+
+    // find the item from a pointer to its link.
+    static item_t *item_of(intrusive_list_node *n) {
+      return (item_t*)((char*)n - (size_t)&(((item_t*)0)->*node));
+    }
+
+    void insert_before(intrusive_list_node *pos, item_t *item) {
+      intrusive_list_node *n = link(item);
+      assert(!n->is_linked());
+      n->next = pos;
+      n->prev = pos->prev;
+      n->prev->next = n;
+      pos->prev = n;
+    }
+
+    // do not define this!
+    intrusive_list(const intrusive_list &rhs);
+  public:
+    /// make an empty list
+    intrusive_list() {
+      head.next = head.prev = &head;
+    }
+
+    /// the items are unlinked, but not deleted.
+    ~intrusive_list() {
+      clear();
+    }
+
+    /// STL-style iterator.
+    class iterator {
+      intrusive_list_node *n;
+      friend class intrusive_list;
+    public:
+      iterator(intrusive_list_node *n) { this->n = n; }
+      item_t *operator ->() { return item_of(n); }
+      item_t &operator *() { return *item_of(n); }
+      bool operator != (const iterator &rhs) const { return n != rhs.n; }
+      iterator &operator++() { n = n->next; return *this; }
+      iterator &operator--() { n = n->prev; return *this; }
+    };
+
+    /// get an iterator representing the first element in the list
+    iterator begin() {
+      return iterator(head.next);
+    }
+
+    /// get an iterator representing the end of the list
+    iterator end() {
+      return iterator(&head);
+    }
+
+    /// true if there are no items on the list.
+    bool empty() const {
+      return head.next == &head;
+    }
+
+    /// first item, or NULL
+    item_t *front() {
+      return empty() ? 0 : item_of(head.next);
+    }
+
+    /// last item, or NULL
+    item_t *back() {
+      return empty() ? 0 : item_of(head.prev);
+    }
+
+    /// add an item to the end of the list.
+    void push_back(item_t *item) {
+      insert_before(&head, item);
+    }
+
+    /// add an item to the start of the list.
+    void push_front(item_t *item) {
+      insert_before(head.next, item);
+    }
+
+    /// add an item before another item on this list.
+    void insert(item_t *pos, item_t *item) {
+      insert_before(link(pos), item);
+    }
+
+    /// take an item off the list.
+    void remove(item_t *item) {
+      link(item)->unlink();
+    }
+
+    /// take the first item off the list, or return NULL.
+    item_t *pop_front() {
+      item_t *item = front();
+      if (item) remove(item);
+      return item;
+    }
+
+    /// unlink all the items.
+    void clear() {
+      while (!empty()) {
+        head.next->unlink();
+      }
+    }
+  };
+} }
@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Pool of objects addressed by generational handles
+//
+// The objects are kept packed at the start of an array, so updating all
+// of them is a straight walk through memory. Removing an object moves the
+// last one into its place. Handles go through a slot table, so they stay
+// valid when objects move, and a generation count in each slot makes
+// handles to removed objects fail instead of finding a new object.
+//
+
+namespace octet { namespace containers {
+  /// Handle to an object in an object_pool. The default handle is never valid.
+  struct pool_handle {
+    uint32_t index;
+    uint32_t generation;
+
+    pool_handle() {
+      index = 0;
+      generation = 0;
+    }
+
+    pool_handle(uint32_t index, uint32_t generation) {
+      this->index = index;
+      this->generation = generation;
+    }
+
+    /// true if this handle was never set.
+    bool is_null() const {
+      return generation == 0;
+    }
+
+    bool operator==(const pool_handle &rhs) const { return index == rhs.index && generation == rhs.generation; }
+    bool operator!=(const pool_handle &rhs) const { return !(*this == rhs); }
+  };
+
+  /// Packed array of objects with stable handles. Adding and removing does not allocate once reserved.
+  ///
+  /// Example
+  ///
+  ///     object_pool<particle> particles;
+  ///     pool_handle h = particles.add(particle(pos));
+  ///     if (particle *p = particles.get(h)) p->age++;
+  ///     particles.remove(h);
+  ///     // particles.get(h) is now NULL
+  template <class item_t, class allocator_t=allocator> class object_pool {
+    struct slot_t {
+      uint32_t generation;  // odd: in use. even: free.
+      uint32_t index;       // dense index if in use, next free slot if free
+    };
+
+    enum { no_slot = 0xffffffff };
+
+    dynarray<item_t, allocator_t> items;
+    dynarray<uint32_t, allocator_t> item_slot;  // slot of each dense item
+    dynarray<slot_t, allocator_t> slots;
+    uint32_t free_slot;
+
+    // do not define this!
+    object_pool(const object_pool &rhs);
+
+    // give the item just added to the end of items a slot.
+    uint32_t new_slot() {
+      uint32_t s = free_slot;
+      if (s == no_slot) {
+        s = (uint32_t)slots.size();
+        slot_t slot = { 0, 0 };
+        slots.push_back(slot);
+      } else {
+        free_slot = slots[s].index;
+      }
+      slots[s].generation++;
+      slots[s].index = (uint32_t)items.size() - 1;
+      item_slot.push_back(s);
+      return s;
+    }
+
+    const slot_t *find(pool_handle h) const {
+      if (h.index >= slots.size()) return 0;
+      const slot_t *slot = &slots[h.index];
+      return slot->generation == h.generation ? slot : 0;
+    }
+
+  public:
+    object_pool() {
+      free_slot = no_slot;
+    }
+
+    /// make room for "size" objects without allocating.
+    void reserve(unsigned size) {
+      items.reserve(size);
+      item_slot.reserve(size);
+      slots.reserve(size);
+    }
+
+    /// add a copy of an object.
+    pool_handle add(const item_t &item) {
+      return emplace(item);
+    }
+
+    /// construct a new object from constructor arguments.
+    template <class... args_t> pool_handle emplace(args_t&&... args) {
+      items.emplace_back(std::forward<args_t>(args)...);
+      uint32_t s = new_slot();
+      return pool_handle(s, slots[s].generation);
+    }
+
+    /// remove an object. The last object takes its place. Does nothing if the handle is stale.
+    void remove(pool_handle h) {
+      const slot_t *slot = find(h);
+      if (!slot) return;
+      uint32_t i = slot->index;
+      uint32_t last = (uint32_t)items.size() - 1;
+      if (i != last) {
+        items[i] = std::move(items[last]);
+        item_slot[i] = item_slot[last];
+        slots[item_slot[i]].index = i;
+      }
+      items.pop_back();
+      item_slot.pop_back();
+
+      slot_t &s = slots[h.index];
+      s.generation++;
+      s.index = free_slot;
+      free_slot = h.index;
+    }
+
+    /// get an object from its handle, or NULL if it has been removed.
+    item_t *get(pool_handle h) {
+      const slot_t *slot = find(h);
+      return slot ? &items[slot->index] : 0;
+    }
+
+    /// get an object from its handle, or NULL if it has been removed.
+    const item_t *get(pool_handle h) const {
+      const slot_t *slot = find(h);
+      return slot ? &items[slot->index] : 0;
+    }
+
+    /// true if the handle refers to an object in the pool.
+    bool is_valid(pool_handle h) const {
+      return find(h) != 0;
+    }
+
+    /// get the handle of the object at a dense index.
+    pool_handle get_handle(unsigned i) const {
+      uint32_t s = item_slot[i];
+      return pool_handle(s, slots[s].generation);
+    }
+
+    /// remove all the objects. Existing handles become stale.
+    void clear() {
+      while (items.size()) {
+        remove(get_handle(items.size() - 1));
+      }
+    }
+
+    /// object at a dense index, 0..size()-1. Indices change when objects are removed.
+    item_t &operator[](unsigned i) { return items[i]; }
+
+    /// object at a dense index, 0..size()-1. Indices change when objects are removed.
+    const item_t &operator[](unsigned i) const { return items[i]; }
+
+    /// number of objects in the pool
+    unsigned size() const { return (unsigned)items.size(); }
+
+    /// true if there are no objects
+    bool empty() const { return items.size() == 0; }
+
+    /// start of the packed objects, for range-based for loops
+    item_t *begin() { return items.data(); }
+
+    /// end of the packed objects, for range-based for loops
+    item_t *end() { return items.data() + items.size(); }
+  };
+} }
@@ -0,0 +1,225 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Dynamic array with space for a few items inside the object
+//
+// Short lists such as the parts of a split string usually fit in the
+// inline space and never call the allocator. Longer lists move to the
+// heap like an ordinary dynarray.
+//
+
+namespace octet { namespace containers {
+  /// Dynamic array that holds up to N items without allocating.
+  ///
+  /// Example
+  ///
+  ///     small_dynarray<string, 8> parts;
+  ///     url.split(parts, "&");    // no allocation for up to eight short parts
+  ///
+  /// Note: use this for locals. The inline space makes the object large.
+  template <class item_t, unsigned N, class allocator_t=allocator> class small_dynarray {
+    typedef unsigned int_size_t;
+
+    item_t *data_;
+    int_size_t size_;
+    int_size_t capacity_;
+    typename std::aligned_storage<sizeof(item_t) * (N ? N : 1), std::alignment_of<item_t>::value>::type inline_;
+
+    item_t *inline_data() { return (item_t*)&inline_; }
+
+    bool is_inline() const { return (const void*)data_ == (const void*)&inline_; }
+
+    void grow(int_size_t new_size) {
+      if (new_size > capacity_) {
+        // N may be zero, so start from a few items rather than doubling nothing.
+        int_size_t new_capacity = capacity_ * 2 < 4 ? 4 : capacity_ * 2;
+        while (new_capacity < new_size) new_capacity *= 2;
+        reserve(new_capacity);
+      }
+    }
+
+    void init() {
+      data_ = inline_data();
+      size_ = 0;
+      capacity_ = N;
+    }
+
+    // take the items of rhs, leaving it empty.
+    void take(small_dynarray &rhs) {
+      if (rhs.is_inline()) {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != rhs.size_; ++i) {
+          new (data_ + i, x) item_t(std::move(rhs.data_[i]));
+          rhs.data_[i].~item_t();
+        }
+        size_ = rhs.size_;
+        rhs.size_ = 0;
+      } else {
+        data_ = rhs.data_;
+        size_ = rhs.size_;
+        capacity_ = rhs.capacity_;
+        rhs.init();
+      }
+    }
+
+  public:
+    /// Create a new, empty array.
+    small_dynarray() {
+      init();
+    }
+
+    /// Create a copy of an array.
+    small_dynarray(const small_dynarray &rhs) {
+      init();
+      append(rhs.data_, rhs.size_);
+    }
+
+    /// Take the contents of another array, leaving it empty.
+    small_dynarray(small_dynarray &&rhs) {
+      init();
+      take(rhs);
+    }
+
+    /// Replace the contents with a copy of another array.
+    small_dynarray &operator=(const small_dynarray &rhs) {
+      if (this != &rhs) {
+        resize(0);
+        append(rhs.data_, rhs.size_);
+      }
+      return *this;
+    }
+
+    /// Replace the contents with those of another array, leaving it empty.
+    small_dynarray &operator=(small_dynarray &&rhs) {
+      if (this != &rhs) {
+        reset();
+        take(rhs);
+      }
+      return *this;
+    }
+
+    /// Destroy the array and its contents.
+    ~small_dynarray() {
+      reset();
+    }
+
+    /// Make room for "new_capacity" items.
+    void reserve(int_size_t new_capacity) {
+      if (new_capacity <= capacity_) return;
+      item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
+      if (is_relocatable<item_t>::value) {
+        memcpy((void*)new_data, data_, size_ * sizeof(item_t));
+      } else {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != size_; ++i) {
+          new (new_data + i, x) item_t(std::move(data_[i]));
+          data_[i].~item_t();
+        }
+      }
+      if (!is_inline()) {
+        allocator_t::free(data_, capacity_ * sizeof(item_t));
+      }
+      data_ = new_data;
+      capacity_ = new_capacity;
+    }
+
+    /// Resize the array, default constructing new items.
+    void resize(int_size_t new_size) {
+      dynarray_dummy_t x;
+      grow(new_size);
+      while (size_ < new_size) {
+        new (data_ + size_, x) item_t;
+        size_++;
+      }
+      while (size_ > new_size) {
+        --size_;
+        data_[size_].~item_t();
+      }
+    }
+
+    /// Empty the array and free any heap memory.
+    void reset() {
+      resize(0);
+      if (!is_inline()) {
+        allocator_t::free(data_, capacity_ * sizeof(item_t));
+      }
+      init();
+    }
+
+    /// Add an item at the back of the array.
+    void push_back(const item_t &new_item) {
+      emplace_back(new_item);
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      emplace_back(std::move(new_item));
+    }
+
+    /// Construct an item at the back of the array from constructor arguments.
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      dynarray_dummy_t x;
+      if (size_ == capacity_) {
+        // the arguments may refer to items in this array.
+        item_t tmp(std::forward<args_t>(args)...);
+        grow(size_ + 1);
+        return *new (data_ + size_++, x) item_t(std::move(tmp));
+      }
+      return *new (data_ + size_++, x) item_t(std::forward<args_t>(args)...);
+    }
+
+    /// Add "num" items copied from "src" to the back of the array.
+    void append(const item_t *src, int_size_t num) {
+      dynarray_dummy_t x;
+      grow(size_ + num);
+      for (int_size_t i = 0; i != num; ++i) {
+        new (data_ + size_ + i, x) item_t(src[i]);
+      }
+      size_ += num;
+    }
+
+    /// Shrink the size of the array by one.
+    void pop_back() {
+      assert(size_ != 0);
+      data_[--size_].~item_t();
+    }
+
+    /// Get the last element in the array.
+    item_t &back() const {
+      assert(size_);
+      return data_[size_-1];
+    }
+
+    /// Return true if the array is empty.
+    bool empty() const {
+      return size_ == 0;
+    }
+
+    /// Access an element in the array.
+    item_t &operator[](size_t elem) { return data_[elem]; }
+
+    /// Read an element in the array.
+    const item_t &operator[](size_t elem) const { return data_[elem]; }
+
+    /// Return number of elements in the array
+    int_size_t size() const { return size_; }
+
+    /// Return the number of elements in the array before we have to reallocate the memory
+    int_size_t capacity() const { return capacity_; }
+
+    /// Get a constant pointer to the first element of the array.
+    const item_t *data() const { return data_; }
+
+    /// Get a pointer to the first element of the array.
+    item_t *data() { return data_; }
+
+    /// start of the items, for range-based for loops
+    item_t *begin() { return data_; }
+
+    /// end of the items, for range-based for loops
+    item_t *end() { return data_ + size_; }
+  };
+} }
@@ -21,16 +21,71 @@ namespace octet { namespace containers {
   /// This string class has the ability to perform a few common operations such as formatting
   /// and url encode/decode.
   ///
+  /// Short strings (up to 23 bytes) are stored inside the string object and do not use the allocator.
+  ///
   class string {
-    char *data_;
-
-    static char *null_string() { static char c; return &c; }
+    enum { inline_capacity = 23 };
+
+    // short text is stored in place of the heap pointer.
+    union {
+      char *heap_;
+      char inline_[inline_capacity + 1];
+    };
+    unsigned size_;       // bytes, not including the terminator
+    unsigned capacity_;   // heap bytes, not including the terminator. Zero if the text is inline.
+
+    char *text() { return capacity_ ? heap_ : inline_; }
+    const char *text() const { return capacity_ ? heap_ : inline_; }
+
+    void init() {
+      inline_[0] = 0;
+      size_ = 0;
+      capacity_ = 0;
+    }
 
     void release() {
-      if (data_ != null_string()) {
-        allocator::free((void*)data_, size() + 1);
-        data_ = null_string();
+      if (capacity_) {
+        allocator::free((void*)heap_, capacity_ + 1);
+      }
+      init();
+    }
+
+    // make room for "new_capacity" bytes, keeping the text.
+    void reserve(unsigned new_capacity) {
+      if (new_capacity <= (capacity_ ? capacity_ : (unsigned)inline_capacity)) return;
+      if (capacity_) {
+        heap_ = (char*)allocator::realloc((void*)heap_, capacity_ + 1, new_capacity + 1);
+      } else {
+        char *new_heap = (char*)allocator::malloc(new_capacity + 1);
+        memcpy(new_heap, inline_, size_ + 1);
+        heap_ = new_heap;
+      }
+      capacity_ = new_capacity;
+    }
+
+    // make the string "size" bytes long, with undefined contents, and return the text.
+    char *alloc_text(unsigned size) {
+      if (size > (capacity_ ? capacity_ : (unsigned)inline_capacity)) {
+        release();
+        heap_ = (char*)allocator::malloc(size + 1);
+        capacity_ = size;
       }
+      size_ = size;
+      char *dest = text();
+      dest[size] = 0;
+      return dest;
+    }
+
+    // add bytes to the end, growing geometrically.
+    void append(const char *value, unsigned size) {
+      if (size_ + size > (capacity_ ? capacity_ : (unsigned)inline_capacity)) {
+        unsigned cap = capacity_ * 2;
+        reserve(cap > size_ + size ? cap : size_ + size);
+      }
+      char *dest = text();
+      memcpy(dest + size_, value, size);
+      size_ += size;
+      dest[size_] = 0;
     }
 
     // When dealing with windows or java, we will come across the less popular
@@ -145,19 +200,25 @@ namespace octet { namespace containers {
     }
   public:
     /// Default constructor: empty string.
-    string() { data_ = null_string(); }
+    string() { init(); }
 
     /// Copy a UTF8 C string
-    string(const char *value) { data_ = null_string(); *this = value; }
+    string(const char *value) { init(); *this = value; }
     
     /// Copy of a UFT16 C string
-    string(const wchar_t *value) { data_ = null_string(); *this = value; }
+    string(const wchar_t *value) { init(); *this = value; }
     
     /// Copy of another string
-    string(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); }
+    string(const string& rhs) { init(); set(rhs.c_str(), rhs.size_); }
+
+    /// Take the text of another string, leaving it empty
+    string(string &&rhs) {
+      memcpy((void*)this, (void*)&rhs, sizeof(string));
+      rhs.init();
+    }
     
     /// Copy of a substring
-    string(const char *value, unsigned size) { data_ = null_string(); set(value, size); }
+    string(const char *value, unsigned size) { init(); set(value, size); }
 
     /// Free up memory used by the string.
     ~string() { release(); }
@@ -169,7 +230,7 @@ namespace octet { namespace containers {
     ///     string my_path;
     ///     my_path.format("%s/%s.dat", path, filename);
     string &format(const char *fmt, ...) {
-      release();
+      truncate(0);
       va_list v;
       va_start(v, fmt);
       vformat(fmt, v);
@@ -177,6 +238,7 @@ namespace octet { namespace containers {
       return *this;
     }
 
+    /// Format a string using sprintf, appending to the string.
     string &printf(const char *fmt, ...) {
       va_list v;
       va_start(v, fmt);
@@ -187,16 +249,11 @@ namespace octet { namespace containers {
 
     void vformat(const char *fmt, va_list v) {
       #ifdef WIN32
-        size_t cur_len = strlen(data_);
         int len = _vscprintf(fmt, v);
-        if (len) {
-          if (cur_len) {
-            data_ = (char*)allocator::realloc(data_, cur_len+1, cur_len + len + 1);
-            vsprintf_s(data_ + cur_len, len+1, fmt, v);
-          } else {
-            data_ = (char*)allocator::malloc(len+1);
-            vsprintf_s(data_, len+1, fmt, v);
-          }
+        if (len > 0) {
+          reserve(size_ + len);
+          vsprintf_s(text() + size_, len+1, fmt, v);
+          size_ += len;
         }
       #else
         char tmp[1024];
@@ -207,106 +264,95 @@ namespace octet { namespace containers {
 
     /// Decode url strings - to turn them into filenames, for example.
     string &urldecode(const char *value) {
-      release();
+      truncate(0);
       if (value) {
         unsigned size = urldecode_impl(0, value);
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          urldecode_impl(data_, value);
-        }
+        urldecode_impl(alloc_text(size), value);
       }
       return *this;
     }
 
     /// encode url strings - to turn them into URLs, for example
     string &urlencode(const char *value) {
-      release();
+      truncate(0);
       if (value) {
         unsigned size = urlencode_impl(0, value);
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          urlencode_impl(data_, value);
-        }
+        urlencode_impl(alloc_text(size), value);
       }
       return *this;
     }
 
     // copy a utf8 string - unix, mac and the web.
     string &operator=(const char *value) {
-      release();
-      if (value) {
-        size_t size = strlen(value);
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          memcpy((char*)data_, value, size+1);
-        }
-      }
-      return *this;
+      return set(value, value ? (unsigned)strlen(value) : 0);
     }
 
     // copy utf16 unicode strings - microsoft & java
     string &operator=(const wchar_t *value) {
-      release();
+      truncate(0);
       if (value) {
         unsigned size = utf16_to_utf8(0, value);
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          utf16_to_utf8(data_, value);
-        }
+        utf16_to_utf8(alloc_text(size), value);
       }
       return *this;
     }
 
     /// copy another string
-    string &operator=(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); return *this; }
+    string &operator=(const string& rhs) {
+      if (this != &rhs) {
+        set(rhs.c_str(), rhs.size_);
+      }
+      return *this;
+    }
+
+    /// Take the text of another string, leaving it empty
+    string &operator=(string &&rhs) {
+      if (this != &rhs) {
+        release();
+        memcpy((void*)this, (void*)&rhs, sizeof(string));
+        rhs.init();
+      }
+      return *this;
+    }
 
     /// copy a substring
     string &set(const char *value, unsigned size) {
-      release();
-      if (value) {
-        if (size) {
-          data_ = (char*)allocator::malloc(size+1);
-          memcpy((char*)data_, value, size);
-          data_[size] = 0;
-        }
+      if (!value) size = 0;
+      // value may point into this string
+      if (size > (capacity_ ? capacity_ : (unsigned)inline_capacity)) {
+        string tmp;
+        memcpy(tmp.alloc_text(size), value, size);
+        return *this = static_cast<string&&>(tmp);
       }
+      char *dest = text();
+      memmove(dest, value, size);
+      dest[size] = 0;
+      size_ = size;
       return *this;
     }
 
     /// shorten a string to a new length
     string &truncate(int new_len) {
-      int size = (int)strlen(data_);
-      if (new_len < size) {
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(new_len+1);
-        } else {
-          data_ = (char*)allocator::realloc((void*)data_, size+1, new_len+1);
-        }
-        data_[new_len] = 0;
+      if ((unsigned)new_len < size_) {
+        size_ = (unsigned)new_len;
+        text()[new_len] = 0;
       }
       return *this;
     }
 
     /// compare two strings
-    bool operator==(const char *rhs) const { return strcmp(data_, rhs) == 0; }
+    bool operator==(const char *rhs) const { return strcmp(text(), rhs) == 0; }
     /// compare two strings
-    bool operator!=(const char *rhs) const { return strcmp(data_, rhs) != 0; }
+    bool operator!=(const char *rhs) const { return strcmp(text(), rhs) != 0; }
     /// compare two strings
-    bool operator<(const char *rhs) const { return strcmp(data_, rhs) < 0; }
+    bool operator<(const char *rhs) const { return strcmp(text(), rhs) < 0; }
     /// compare two strings
-    bool operator>(const char *rhs) const { return strcmp(data_, rhs) > 0; }
+    bool operator>(const char *rhs) const { return strcmp(text(), rhs) > 0; }
 
     /// Append to a string. Note: it is generally better to use format.
     string &operator+=(const char *rhs) {
       if (rhs) {
-        size_t data_size = strlen(data_);
-        size_t rhs_size = strlen(rhs);
-        if (data_ == null_string()) {
-          data_ = (char*)allocator::malloc(data_size+rhs_size+1);
-        } else {
-          data_ = (char*)allocator::realloc(data_, data_size + 1, data_size+rhs_size+1);
-        }
-        memcpy(data_ + data_size, rhs, rhs_size+1);
+        append(rhs, (unsigned)strlen(rhs));
       }
       return *this;
     }
@@ -314,23 +360,22 @@ namespace octet { namespace containers {
     /// Insert a substring.
     string &insert(unsigned pos, const char *rhs) {
       if (rhs) {
-        size_t data_size = strlen(data_);
-        size_t rhs_size = strlen(rhs);
-        char *new_data = (char*)allocator::malloc(data_size+rhs_size+1);
-        memcpy(new_data, data_, pos);
-        memcpy(new_data + pos, rhs, rhs_size);
-        memcpy(new_data + pos + rhs_size, data_, data_size - pos + 1);
-        release();
-        data_ = new_data;
+        unsigned rhs_size = (unsigned)strlen(rhs);
+        string result;
+        char *dest = result.alloc_text(size_ + rhs_size);
+        memcpy(dest, text(), pos);
+        memcpy(dest + pos, rhs, rhs_size);
+        memcpy(dest + pos + rhs_size, text() + pos, size_ - pos + 1);
+        *this = static_cast<string&&>(result);
       }
       return *this;
     }
 
     /// Find a substring.
     int find(const char *rhs) const {
-      char *d = strstr(data_, rhs);
+      const char *d = strstr(text(), rhs);
       if (d) {
-        return (int)(d - data_);
+        return (int)(d - text());
       }
       return -1;
     }
@@ -338,12 +383,12 @@ namespace octet { namespace containers {
     /// Find the position of the extension in a file path.
     int extension_pos() const {
       int res = -1;
-      for (const char *p = data_; *p; ++p) {
+      for (const char *p = text(); *p; ++p) {
         char chr = *p;
         if (chr == '/' || chr == '\\') {
           res = -1;  // note  /usr/fred.jim/harry   has no extension
         } else if (chr == '.') {
-          res = (int)(p - data_);
+          res = (int)(p - text());
         }
       }
       return res;
@@ -352,60 +397,63 @@ namespace octet { namespace containers {
     /// Find the position of a filename in a file path
     int filename_pos() const  {
       int res = 0;
-      for (const char *p = data_; *p; ++p) {
+      for (const char *p = text(); *p; ++p) {
         char chr = *p;
         if (chr == '/' || chr == '\\') {
-          res = (int)(p - data_ + 1);
+          res = (int)(p - text() + 1);
         }
       }
       return res;
     }
 
     /// Number of bytes in a string. Note: this is not the number of characters.
-    int size() { return (int)strlen(data_); }
+    int size() const { return (int)size_; }
 
     /// Get a C string from this string.
-    const char *c_str() const { return data_; }
+    const char *c_str() const { return text(); }
     /// Get a C string from this string.
-    operator const char *() { return data_; }
+    operator const char *() const { return text(); }
 
-    /// raw data access
+    /// raw data access. Do not change the length of the text through this pointer.
     char *data() const {
-      return data_;
+      return const_cast<string*>(this)->text();
     }
 
     /// Get/set a byte from the string.
-    char &operator[](int index) { return data_[index]; }
+    char &operator[](int index) { return text()[index]; }
     
     /// Get a byte from the string.
-    char operator[](int index) const { return data_[index]; }
+    char operator[](int index) const { return text()[index]; }
 
     /// python-style string split.
     ///
+    /// The result can be a dynarray<string> or a small_dynarray<string, N>.
+    ///
     /// Example.
     ///
-    ///     dynarray<string> parts;
+    ///     small_dynarray<string, 8> parts;
     ///     string my_csv = "100,fred,bert,harry";
     ///     my_csv.split(parts, ",")
     ///     // parts now contains four strings: "100", "fred", "bert", "harry"
-    void split(dynarray<string> &result, const char *delimiter) {
+    template <class array_t> void split(array_t &result, const char *delimiter) const {
       result.resize(0);
-      char *cur = data_;
+      const char *cur = text();
       unsigned delim_len = (unsigned)strlen(delimiter);
       for(;;) {
-        char *next = strstr(cur, delimiter);
+        const char *next = strstr(cur, delimiter);
         if (!next) break;
-        result.push_back(string());
-        result.back().set(cur, (int)(next - cur));
+        result.emplace_back(cur, (unsigned)(next - cur));
         cur = next + delim_len;
       }
-      result.push_back(string());
-      result.back() = cur;
+      result.emplace_back(cur);
     }
 
     /// return true if the string is empty.
-    bool empty() {
-      return size() == 0;
+    bool empty() const {
+      return size_ == 0;
     }
   };
+
+  /// strings do not point into themselves, so arrays of strings can grow with realloc.
+  template <> struct is_relocatable<string> { enum { value = 1 }; };
 } }
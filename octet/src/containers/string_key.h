@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Strong string hash and pre-hashed string keys
+//
+// hash_bytes follows the structure of wyhash: 64 bit multiplies folded
+// into 64 bits, reading eight or sixteen bytes at a time. It is fast on
+// short keys like names and atoms and has far fewer collisions than
+// shift-and-xor hashes.
+//
+
+namespace octet { namespace containers {
+  /// Hash a block of bytes to 64 bits.
+  class string_hash {
+    static uint64_t secret(unsigned i) {
+      static const uint64_t values[] = {
+        0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+      };
+      return values[i];
+    }
+
+    // 64x64 -> 128 bit multiply. a gets the low half, b the high half.
+    static void mum(uint64_t &a, uint64_t &b) {
+      #if defined(__SIZEOF_INT128__)
+        __uint128_t r = (__uint128_t)a * b;
+        a = (uint64_t)r;
+        b = (uint64_t)(r >> 64);
+      #elif defined(_MSC_VER) && defined(_M_X64)
+        a = _umul128(a, b, &b);
+      #else
+        uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32);
+        uint64_t c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        a = lo;
+        b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+      #endif
+    }
+
+    // multiply and fold the halves together
+    static uint64_t mix(uint64_t a, uint64_t b) {
+      mum(a, b);
+      return a ^ b;
+    }
+
+    // unaligned little-endian reads
+    static uint64_t r8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    static uint64_t r4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint64_t r3(const uint8_t *p, size_t k) {
+      return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+    }
+
+  public:
+    /// hash "size" bytes at "data"
+    static uint64_t hash_bytes(const void *data, size_t size, uint64_t seed=0) {
+      const uint8_t *p = (const uint8_t*)data;
+      seed ^= mix(seed ^ secret(0), secret(1));
+      uint64_t a, b;
+      if (size <= 16) {
+        if (size >= 4) {
+          size_t mid = (size >> 3) << 2;
+          a = (r4(p) << 32) | r4(p + mid);
+          b = (r4(p + size - 4) << 32) | r4(p + size - 4 - mid);
+        } else if (size > 0) {
+          a = r3(p, size);
+          b = 0;
+        } else {
+          a = b = 0;
+        }
+      } else {
+        size_t i = size;
+        if (i > 48) {
+          uint64_t see1 = seed, see2 = seed;
+          do {
+            seed = mix(r8(p) ^ secret(1), r8(p + 8) ^ seed);
+            see1 = mix(r8(p + 16) ^ secret(2), r8(p + 24) ^ see1);
+            see2 = mix(r8(p + 32) ^ secret(3), r8(p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+          } while (i > 48);
+          seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+          seed = mix(r8(p) ^ secret(1), r8(p + 8) ^ seed);
+          i -= 16;
+          p += 16;
+        }
+        a = r8(p + i - 16);
+        b = r8(p + i - 8);
+      }
+      a ^= secret(1);
+      b ^= seed;
+      mum(a, b);
+      return mix(a ^ secret(0) ^ size, b ^ secret(1));
+    }
+  };
+
+  /// A string view with its hash calculated once.
+  ///
+  /// Use this as a handle for names that are looked up often.
+  /// The text is not copied, so it must outlive the key.
+  ///
+  /// Example:
+  ///
+  ///     static const string_key diffuse_key("diffuse");
+  ///     int index = my_dict.get_index(diffuse_key);  // no hashing, no strlen
+  class string_key {
+    const char *data_;
+    unsigned size_;
+    uint64_t hash_;
+  public:
+    /// make a key from a zero terminated string
+    string_key(const char *text) {
+      data_ = text ? text : "";
+      size_ = (unsigned)strlen(data_);
+      hash_ = string_hash::hash_bytes(data_, size_);
+    }
+
+    /// make a key from part of a string.
+    string_key(const char *text, unsigned size) {
+      data_ = text;
+      size_ = size;
+      hash_ = string_hash::hash_bytes(text, size);
+    }
+
+    /// the text of the key (not zero terminated for partial strings)
+    const char *data() const { return data_; }
+
+    /// number of bytes in the key
+    unsigned size() const { return size_; }
+
+    /// the 64 bit hash of the text
+    uint64_t get_hash() const { return hash_; }
+  };
+} }
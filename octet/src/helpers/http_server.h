@@ -8,6 +8,9 @@
 // HTTP server for debugging game code and building game editors.
 
 namespace octet { namespace helpers {
+  // allocation profiler tag for the sessions and receive buffer
+  OCTET_ALLOC_TAG(http_server_buffers)
+
   /// Class for exposing game object to web browsers.
   class http_server {
     enum { port = 8888 };
@@ -21,43 +24,64 @@ namespace octet { namespace helpers {
     ref<resource_dict> dict;
 
     // client sessions active
-    dynarray<session> sessions;
+    dynarray<session, tagged_allocator<http_server_buffers> > sessions;
 
     // temporary buffer used for send/recieve
-    dynarray<char> buf;
+    dynarray<char, tagged_allocator<http_server_buffers> > buf;
 
     void set_non_blocking(int socket) {
       unsigned long mode = 1;
       ioctlsocket(socket, FIONBIO, &mode);
     }
 
+    // send a plain text page, eg. the allocation report.
+    void send_text(session &s, const string &text) {
+      string response_header;
+      response_header.format(
+        "HTTP/1.1 200 OK\n"
+        "Content-Type: text/plain; charset=UTF-8\n"
+        "Content-Length: %d\n"
+        "\n",
+        text.size()
+      );
+      send(s.client_socket, response_header.c_str(), response_header.size(), 0);
+      send(s.client_socket, text.c_str(), text.size(), 0);
+    }
+
     void parse_http_request(session &s, char *p) {
       string header(p);
 
-      dynarray<string> lines;
-      lines.reserve(32);
+      small_dynarray<string, 32, http_writer::allocator_t> lines;
       header.split(lines, "\n");
       if (lines.size() == 0) return;
 
-      dynarray<string> line0;
+      small_dynarray<string, 4> line0;
       lines[0].split(line0, " ");
       if (line0.size() < 3) return;
       if (line0[0] != "GET") return;
 
       log("http get from: %s\n", line0[1].c_str());
 
+      // /alloc: allocation profile
+      if (line0[1] == "/alloc") {
+        string text;
+        alloc_profiler::report(text);
+        send_text(s, text);
+        return;
+      }
+
       // /graph?operation=get_children&id=1
-      dynarray<string> url;
+      small_dynarray<string, 4> url;
       line0[1].split(url, "?");
       if (url.size() < 2) return;
 
-      dynarray<string> ops;
+      small_dynarray<string, 8> ops;
       url[1].split(ops, "&");
       string id;
       string callback;
       bool get_children = false;
       for (unsigned i = 0; i != ops.size(); ++i) {
-        dynarray<string> lhsrhs;
+        small_dynarray<string, 4> lhsrhs;
         ops[i].split(lhsrhs, "=");
         if (lhsrhs[0] == "operation") {
           get_children = lhsrhs[1] == "get_children";
@@ -74,7 +98,8 @@ namespace octet { namespace helpers {
       //dynarray<string> id_parts;
       //id.split(id_parts, ".");
 
-      dynarray<string> response;
+      // the response only lives until it is sent, so it uses frame memory.
+      http_writer::response_t response;
       response.reserve(64);
       int max_depth = 5;
       http_writer writer(0, max_depth, response);
@@ -8,7 +8,21 @@
 // jpeg file decoder - tiny and fast
 //
 // See http://en.wikipedia.org/wiki/JPEG
-// 
+//
+// The inverse DCT is the Arai, Agui and Nakajima (AAN) factorisation in 16 bit
+// fixed point. AAN has only five multiplies in each 1D pass because the rest of
+// the scaling is folded into the quantisation tables. With SSE2, a row of
+// eight coefficients fits in one register, so each pass works on the whole
+// block at once. Colour conversion and chroma upsampling also work on eight
+// pixels at a time. The plain C versions give the same results bit for bit.
+//
+// Huffman codes of up to nine bits, nearly all of them, are decoded with one
+// table lookup.
+//
+// If the file has restart markers (DRI), each restart interval can be decoded
+// on its own, so the intervals are shared out between the worker threads.
+// Each thread keeps its own DC predictions and MCU buffers in a mcu_state.
+//
 namespace octet { namespace loaders {
   class jpeg_decoder {
     enum { debug = 0 };
@@ -32,22 +46,69 @@ namespace octet { namespace loaders {
     unsigned num_mcu_blocks;
     unsigned num_components_in_scan;
 
-    // skip a number of bits in the file.
-    // there is a special case where every 0xff byte is followed by 0x00
-    static void skip_bits(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
-      shift -= bits;
-      while (shift < 0) {
-        // grab more bytes
-        uint8_t byte = *src++;
-        acc = acc * 256 + byte;
-        if (byte == 0xff) {
-          // in JPEG, an 0xff byte is followed by a zero
-          // do not advance past any other 0xff marker
-          src += src[0] == 0x00 ? 1 : -1;
+    // number of MCUs between restart markers, 0 for none
+    unsigned restart_interval;
+
+    // reads bits from the entropy coded data, most significant bit first.
+    // there is a special case where every 0xff byte is followed by 0x00.
+    // At a marker or the end of the data, we feed in zeros and do not advance.
+    struct bit_reader {
+      const uint8_t *src;
+      const uint8_t *src_max;
+      uint64_t buf;       // next bits to read are at the top
+      unsigned bits;      // number of valid bits in buf
+
+      void init(const uint8_t *src_, const uint8_t *src_max_) {
+        src = src_;
+        src_max = src_max_;
+        buf = 0;
+        bits = 0;
+        refill();
+      }
+
+      // fill the buffer to at least 57 bits
+      void refill() {
+        while (bits <= 56) {
+          unsigned byte = 0;
+          if (src < src_max) {
+            byte = src[0];
+            if (byte != 0xff) {
+              src++;
+            } else if (src + 1 < src_max && src[1] == 0x00) {
+              src += 2;
+            } else {
+              byte = 0;
+            }
+          }
+          buf |= (uint64_t)byte << (56 - bits);
+          bits += 8;
         }
-        shift += 8;
       }
-    }
+
+      // huffman codes and values are at most 16 bits each.
+      void refill_for_code() {
+        if (bits < 32) refill();
+      }
+
+      // look at the next n (1..32) bits
+      unsigned peek(unsigned n) const {
+        return (unsigned)(buf >> (64 - n));
+      }
+
+      void skip(unsigned n) {
+        buf <<= n;
+        bits -= n;
+      }
+
+      // read n bits as a signed coefficient.
+      // negative numbers need to be twiddled as all numbers coming in are positive.
+      int get_signed(unsigned n) {
+        if (n == 0) return 0;
+        unsigned v = peek(n);
+        skip(n);
+        return v < ( 1u << ( n-1 ) ) ? (int)v - ( 1 << n ) + 1 : (int)v;
+      }
+    };
 
     // this is a component usually Y (brightness), Cb (blueness) and Cr (redness)
     // from the file.
@@ -69,13 +130,14 @@ namespace octet { namespace loaders {
       uint8_t dc_table;
       unsigned width_in_blocks;
       unsigned height_in_blocks;
-      int last_dc;
     } scan_components[4];
 
     // quantisation table. We multiply the dc and ac coefficients by these numbers.
-    // this is the lossy part of the compression
+    // this is the lossy part of the compression.
+    // The AAN scale factors for each coefficient are folded in, with two extra bits of precision
+    // for the DCT and eight fraction bits, as the scale factors are not whole numbers.
     struct quant_table {
-      float table[64];
+      int32_t table[64];
     } quant_tables[4];
 
     // A huffman table maps variable length codes to lengths and values.
@@ -83,26 +145,40 @@ namespace octet { namespace loaders {
     // where each code is distinct from the previous one, even if it has more bits.
     // (ie. 100(0) and 100(1) are less than 1010).
     struct huffman_table {
-      unsigned min_len;
+      enum { lookahead_bits = 9 };
+
+      // (length << 8) | value for every code of up to lookahead_bits, 0 for longer codes.
+      uint16_t lookahead[1 << lookahead_bits];
       uint8_t huffval[257];
       uint16_t maxcodes[17];
       uint16_t offset[17];
 
-      // decode a variable length huffman code
+      // decode a variable length huffman code.
+      // Short codes come straight from the lookahead table. For longer ones
       // we grab the next 16 bits and look in the maxcodes table to see how many
       // bits the code has. After that, we strip the right hand bits and
       // look up the code in a table.
-      unsigned decode(unsigned &acc, const uint8_t *&src, int &shift) {
-        unsigned i = min_len;
-        unsigned short acc16 = acc >> shift;
+      OCTET_HOT unsigned decode(bit_reader &reader) const {
+        unsigned entry = lookahead[reader.peek(lookahead_bits)];
+        if (entry) {
+          reader.skip(entry >> 8);
+          return entry & 0xff;
+        }
+
+        unsigned acc16 = reader.peek(16);
+        unsigned i = lookahead_bits;
+        for (; i != 16 && acc16 > maxcodes[i]; ++i) {
+        }
 
-        // find the shortest code that this could be
-        for (; acc16 > maxcodes[i]; ++i) {
+        if (i == 16) {
+          // not a valid code
+          reader.skip(16);
+          return 0;
         }
 
         unsigned code = ( acc16 >> (15-i) ) - offset[i];
-        skip_bits(i + 1, acc, src, shift);
-        return huffval[code];
+        reader.skip(i + 1);
+        return huffval[code & 0xff];
       }
     } huffman_tables[2][4];
 
@@ -113,11 +189,29 @@ namespace octet { namespace loaders {
       huffman_table *dc_table;
       huffman_table *ac_table;
       quant_table *quant;
-      scan_component *scan_comp;
-    } mcu_blocks[8];
+      unsigned scan_index;      // which scan component, for the DC prediction
+      unsigned sample_offset;   // where the 8x8 pixels go in mcu_state::samples
+      unsigned sample_stride;
+    } mcu_blocks[10];
 
-    float dct_coeffs[8*64];
-    float ycrcb_values[8*64];
+    // size of the MCU in blocks. Chroma is always one block.
+    unsigned mcu_hsamp;
+    unsigned mcu_vsamp;
+
+    enum { plane_size = 256 };
+
+    // everything that changes while decoding MCUs. One for each thread.
+    struct mcu_state {
+      // DC coefficients are stored as the difference from the previous block.
+      // They start again from zero after each restart marker.
+      int last_dc[4];
+
+      int16_t dct_coeffs[64];
+
+      // pixels of one MCU after the inverse DCT.
+      // Y is at 0 (up to 16x16), Cb at 256 and Cr at 512 (8x8 each)
+      uint8_t samples[plane_size * 3];
+    };
 
     unsigned u2(const uint8_t *src) {
       return src[0] * 256 + src[1];
@@ -125,7 +219,7 @@ namespace octet { namespace loaders {
 
     // dct coefficients are stored in zig-zag order because the top
     // left is far more common.
-    uint8_t zig_zag(unsigned i) {
+    static uint8_t zig_zag(unsigned i) {
       static const uint8_t zig_zag_[64] = {
         0, 1, 8, 16, 9, 2, 3, 10,
         17, 24, 32, 25, 18, 11, 4, 5,
@@ -139,218 +233,330 @@ namespace octet { namespace loaders {
       return i < 63 ? zig_zag_[i] : 63;
     }
 
-    // negative numbers need to be twiddled as all numbers coming in are positive.
-    static int extend(unsigned bits, unsigned &acc, const uint8_t *&src, int &shift) {
-      uint16_t acc16 = acc >> shift;
-      unsigned v = acc16 >> (16 - bits);
-      return v < ( 1u << ( bits-1 ) ) ? (int)v + ( -1 << bits ) + 1 : (int)v;
-    }
-
     // decode one block of an MCU which may contain many blocks
     // The Y component may have four blocks, for example, and only one each of Cr, Cb
-    void decode_mcu_block(unsigned block_num, unsigned &acc, const uint8_t *&src, int &shift, float *outptr) {
-      mcu_block &block = mcu_blocks[block_num];
-
-      unsigned value = block.dc_table->decode(acc, src, shift);
-
-      int dc = 0;
-      if (value) {
-        dc = extend(value, acc, src, shift);
-        skip_bits(value, acc, src, shift);
-        //if (debug) printf("dc=%d\n", dc);
-      }
-      int abs_dc = block.scan_comp->last_dc += dc;
-      outptr[0] = abs_dc * block.quant->table[0];
-
-      for (int ac_coef = 1; ac_coef < 64; ++ac_coef) {
-        unsigned value = block.ac_table->decode(acc, src, shift);
+    // returns false if only the DC coefficient is set.
+    OCTET_HOT bool decode_mcu_block(unsigned block_num, bit_reader &reader, int16_t *outptr, int *last_dc) const {
+      const mcu_block &block = mcu_blocks[block_num];
+      const int32_t *quant = block.quant->table;
+      const huffman_table *ac_table = block.ac_table;
+
+      reader.refill_for_code();
+      unsigned value = block.dc_table->decode(reader);
+
+      int dc = reader.get_signed(value);
+      int abs_dc = last_dc[block.scan_index] += dc;
+      outptr[0] = (int16_t)(((int64_t)abs_dc * quant[0] + 128) >> 8);
+
+      bool has_ac = false;
+      for (unsigned ac_coef = 1; ac_coef < 64; ) {
+        reader.refill_for_code();
+        unsigned value = ac_table->decode(reader);
         unsigned skip = value >> 4;
         value &= 0x0f;
-        ac_coef += skip;
 
         if (value) {
-          int ac = extend(value, acc, src, shift);
-          skip_bits(value, acc, src, shift);
-          //if (debug) printf("ac=%d,%d coef=%d zig_zag=%d\n", skip, ac, ac_coef, zig_zag(ac_coef));
-          outptr[zig_zag(ac_coef)] = (float)ac * block.quant->table[ac_coef];
-        } else if (skip != 15) {
+          ac_coef += skip;
+          if (ac_coef >= 64) break;
+          int ac = reader.get_signed(value);
+          outptr[zig_zag(ac_coef)] = (int16_t)(((int64_t)ac * quant[ac_coef] + 128) >> 8);
+          has_ac = true;
+          ac_coef++;
+        } else if (skip == 15) {
+          ac_coef += 16;
+        } else {
           break;
         }
       }
-      if (debug) {
-        for (int j = 0; j != 8; ++j) {
-          for (int i = 0; i != 8; ++i) {
-            printf("%3.0f ", outptr[i+j*8]);
-          }
-          printf("\n");
-        }
-      }
+      return has_ac;
     }
 
-    // one dimensional inverse DCT.
+    // multiply by fractions of 65536, eg. 27146 is 0.414213562 * 65536
+    // The 16 bit adds and subtracts wrap round in the plain C version, just like SSE2.
+    #if OCTET_SSE2
+      struct i16x8 {
+        __m128i v;
+        i16x8() {}
+        i16x8(__m128i v) : v(v) {}
+        i16x8 operator+(i16x8 b) const { return _mm_add_epi16(v, b.v); }
+        i16x8 operator-(i16x8 b) const { return _mm_sub_epi16(v, b.v); }
+        i16x8 mul_frac(int16_t k) const { return _mm_mulhi_epi16(v, _mm_set1_epi16(k)); }
+      };
+    #else
+      struct i16x8 {
+        int16_t v[8];
+        i16x8 operator+(const i16x8 &b) const { i16x8 r; for (int i = 0; i != 8; ++i) r.v[i] = (int16_t)(v[i] + b.v[i]); return r; }
+        i16x8 operator-(const i16x8 &b) const { i16x8 r; for (int i = 0; i != 8; ++i) r.v[i] = (int16_t)(v[i] - b.v[i]); return r; }
+        i16x8 mul_frac(int16_t k) const { i16x8 r; for (int i = 0; i != 8; ++i) r.v[i] = (int16_t)((v[i] * k) >> 16); return r; }
+      };
+    #endif
+
+    // one dimensional inverse DCT on eight columns at once (AAN).
     // c0 is the DC term and c1..c7 increase in frequency
     // example: c0 = 128, c1..c7 = 0 -> 128, 128, 128, 128, 128, 128, 128, 128
-    // todo: improve this!
-    OCTET_HOT void idct(float &c0, float &c1, float &c2, float &c3, float &c4, float &c5, float &c6, float &c7) {
-      float c2c6_1 = (c2 + c6) * 0.541196100f;
-      float c2c6_2 = c2c6_1 + c6 * -1.847759065f;
-      float c2c6_3 = c2c6_1 + c2 * 0.765366865f;
-    
-      float c0c4_1 = c0 + c4;
-      float c0c4_2 = c0 - c4;
-    
-      float ceven_1 = c0c4_1 + c2c6_3;
-      float ceven_2 = c0c4_1 - c2c6_3;
-      float ceven_3 = c0c4_2 + c2c6_2;
-      float ceven_4 = c0c4_2 - c2c6_2;
-    
-      float c1c7 = c7 + c1;
-      float c3c5 = c5 + c3;
-      float c7c3 = c7 + c3;
-      float c5c1 = c5 + c1;
-      float codd_0 = (c7c3 + c5c1) * 1.175875602f;
-    
-      float codd_4 = c7 * 0.298631336f;
-      float codd_3 = c5 * 2.053119869f;
-      float codd_2 = c3 * 3.072711026f;
-      float codd_1 = c1 * 1.501321110f;
-      c1c7 = c1c7 * -0.899976223f;
-      c3c5 = c3c5 * -2.562915447f;
-      c7c3 = c7c3 * -1.961570560f;
-      c5c1 = c5c1 * -0.390180644f;
-    
-      c7c3 += codd_0;
-      c5c1 += codd_0;
-    
-      codd_4 += c1c7 + c7c3;
-      codd_3 += c3c5 + c5c1;
-      codd_2 += c3c5 + c7c3;
-      codd_1 += c1c7 + c5c1;
-    
-      c0 = ceven_1 + codd_1;
-      c7 = ceven_1 - codd_1;
-      c1 = ceven_3 + codd_2;
-      c6 = ceven_3 - codd_2;
-      c2 = ceven_4 + codd_3;
-      c5 = ceven_4 - codd_3;
-      c3 = ceven_2 + codd_4;
-      c4 = ceven_2 - codd_4;
+    // The inputs are pre-scaled by the quantisation table.
+    static OCTET_HOT void idct(i16x8 *c) {
+      // even part
+      i16x8 tmp10 = c[0] + c[4];
+      i16x8 tmp11 = c[0] - c[4];
+      i16x8 tmp13 = c[2] + c[6];
+      i16x8 c2c6 = c[2] - c[6];
+      i16x8 tmp12 = c2c6 + c2c6.mul_frac(27146) - tmp13;   // * 1.414213562
+
+      i16x8 even0 = tmp10 + tmp13;
+      i16x8 even3 = tmp10 - tmp13;
+      i16x8 even1 = tmp11 + tmp12;
+      i16x8 even2 = tmp11 - tmp12;
+
+      // odd part
+      i16x8 z13 = c[5] + c[3];
+      i16x8 z10 = c[5] - c[3];
+      i16x8 z11 = c[1] + c[7];
+      i16x8 z12 = c[1] - c[7];
+
+      i16x8 odd7 = z11 + z13;
+      i16x8 z11z13 = z11 - z13;
+      i16x8 odd11 = z11z13 + z11z13.mul_frac(27146);         // * 1.414213562
+      i16x8 z10z12 = z10 + z12;
+      i16x8 z5 = z10z12 + z10z12 - z10z12.mul_frac(9977);     // * 1.847759065
+      i16x8 odd10 = z12 + z12.mul_frac(5400) - z5;           // * 1.082392200
+      i16x8 odd12 = z5 - (z10 + z10 + z10 - z10.mul_frac(25354)); // * -2.613125930
+
+      i16x8 odd6 = odd12 - odd7;
+      i16x8 odd5 = odd11 - odd6;
+      i16x8 odd4 = odd10 + odd5;
+
+      c[0] = even0 + odd7;
+      c[7] = even0 - odd7;
+      c[1] = even1 + odd6;
+      c[6] = even1 - odd6;
+      c[2] = even2 + odd5;
+      c[5] = even2 - odd5;
+      c[4] = even3 + odd4;
+      c[3] = even3 - odd4;
+    }
+
+    // swap rows and columns of an 8x8 block
+    static OCTET_HOT void transpose(i16x8 *r) {
+      #if OCTET_SSE2
+        __m128i a0 = _mm_unpacklo_epi16(r[0].v, r[1].v), a1 = _mm_unpackhi_epi16(r[0].v, r[1].v);
+        __m128i a2 = _mm_unpacklo_epi16(r[2].v, r[3].v), a3 = _mm_unpackhi_epi16(r[2].v, r[3].v);
+        __m128i a4 = _mm_unpacklo_epi16(r[4].v, r[5].v), a5 = _mm_unpackhi_epi16(r[4].v, r[5].v);
+        __m128i a6 = _mm_unpacklo_epi16(r[6].v, r[7].v), a7 = _mm_unpackhi_epi16(r[6].v, r[7].v);
+        __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+        __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+        __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+        __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+        r[0] = _mm_unpacklo_epi64(b0, b4); r[1] = _mm_unpackhi_epi64(b0, b4);
+        r[2] = _mm_unpacklo_epi64(b1, b5); r[3] = _mm_unpackhi_epi64(b1, b5);
+        r[4] = _mm_unpacklo_epi64(b2, b6); r[5] = _mm_unpackhi_epi64(b2, b6);
+        r[6] = _mm_unpacklo_epi64(b3, b7); r[7] = _mm_unpackhi_epi64(b3, b7);
+      #else
+        for (int j = 0; j != 8; ++j) {
+          for (int i = j + 1; i != 8; ++i) {
+            int16_t tmp = r[j].v[i];
+            r[j].v[i] = r[i].v[j];
+            r[i].v[j] = tmp;
+          }
+        }
+      #endif
     }
 
     // Two dimensional inverse DCT
-    // we can do the rows and columns separately.
-    // Optimisations include spotting blank rows and columns, but this
-    // is just a reference design.
-    void inverse_dct(float *inptr) {
-      // do rows
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*0+i], inptr[8*1+i], inptr[8*2+i], inptr[8*3+i], inptr[8*4+i], inptr[8*5+i], inptr[8*6+i], inptr[8*7+i]);
+    // we can do the columns and rows separately.
+    // The results are clamped to 0..255 and stored in 8x8 pixels at outptr.
+    static OCTET_HOT void inverse_dct(uint8_t *outptr, unsigned stride, int16_t *inptr, bool has_ac) {
+      // 128 to make unsigned pixels and 0.5 to round.
+      // Only the DC term is affected, which is never multiplied.
+      // The output is scaled by 8 (the DCT) and 4 (the quantisation tables).
+      inptr[0] = (int16_t)(inptr[0] + (128 << 5) + (1 << 4));
+
+      if (!has_ac) {
+        // flat block, common in smooth areas.
+        int v = inptr[0] >> 5;
+        uint8_t pixel = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+        for (unsigned j = 0; j != 8; ++j) {
+          memset(outptr + j * stride, pixel, 8);
+        }
+        return;
       }
 
+      i16x8 rows[8];
+      #if OCTET_SSE2
+        for (unsigned j = 0; j != 8; ++j) {
+          rows[j] = _mm_loadu_si128((const __m128i*)(inptr + j * 8));
+        }
+      #else
+        memcpy(rows, inptr, sizeof(rows));
+      #endif
+
       // do columns
-      for (unsigned i = 0; i != 8; ++i) {
-        idct(inptr[8*i+0], inptr[8*i+1], inptr[8*i+2], inptr[8*i+3], inptr[8*i+4], inptr[8*i+5], inptr[8*i+6], inptr[8*i+7]);
-      }
+      idct(rows);
+      transpose(rows);
 
-      if (debug) {
-        for (int j = 0; j != 8; ++j) {
-          for (int i = 0; i != 8; ++i) {
-            printf("%f ", inptr[i+j*8]);
+      // do rows
+      idct(rows);
+      transpose(rows);
+
+      #if OCTET_SSE2
+        for (unsigned j = 0; j != 8; j += 2) {
+          __m128i pixels = _mm_packus_epi16(_mm_srai_epi16(rows[j].v, 5), _mm_srai_epi16(rows[j+1].v, 5));
+          _mm_storel_epi64((__m128i*)(outptr + j * stride), pixels);
+          _mm_storel_epi64((__m128i*)(outptr + (j+1) * stride), _mm_srli_si128(pixels, 8));
+        }
+      #else
+        for (unsigned j = 0; j != 8; ++j) {
+          for (unsigned i = 0; i != 8; ++i) {
+            int v = rows[j].v[i] >> 5;
+            outptr[j * stride + i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
           }
-          printf("\n");
         }
-      }
+      #endif
     }
 
-    // clamp to 0..255 range without using branches.
-    // fabsf is usually implemented in hardware (with fast math options)
-    OCTET_HOT uint8_t clamp(float v) {
-      // v + fabsf(v) = 2v when v > 0
-      // v + fabsf(v) = 0  when v < 0
-      float clamp0 = v + fabsf(v);
-
-      // v - fabsf(v-n) = n when v > n
-      // v - fabsf(v-n) = 2v - n when v < n
-      return (uint8_t)( ( clamp0 - fabsf( clamp0 - (255.999f * 2) ) ) * 0.25f + 128 );
+    // convert from YCrCb to RGB
+    // See http://en.wikipedia.org/wiki/YCbCr
+    // 16 bit fixed point with four fraction bits.
+    // cb and cr are 8 bit samples, repeated if upsampling.
+    static OCTET_HOT void color_convert_8(uint8_t *outptr, const uint8_t *y, const uint8_t *cb, const uint8_t *cr) {
+      #if OCTET_SSE2
+        __m128i zero = _mm_setzero_si128();
+        __m128i c128 = _mm_set1_epi16(128);
+        __m128i yv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)y), zero);
+        __m128i cbv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)cb), zero);
+        __m128i crv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)cr), zero);
+        __m128i y4 = _mm_add_epi16(_mm_slli_epi16(yv, 4), _mm_set1_epi16(8));
+        __m128i cb7 = _mm_slli_epi16(_mm_sub_epi16(cbv, c128), 7);
+        __m128i cr7 = _mm_slli_epi16(_mm_sub_epi16(crv, c128), 7);
+
+        __m128i r = _mm_srai_epi16(_mm_add_epi16(y4, _mm_mulhi_epi16(cr7, _mm_set1_epi16(11485))), 4);
+        __m128i g = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(y4, _mm_mulhi_epi16(cb7, _mm_set1_epi16(2819))), _mm_mulhi_epi16(cr7, _mm_set1_epi16(5850))), 4);
+        __m128i b = _mm_srai_epi16(_mm_add_epi16(y4, _mm_mulhi_epi16(cb7, _mm_set1_epi16(14516))), 4);
+
+        __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+        __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8((char)0xff));
+        _mm_storeu_si128((__m128i*)outptr, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i*)(outptr + 16), _mm_unpackhi_epi16(rg, ba));
+      #else
+        for (unsigned i = 0; i != 8; ++i) {
+          int y4 = y[i] * 16 + 8;
+          int cb7 = (int16_t)((cb[i] - 128) * 128);
+          int cr7 = (int16_t)((cr[i] - 128) * 128);
+          int r = (y4 + ((cr7 * 11485) >> 16)) >> 4;
+          int g = (y4 - ((cb7 * 2819) >> 16) - ((cr7 * 5850) >> 16)) >> 4;
+          int b = (y4 + ((cb7 * 14516) >> 16)) >> 4;
+          outptr[0] = (uint8_t)(r < 0 ? 0 : r > 255 ? 255 : r);
+          outptr[1] = (uint8_t)(g < 0 ? 0 : g > 255 ? 255 : g);
+          outptr[2] = (uint8_t)(b < 0 ? 0 : b > 255 ? 255 : b);
+          outptr[3] = 0xff;
+          outptr += 4;
+        }
+      #endif
     }
 
     // convert from Y to RGB
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444_greyscale(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
+    static OCTET_HOT void color_convert_greyscale_8(uint8_t *outptr, const uint8_t *y) {
+      #if OCTET_SSE2
+        __m128i yv = _mm_loadl_epi64((const __m128i*)y);
+        __m128i yy = _mm_unpacklo_epi8(yv, yv);
+        __m128i ya = _mm_unpacklo_epi8(yv, _mm_set1_epi8((char)0xff));
+        _mm_storeu_si128((__m128i*)outptr, _mm_unpacklo_epi16(yy, ya));
+        _mm_storeu_si128((__m128i*)(outptr + 16), _mm_unpackhi_epi16(yy, ya));
+      #else
         for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f);
-          outptr[1] = clamp(128 + y * 0.125f);
-          outptr[2] = clamp(128 + y * 0.125f);
+          outptr[0] = outptr[1] = outptr[2] = y[i];
           outptr[3] = 0xff;
           outptr += 4;
         }
-        outptr += stride - 32;
+      #endif
+    }
+
+    // convert a MCU to RGBA, upsampling the chroma if the Y component has 2x1, 1x2 or 2x2 blocks.
+    // The chroma samples are repeated, as in the original decoder.
+    OCTET_HOT void color_convert(uint8_t *outptr, int stride, const uint8_t *samples) const {
+      const uint8_t *y = samples;
+      const uint8_t *cb = samples + plane_size;
+      const uint8_t *cr = samples + plane_size * 2;
+      unsigned y_stride = mcu_hsamp * 8;
+      unsigned num_rows = mcu_vsamp * 8;
+
+      if (num_components_in_scan == 1) {
+        for (unsigned j = 0; j != num_rows; ++j) {
+          for (unsigned i = 0; i != y_stride; i += 8) {
+            color_convert_greyscale_8(outptr + i * 4, y + j * y_stride + i);
+          }
+          outptr += stride;
+        }
+      } else {
+        uint8_t cb2[16], cr2[16];
+        for (unsigned j = 0; j != num_rows; ++j) {
+          const uint8_t *cb_row = cb + (j / mcu_vsamp) * 8;
+          const uint8_t *cr_row = cr + (j / mcu_vsamp) * 8;
+          if (mcu_hsamp == 2) {
+            #if OCTET_SSE2
+              __m128i cbv = _mm_loadl_epi64((const __m128i*)cb_row);
+              __m128i crv = _mm_loadl_epi64((const __m128i*)cr_row);
+              _mm_storeu_si128((__m128i*)cb2, _mm_unpacklo_epi8(cbv, cbv));
+              _mm_storeu_si128((__m128i*)cr2, _mm_unpacklo_epi8(crv, crv));
+            #else
+              for (unsigned i = 0; i != 8; ++i) {
+                cb2[i*2] = cb2[i*2+1] = cb_row[i];
+                cr2[i*2] = cr2[i*2+1] = cr_row[i];
+              }
+            #endif
+            color_convert_8(outptr, y + j * y_stride, cb2, cr2);
+            color_convert_8(outptr + 32, y + j * y_stride + 8, cb2 + 8, cr2 + 8);
+          } else {
+            color_convert_8(outptr, y + j * y_stride, cb_row, cr_row);
+          }
+          outptr += stride;
+        }
       }
     }
 
-    // convert from YCrCb to RGB
-    // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_444(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y = inptr[0];
-          float cb = inptr[64];
-          float cr = inptr[128];
-          inptr++;
-          outptr[0] = clamp(128 + y * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
+    // decode MCUs [begin, end) of a scan into the image.
+    OCTET_HOT void decode_mcus(mcu_state &state, bit_reader &reader, unsigned begin, unsigned end, unsigned xmax, uint8_t *image_base, int stride) const {
+      for (unsigned mcu = begin; mcu != end; ++mcu) {
+        unsigned x = mcu % xmax;
+        unsigned y = mcu / xmax;
+        for (unsigned b = 0; b < num_mcu_blocks; ++b) {
+          memset(state.dct_coeffs, 0, sizeof(state.dct_coeffs));
+          bool has_ac = decode_mcu_block(b, reader, state.dct_coeffs, state.last_dc);
+          const mcu_block &m = mcu_blocks[b];
+          inverse_dct(state.samples + m.sample_offset, m.sample_stride, state.dct_coeffs, has_ac);
         }
-        outptr += stride - 32;
+        // the image is stored upside down for OpenGL
+        unsigned top = y * mcu_vsamp * 8;
+        color_convert(&image_base[((height - 1 - top) * stride) + (x * mcu_hsamp * 8 * 4)], -stride, state.samples);
       }
     }
 
-    // convert from YCrCb to RGB
-    // See http://en.wikipedia.org/wiki/YCbCr
-    // The 0.125 scaling factor is because the DCT data has a scale of 8
-    void color_convert_411(uint8_t *outptr, int stride, float *inptr) {
-      for (unsigned j = 0; j != 8; ++j) {
-        for (unsigned i = 0; i != 8; ++i) {
-          float y0 = inptr[0x00];
-          float y1 = inptr[0x40];
-          float y2 = inptr[0x80];
-          float y3 = inptr[0xc0];
-          float cb = inptr[0x100];
-          float cr = inptr[0x140];
-          inptr++;
-          outptr[0] = clamp(128 + y0 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y0 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y0 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y1 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y1 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y1 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += stride - 4;
-          outptr[0] = clamp(128 + y2 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y2 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y2 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += 4;
-          outptr[0] = clamp(128 + y3 * 0.125f + cr * (1.402f * 0.125f));
-          outptr[1] = clamp(128 + y3 * 0.125f - cb * (0.34414f * 0.125f) - cr * (0.71414f * 0.125f));
-          outptr[2] = clamp(128 + y3 * 0.125f + cb * (1.772f * 0.125f));
-          outptr[3] = 0xff;
-          outptr += -stride + 4;
+    // find the entropy coded data after each restart marker (RST0-7) and the marker that ends the scan.
+    static const uint8_t *find_restart_intervals(dynarray<const uint8_t *> &starts, const uint8_t *src, const uint8_t *src_end) {
+      starts.push_back(src);
+      for (;;) {
+        src = (const uint8_t *)memchr(src, 0xff, src_end - src);
+        if (!src || src + 1 >= src_end) {
+          return src_end;
+        }
+        uint8_t code = src[1];
+        if (code == 0x00) {
+          // stuffed zero
+          src += 2;
+        } else if (code == 0xff) {
+          // fill byte
+          src++;
+        } else if (code >= 0xd0 && code <= 0xd7) {
+          src += 2;
+          starts.push_back(src);
+        } else {
+          return src;
         }
-        outptr += stride*2 - 64;
       }
     }
 
     // JPEG files are split up into chunks starting with 0xff
-    unsigned decode_chunk(const uint8_t *src, dynarray<uint8_t> &image, uint16_t &format) {
+    unsigned decode_chunk(const uint8_t *src, const uint8_t *src_end, dynarray<uint8_t> &image, uint16_t &format, worker_pool &pool) {
       if (debug) printf("decode_chunk %02x\n", src[1]);
 
       unsigned length = 2;
@@ -391,14 +597,14 @@ namespace octet { namespace loaders {
             c.quantisation_table = src[10 + i*3 + 2] & 3;
             if (debug) printf("id=%d h=%d v=%d q=%d\n", c.id, c.hsamp, c.vsamp, c.quantisation_table);
           }
-          
+
         } break;
 
         // huffman tables
         case 0xc4: {
           length = u2(src + 2) + 2;
-          src += 4;
           const uint8_t *src_max = src + length;
+          src += 4;
           while (src + 17 <= src_max) {
             unsigned index = src[0];
             unsigned is_ac = (index >> 4) & 1;
@@ -414,18 +620,21 @@ namespace octet { namespace loaders {
             memcpy(h.huffval, src, count);
             src += count;
 
+            memset(h.lookahead, 0, sizeof(h.lookahead));
             unsigned dest = 0;
             unsigned code = 0;
-            h.min_len = 0;
-            bool done_min_len = false;
             for (unsigned len = 1; len < 17; ++len) {
               h.offset[len-1] = code - dest;
-              if (!done_min_len && num_codes[len-1]) {
-                h.min_len = len - 1;
-                done_min_len = true;
-              }
               for (unsigned i = 0; i != num_codes[len-1]; ++i) {
                 if (debug) printf("code=%04x len=%d\n", ( ( code + i ) << (16 - len) ), len );
+                if (len <= huffman_table::lookahead_bits) {
+                  // every lookahead with this code at the top
+                  unsigned first = ( code + i ) << (huffman_table::lookahead_bits - len);
+                  unsigned last = first + ( 1 << (huffman_table::lookahead_bits - len) );
+                  for (unsigned j = first; j < last && j < (1 << huffman_table::lookahead_bits); ++j) {
+                    h.lookahead[j] = (uint16_t)(len << 8 | h.huffval[dest + i]);
+                  }
+                }
               }
               dest += num_codes[len-1];
               code = code + num_codes[len-1];
@@ -434,7 +643,7 @@ namespace octet { namespace loaders {
               if (debug) printf("h.maxcodes[%d] = %04x\n", len-1, h.maxcodes[len-1]);
             }
             h.maxcodes[16] = 0xffff;
-            
+
             if (debug) printf("DHT %d\n", index);
           }
         } break;
@@ -453,17 +662,24 @@ namespace octet { namespace loaders {
         case 0xda: {
           const uint8_t *src0 = src;
           length = u2(src + 2) + 2;
+          const uint8_t *src_max = src + length;
           src += 4;
           num_components_in_scan = *src++;
           unsigned max_hsamp = 1;
           unsigned max_vsamp = 1;
           num_mcu_blocks = 0;
-          const uint8_t *src_max = src + length;
+
+          if (num_components_in_scan != 1 && num_components_in_scan != 3) {
+            printf("only greyscale and ycrcb supported (%d components in scan)\n", num_components_in_scan);
+            return 0;
+          }
+
           for (unsigned i = 0; i != num_components_in_scan; ++i) {
             scan_component &sc = scan_components[i];
             unsigned id = *src++;
             sc.ac_table = *src & 0x0f;
-            sc.dc_table = *src++ >> 4;
+            sc.dc_table = (*src++ >> 4) & 3;
+            sc.ac_table &= 3;
             unsigned comp = 0;
             while (comp < num_components) {
               if (components[comp].id == id) break;
@@ -471,33 +687,36 @@ namespace octet { namespace loaders {
             }
             if (comp >= num_components) return 0;
             component &c = components[comp];
-            max_hsamp = c.hsamp > max_hsamp ? c.hsamp : max_hsamp;
-            max_vsamp = c.vsamp > max_vsamp ? c.vsamp : max_vsamp;
             sc.comp = comp;
             if (debug) printf("SOS comp=%d ac=%d dc=%d\n", comp, sc.ac_table, sc.dc_table);
-            unsigned samps = c.hsamp * c.vsamp;
 
-            if (num_mcu_blocks + samps > sizeof(mcu_blocks)/sizeof(mcu_blocks[0])) {
-              printf("too many mcu blocks\n");
+            // a scan with one component has one block per MCU.
+            unsigned hsamp = num_components_in_scan == 1 ? 1 : c.hsamp;
+            unsigned vsamp = num_components_in_scan == 1 ? 1 : c.vsamp;
+            max_hsamp = hsamp > max_hsamp ? hsamp : max_hsamp;
+            max_vsamp = vsamp > max_vsamp ? vsamp : max_vsamp;
+
+            // Y may have 1x1, 2x1, 1x2 or 2x2 blocks, Cb and Cr only 1x1.
+            if (i == 0 ? hsamp < 1 || hsamp > 2 || vsamp < 1 || vsamp > 2 : hsamp != 1 || vsamp != 1) {
+              printf("only 4:4:4, 4:2:2, 4:4:0 and 4:2:0 greyscale and ycrcb supported (%dx%d)\n", hsamp, vsamp);
               return 0;
             }
 
-            for (unsigned j = 0; j != samps; ++j) {
-              mcu_block &m = mcu_blocks[num_mcu_blocks++];
-              m.dc_table = &huffman_tables[0][sc.dc_table];
-              m.ac_table = &huffman_tables[1][sc.ac_table];
-              m.quant = &quant_tables[c.quantisation_table];
-              m.scan_comp = &sc;
+            for (unsigned by = 0; by != vsamp; ++by) {
+              for (unsigned bx = 0; bx != hsamp; ++bx) {
+                mcu_block &m = mcu_blocks[num_mcu_blocks++];
+                m.dc_table = &huffman_tables[0][sc.dc_table];
+                m.ac_table = &huffman_tables[1][sc.ac_table];
+                m.quant = &quant_tables[c.quantisation_table];
+                m.scan_index = i;
+                m.sample_stride = hsamp * 8;
+                m.sample_offset = i * plane_size + by * 8 * m.sample_stride + bx * 8;
+              }
             }
-
-            sc.last_dc = 0;
           }
 
-          // at present, we only support YCrCb in 4:4:4
-          if (num_mcu_blocks != 1 && num_mcu_blocks != 3 && num_mcu_blocks != 6) {
-            printf("only 4:4:4 and 4:1:1 greyscale and ycrcb supported (%d mcu blocks)\n", num_mcu_blocks);
-            return 0;
-          }
+          mcu_hsamp = max_hsamp;
+          mcu_vsamp = max_vsamp;
 
           spectral_start = *src++;
           spectral_end = *src++;
@@ -509,7 +728,7 @@ namespace octet { namespace loaders {
             scan_component &sc = scan_components[i];
             component &c = components[sc.comp];
             sc.width_in_blocks = width * c.hsamp / max_hsamp;
-            sc.height_in_blocks = height * c.hsamp / max_hsamp;
+            sc.height_in_blocks = height * c.vsamp / max_vsamp;
           }
 
           width = (width + max_hsamp * 8 - 1) & ~(max_hsamp * 8 - 1);
@@ -518,10 +737,6 @@ namespace octet { namespace loaders {
           unsigned xmax = ( width + max_hsamp * 8 - 1 ) / (max_hsamp * 8);
           unsigned ymax = ( height + max_vsamp * 8 - 1 ) / (max_vsamp * 8);
 
-          unsigned acc = 0;
-          int shift = 0;
-          skip_bits(16, acc, src, shift);
-          
           int stride = width * 4;
 
           unsigned size = width * height * 4;
@@ -531,29 +746,37 @@ namespace octet { namespace loaders {
 
           uint8_t *image_base = image.data() + base;
 
-          for (unsigned y = 0; y != ymax; ++y) {
-            for (unsigned x = 0; x != xmax; ++x) {
-              float *coeffs = dct_coeffs;
-              memset(coeffs, 0, 64 * num_mcu_blocks * sizeof(float));
-              for (unsigned b = 0; b < num_mcu_blocks; ++b) {
-                decode_mcu_block(b, acc, src, shift, coeffs);
-                inverse_dct(coeffs);
-                coeffs += 64;
-              }
-              if (num_mcu_blocks == 1) {
-                // assume 4:4:4 Greyscale
-                color_convert_444_greyscale(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 3) {
-                // assume 4:4:4 YCbCr
-                color_convert_444(&image_base[((height - 1 - y * 8) * stride) + (x * 8 * 4)], -stride, dct_coeffs);
-              } else if (num_mcu_blocks == 6) {
-                // assume 4:1:1 YCbCr
-                color_convert_411(&image_base[((height - 1 - y * 16) * stride) + (x * 16 * 4)], -stride, dct_coeffs);
-              }
+          dynarray<const uint8_t *> starts;
+          const uint8_t *end = find_restart_intervals(starts, src, src_end);
+
+          unsigned num_mcus = xmax * ymax;
+          unsigned interval = restart_interval && restart_interval < num_mcus ? restart_interval : num_mcus;
+          unsigned num_intervals = (num_mcus + interval - 1) / interval;
+          if (debug) printf("%d restart intervals, %d found\n", num_intervals, starts.size());
+
+          // about 1024 MCUs per task, so small intervals do not cost more to share than to decode.
+          unsigned intervals_per_task = interval >= 1024 ? 1 : 1024 / interval;
+
+          pool.parallel_for(num_intervals, intervals_per_task, [&](unsigned first, unsigned last) {
+            mcu_state state;
+            bit_reader reader;
+            for (unsigned i = first; i != last; ++i) {
+              memset(state.last_dc, 0, sizeof(state.last_dc));
+              // a missing interval is decoded from zeros, so the image is always filled.
+              reader.init(i < starts.size() ? starts[i] : end, end);
+              unsigned begin = i * interval;
+              decode_mcus(state, reader, begin, num_mcus - begin < interval ? num_mcus : begin + interval, xmax, image_base, stride);
             }
-          }
-          skip_bits(shift, acc, src, shift);
-          length = (unsigned)(src - src0);
+          });
+
+          length = (unsigned)(end - src0);
+        } break;
+
+        // restart interval
+        case 0xdd: {
+          length = u2(src + 2) + 2;
+          restart_interval = u2(src + 4);
+          if (debug) printf("DRI %d\n", restart_interval);
         } break;
 
         // quantisation tables (the lossy bit)
@@ -566,7 +789,14 @@ namespace octet { namespace loaders {
             unsigned n = src[0] & 0x0f;
             src++;
             for (unsigned i = 0; i != 64; ++i) {
-              quant_tables[n&3].table[i] = (float)( prec ? u2(src) : *src );
+              // AAN scale factors: 1 for DC, sqrt(2) * cos(k * pi / 16) for the others.
+              // x4 for two more bits of precision in the DCT and x256 for the fraction.
+              unsigned pos = zig_zag(i);
+              unsigned row = pos / 8, col = pos % 8;
+              float row_scale = row ? 1.41421356f * cosf(row * 3.14159265f / 16) : 1.0f;
+              float col_scale = col ? 1.41421356f * cosf(col * 3.14159265f / 16) : 1.0f;
+              float value = (float)( prec ? u2(src) : *src ) * row_scale * col_scale * (4 * 256) + 0.5f;
+              quant_tables[n&3].table[i] = (int32_t)value;
               src += prec + 1;
             }
             if (debug) printf("DQT %d %d\n", prec, n);
@@ -588,14 +818,19 @@ namespace octet { namespace loaders {
       return length;
     }
   public:
+    jpeg_decoder() {
+      restart_interval = 0;
+    }
+
     // get an opengl texture from a file in memory
-    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max) {
+    // Files with restart markers are decoded on all the threads of the pool.
+    void get_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width_, uint16_t &height_, const uint8_t *src, const uint8_t *src_max, worker_pool &pool=worker_pool::get()) {
       while (src < src_max) {
         if (src[0] != 0xff) {
           printf("warning: bad JPEG file\n");
           return;
         }
-        unsigned length = decode_chunk(src, image, format);
+        unsigned length = decode_chunk(src, src_max, image, format, pool);
         if (!length) {
           printf("warning: bad JPEG file @ chunk %02x\n", src[1]);
           return;
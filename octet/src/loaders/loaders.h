@@ -34,5 +34,6 @@
   #include "../loaders/tga_decoder.h"
   #include "../loaders/dds_decoder.h"
   #include "../loaders/nifti_decoder.h"
+  #include "../loaders/xml_parser.h"
 
 #endif
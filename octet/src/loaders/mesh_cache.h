@@ -0,0 +1,181 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Compiled copies of Collada and OBJ files
+//
+// The first time a file is loaded, it is parsed as usual and the resources it
+// made are saved next to it as "<file>.cache" by the binary_writer. The cache
+// starts with the size and hash of the source file. If they still match, later
+// loads read the cache instead of parsing XML or text. Vertex and index data
+// is read straight into the GL buffers.
+//
+// Only plain files are cached; zip:// and http:// urls are always parsed.
+// Files with textured or custom shaded materials are not cached either, as
+// only the diffuse colour of a material can be saved so far.
+//
+
+namespace octet { namespace loaders {
+  /// Load Collada and OBJ files through a binary cache.
+  ///
+  /// Example
+  ///
+  ///     resource_dict dict;
+  ///     visual_scene *scene = mesh_cache::load_collada(dict, "assets/duck_triangulate.dae");
+  class mesh_cache {
+    enum { debug = 0 };
+
+    // change this when the layout of any visited class changes.
+    enum { version = 2 };
+
+    enum kind_t { kind_collada, kind_obj };
+
+    struct header {
+      char magic[8];
+      uint32_t version;
+      uint32_t format;
+      uint64_t source_size;
+      uint64_t source_hash;
+    };
+
+    // the stream depends on the atom numbering and on how gl_resource stores its bytes.
+    static uint32_t get_format() {
+      uint32_t num_atoms = 1;
+      while (app_utils::predefined_atom(num_atoms)) ++num_atoms;
+      #ifdef OCTET_GLES2
+        return num_atoms * 2 + 1;
+      #else
+        return num_atoms * 2;
+      #endif
+    }
+
+    static void init_header(header &hdr, const url_view &source) {
+      memset(&hdr, 0, sizeof(hdr));
+      memcpy(hdr.magic, "octcache", 8);
+      hdr.version = version;
+      hdr.format = get_format();
+      hdr.source_size = source.size();
+      hdr.source_hash = string_hash::hash_bytes(source.data(), source.size());
+    }
+
+    // read the cache into "dict" if it was made from this version of the source.
+    static bool read_cache(resource_dict &dict, const char *cache_path, const header &expected) {
+      FILE *file = fopen(cache_path, "rb");
+      if (!file) return false;
+
+      header hdr;
+      bool ok = fread(&hdr, 1, sizeof(hdr), file) == sizeof(hdr) && !memcmp(&hdr, &expected, sizeof(hdr));
+      if (ok) {
+        binary_reader reader(file);
+        dict.visit(reader);
+        ok = !reader.get_error() && dict.get_active_scene();
+      }
+      fclose(file);
+
+      if (debug) printf("mesh_cache: %s %s\n", cache_path, ok ? "hit" : "miss");
+      return ok;
+    }
+
+    // save "dict" for next time. If the cache can not be written, it is not an error.
+    static void write_cache(resource_dict &dict, const char *cache_path, const header &hdr) {
+      FILE *file = fopen(cache_path, "wb");
+      if (!file) return;
+
+      fwrite(&hdr, 1, sizeof(hdr), file);
+      {
+        binary_writer writer(file);
+        dict.visit(writer);
+      }
+      bool failed = ferror(file) != 0;
+      fclose(file);
+
+      // do not leave a broken cache behind.
+      if (failed) remove(cache_path);
+    }
+
+    // material::visit() only saves a colour, so files with textured or shaded materials are not cached.
+    static bool can_cache(resource_dict &dict) {
+      dynarray<resource*> found;
+      dict.find_all(found, atom_material);
+      for (unsigned i = 0; i != found.size(); ++i) {
+        if (!found[i]->get_material()->is_plain_color()) return false;
+      }
+
+      // materials that are only reachable from mesh instances.
+      found.resize(0);
+      dict.find_all(found, atom_visual_scene);
+      for (unsigned i = 0; i != found.size(); ++i) {
+        visual_scene *scene = found[i]->get_visual_scene();
+        for (int j = 0; j != scene->get_num_mesh_instances(); ++j) {
+          material *mat = scene->get_mesh_instance(j)->get_material();
+          if (mat && !mat->is_plain_color()) return false;
+        }
+      }
+      return true;
+    }
+
+    // parse the source file into "dict" and set the active scene.
+    static bool parse(resource_dict &dict, const char *url, kind_t kind) {
+      if (kind == kind_collada) {
+        collada_builder builder;
+        if (!builder.load_xml(url)) return false;
+        builder.get_resources(dict);
+        const char *scene_url = builder.get_default_scene();
+        dict.set_active_scene(scene_url ? dict.get_visual_scene(scene_url) : NULL);
+      } else {
+        ref<visual_scene> scene = new visual_scene();
+        obj_loader loader;
+        if (!loader.load(url, dict, scene)) return false;
+        dict.set_resource(url, scene);
+        dict.set_active_scene(scene);
+      }
+      return dict.get_active_scene() != NULL;
+    }
+
+    static visual_scene *load(resource_dict &dict, const char *url, kind_t kind) {
+      // the resources are built in their own dictionary so that only they are saved.
+      resource_dict file_dict;
+
+      bool is_file = strncmp(url, "zip://", 6) && strncmp(url, "http://", 7);
+      url_view source;
+      if (is_file && app_utils::get_url_view(source, url, file_map::access_random)) {
+        header hdr;
+        init_header(hdr, source);
+        string cache_path;
+        app_utils::get_path(cache_path, url);
+        cache_path += ".cache";
+
+        if (!read_cache(file_dict, cache_path, hdr)) {
+          file_dict.reset();
+          file_dict.set_active_scene(NULL);
+          if (!parse(file_dict, url, kind)) return NULL;
+          if (can_cache(file_dict)) {
+            write_cache(file_dict, cache_path, hdr);
+          } else if (debug) {
+            printf("mesh_cache: %s not cached, it has materials that can not be saved\n", url);
+          }
+        }
+      } else if (!parse(file_dict, url, kind)) {
+        return NULL;
+      }
+
+      dict.add_resources(file_dict);
+      return file_dict.get_active_scene();
+    }
+
+  public:
+    /// Load a Collada file into the dictionary and return its default scene.
+    /// Returns NULL if the file could not be loaded.
+    static visual_scene *load_collada(resource_dict &dict, const char *url) {
+      return load(dict, url, kind_collada);
+    }
+
+    /// Load an OBJ file into the dictionary as a new scene, which is added under the url and returned.
+    /// Returns NULL if the file could not be loaded.
+    static visual_scene *load_obj(resource_dict &dict, const char *url) {
+      return load(dict, url, kind_obj);
+    }
+  };
+}}
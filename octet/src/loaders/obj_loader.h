@@ -6,247 +6,579 @@
 //
 // load an OBJ file.
 //
+// The file is mapped and cut into chunks at line boundaries. The chunks are
+// parsed in parallel into their own vertex and triangle arrays. The arrays are
+// then joined in file order, so the result is the same for any number of threads.
+//
+// OBJ indices count from one and negative indices count back from the last
+// vertex. A chunk does not know how many vertices came before it, so relative
+// indices are stored relative to the start of the chunk and fixed up once the
+// chunk sizes are known.
+//
 namespace octet { namespace loaders {
   /// Class for loading OBJ files.
+  ///
+  /// Example
+  ///
+  ///     obj_loader loader;
+  ///     loader.load("assets/teapot.obj", app_scene->get_dict(), app_scene);
   class obj_loader {
+    enum { debug = 0 };
+
+    // bytes of text per chunk; smaller files are parsed in one go.
+    enum { chunk_size = 1024 * 1024 };
+
+    // no uv or normal on this corner.
+    enum { missing = -0x7fffffff - 1 };
+
+    // indices of one triangle corner.
+    struct corner {
+      int32_t pos;
+      int32_t uv;
+      int32_t normal;
+    };
+
+    // one triangle. bit (corner*3 + component) of relative is set if that index is relative to the chunk.
+    struct triangle {
+      corner c[3];
+      uint16_t relative;
+    };
+
+    // an 'o' or 'usemtl' line, before triangle number "first_triangle" of the chunk.
+    struct event {
+      uint32_t first_triangle;
+      bool is_object;
+      string name;
+    };
+
+    // everything found in one chunk of the file.
+    struct chunk {
+      const uint8_t *begin;
+      const uint8_t *end;
+      dynarray<vec3p> positions;
+      dynarray<vec2p> uvs;
+      dynarray<vec3p> normals;
+      dynarray<triangle> triangles;
+      dynarray<event> events;
+      unsigned bad_lines;
+
+      // first position, uv and normal of this chunk in the whole file.
+      unsigned pos_base;
+      unsigned uv_base;
+      unsigned normal_base;
+    };
+
+    // a set of triangles in one object with one material. Each becomes a mesh.
+    struct group {
+      unsigned object;
+      unsigned material;
+      dynarray<mesh::vertex> vertices;
+    };
+
+    // a run of triangles from one chunk, all in the same group.
+    struct run {
+      unsigned chunk;
+      unsigned first_triangle;
+      unsigned num_triangles;
+      unsigned group;
+      unsigned dest;
+    };
+
+    dynarray<chunk> chunks;
+    dynarray<group> groups;
+    dynarray<run> runs;
+    dynarray<string> objects;
+    dynarray<string> materials;
+
+    dynarray<vec3p> positions;
+    dynarray<vec2p> uvs;
+    dynarray<vec3p> normals;
+
+    static bool is_space(uint8_t c) {
+      return c == ' ' || c == '\t';
+    }
+
+    static const uint8_t *skip_space(const uint8_t *src, const uint8_t *end) {
+      while (src != end && is_space(*src)) ++src;
+      return src;
+    }
+
+    // does the line start with this keyword followed by a space?
+    static bool is_keyword(const uint8_t *src, const uint8_t *end, const char *keyword, size_t len) {
+      return (size_t)(end - src) > len && !memcmp(src, keyword, len) && is_space(src[len]);
+    }
+
+    // parse a signed integer. returns NULL if there are no digits.
+    static const uint8_t *parse_int(int32_t &result, const uint8_t *src, const uint8_t *end) {
+      bool negative = src != end && *src == '-';
+      src += negative || (src != end && *src == '+');
+      if (src == end || (unsigned)(*src - '0') > 9) return NULL;
+      int64_t value = 0;
+      while (src != end && (unsigned)(*src - '0') <= 9) {
+        if (value < 0x80000000ll) value = value * 10 + (*src - '0');
+        ++src;
+      }
+      if (value > 0x7fffffff) value = 0x7fffffff;
+      result = (int32_t)(negative ? -value : value);
+      return src;
+    }
+
   public:
-    obj_loader() {
+    /// Parse a decimal floating point number from [src, end) into "result".
+    /// Returns a pointer to the character after the number or NULL if there is no number.
+    ///
+    /// The digits are gathered in a 64 bit integer and scaled by an exact power of ten,
+    /// so the result is correctly rounded. Numbers with too many digits or large exponents
+    /// are passed on to strtod.
+    static const uint8_t *parse_float(float &result, const uint8_t *src, const uint8_t *end) {
+      // powers of ten that are exact in a double.
+      static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+      };
+
+      const uint8_t *start = src;
+      bool negative = src != end && *src == '-';
+      src += negative || (src != end && *src == '+');
+
+      uint64_t mantissa = 0;
+      int num_digits = 0;
+      int exponent = 0;
+      bool any_digits = false;
+      bool truncated = false;
+
+      for (; src != end && (unsigned)(*src - '0') <= 9; ++src) {
+        any_digits = true;
+        if (num_digits < 19) {
+          mantissa = mantissa * 10 + (*src - '0');
+          num_digits += mantissa != 0;
+        } else {
+          // digits past the 19th only scale the number.
+          exponent++;
+          truncated |= *src != '0';
+        }
+      }
+
+      if (src != end && *src == '.') {
+        for (++src; src != end && (unsigned)(*src - '0') <= 9; ++src) {
+          any_digits = true;
+          if (num_digits < 19) {
+            mantissa = mantissa * 10 + (*src - '0');
+            num_digits += mantissa != 0;
+            exponent--;
+          } else {
+            truncated |= *src != '0';
+          }
+        }
+      }
+
+      if (!any_digits) return NULL;
+
+      if (src != end && (*src == 'e' || *src == 'E')) {
+        int32_t exp = 0;
+        const uint8_t *exp_end = parse_int(exp, src + 1, end);
+        if (exp_end) {
+          src = exp_end;
+          // keep clear of overflow, the value is out of range well before this.
+          exponent += exp < -10000 ? -10000 : exp > 10000 ? 10000 : exp;
+        }
+      }
+
+      if (mantissa == 0) {
+        result = negative ? -0.0f : 0.0f;
+        return src;
+      }
+
+      if (!truncated && mantissa <= (1ull << 24) && exponent >= -10 && exponent <= 10) {
+        // both numbers are exact floats, so one float operation rounds correctly.
+        float value = (float)mantissa;
+        value = exponent < 0 ? value / (float)pow10[-exponent] : value * (float)pow10[exponent];
+        result = negative ? -value : value;
+        return src;
+      }
+
+      if (!truncated && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+        // correctly rounded double. Rounding again to float is only wrong when the double
+        // falls exactly half way between two floats.
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / pow10[-exponent] : value * pow10[exponent];
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        if ((bits & 0x1fffffff) != 0x10000000) {
+          result = (float)(negative ? -value : value);
+          return src;
+        }
+      }
+
+      // hard case: let the C library do it.
+      char tmp[128];
+      size_t len = src - start;
+      if (len < sizeof(tmp)) {
+        memcpy(tmp, start, len);
+        tmp[len] = 0;
+        result = strtof(tmp, NULL);
+      } else {
+        std::string str((const char*)start, len);
+        result = strtof(str.c_str(), NULL);
+      }
+      return src;
     }
 
-    /// Load an OBJ file
-    /// http://en.wikipedia.org/wiki/Wavefront_.obj_file
-    bool load(const char *url, resource_dict &dict, visual_scene *scene) {
-      dynarray<uint8_t> file;
-      app_utils::get_url(file, url);
-      if (file.size() == 0) return false;
-
-      const uint8_t *eof = file.data() + file.size();
-      this->dict = &dict;
-      material_index = 0;
-      
-      for (const uint8_t *src = file.data(); src != eof; ) {
-        while (*src == ' ' && src != eof) ++src;
-        const uint8_t *begin = src;
-        while (*src != '\n' && *src != '\r' && src != eof) ++src;
-        const uint8_t *end = src;
-        src += src != eof && *src == '\r';
-        src += src != eof && *src == '\n';
-        if (begin != end ) switch (begin[0]) {
-          case '#': {
-            fwrite(begin, 1, end-begin, stdout);
-          } break;
-          case 'o': {
-            flush();
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') obj_name.assign((const char*)begin + 2, (const char*)end);
-            node = new scene_node(mat4t(), atom_);
-          } break;
-          case 'g': {
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') group_name.assign((const char*)begin + 2, (const char*)end);
-          } break;
-          case 'v': {
-            //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
-              atofv(values, begin+2, end);
-              if (values.size() == 3) {
-                src_vertices.push_back(vec3p(values[0], values[1], values[2]));
-              }
-            } else if (begin[1] == 't' && begin[2] == ' ') {
-              atofv(values, begin+3, end);
-              if (values.size() == 2) {
-                src_uvs.push_back(vec2p(values[0], values[1]));
-              }
-            } else if (begin[1] == 'n' && begin[2] == ' ') {
-              atofv(values, begin+3, end);
-              if (values.size() == 3) {
-                src_normals.push_back(vec3p(values[0], values[1], values[2]));
-              }
-            }
-          } break;
-          case 'f': {
-            //fwrite(begin, 1, end-begin, stdout);
-            if (begin[1] == ' ') {
-              unsigned slashes = 0;
-              mesh::vertex v[6];
-              atoiv(ivalues, slashes, begin + 2, end);
-              size_t num_values = ivalues.size() - slashes;
-              size_t num_comps = ivalues.size() / num_values;
-              size_t num_idx = ivalues.size() / num_comps;
-              if (num_idx > 4 || num_comps > 3) {
-                printf("warning: bad obj file face\n");
-                return false;
-              }
-              mesh::vertex vtx[4];
-              memset(vtx, 0, sizeof(vtx));
-              if (num_comps >= 1) {
-                size_t d = 0;
-                for (size_t i = 0; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].pos = src_vertices[iv < 0 ? src_vertices.size() + iv : iv];
-                }
-              }
-              if (num_comps >= 2) {
-                size_t d = 0;
-                for (size_t i = 1; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].uv = src_uvs[iv < 0 ? src_uvs.size() + iv : iv];
-                }
-              }
-              if (num_comps >= 3) {
-                size_t d = 0;
-                for (size_t i = 2; i < ivalues.size(); i += num_comps) {
-                  int iv = ivalues[i];
-                  vtx[d++].normal = src_normals[iv < 0 ? src_normals.size() + iv : iv];
-                }
-              }
-
-              face f;
-              f.vtx[0] = vtx[0];
-              f.vtx[1] = vtx[1];
-              f.vtx[2] = vtx[2];
-              f.material_index = material_index;
-              faces.push_back(f);
-              if (num_idx == 4) {
-                f.vtx[0] = vtx[0];
-                f.vtx[1] = vtx[2];
-                f.vtx[2] = vtx[3];
-                f.material_index = material_index;
-                faces.push_back(f);
-              }
-            }
-          } break;
-          default: {
-            fwrite(begin, 1, end-begin, stdout);
-            printf("unknown\n");
-            return false;
-          } break;
-          case 'u': {
-            fwrite(begin, 1, end-begin, stdout);
-            if (begin+7 < end && !memcmp(begin, "usemtl ", 7)) {
-              size_t len = end - (begin+7);
-              size_t i = 0;
-              for (; i != materials.size(); ++i) {
-                if (
-                  materials[i].size() == len &&
-                  !memcmp(materials[i].c_str(), begin+7, len)
-                ) {
-                  break;
-                }
-              }
-
-              if (i == materials.size()) {
-                materials.push_back(string((const char*)begin+7, (unsigned)len));
-              }
-
-              material_index = (uint32_t)i;
-            }
-          } break;
+  private:
+    // read up to "max_values" numbers from a line. Returns the number found.
+    static unsigned parse_floats(float *values, unsigned max_values, const uint8_t *src, const uint8_t *end) {
+      unsigned num_values = 0;
+      src = skip_space(src, end);
+      while (src != end && num_values != max_values) {
+        src = parse_float(values[num_values], src, end);
+        if (!src) break;
+        num_values++;
+        src = skip_space(src, end);
+      }
+      return num_values;
+    }
+
+    // convert an OBJ index to a zero based index, relative to the chunk if it was negative.
+    static int32_t chunk_index(int32_t value, unsigned chunk_count, uint16_t &relative, unsigned bit) {
+      if (value < 0) {
+        relative |= 1 << bit;
+        return (int32_t)chunk_count + value;
+      } else {
+        return value - 1;
+      }
+    }
+
+    // parse a face line and fan it into triangles. Returns false if the line is bad.
+    static bool parse_face(chunk &ch, const uint8_t *src, const uint8_t *end) {
+      enum { max_corners = 64 };
+      corner corners[max_corners];
+      uint16_t relative[max_corners];
+      unsigned num_corners = 0;
+
+      src = skip_space(src, end);
+      while (src != end) {
+        if (num_corners == max_corners) return false;
+        corner &c = corners[num_corners];
+        uint16_t &rel = relative[num_corners];
+        c.uv = c.normal = missing;
+        rel = 0;
+
+        int32_t value = 0;
+        src = parse_int(value, src, end);
+        if (!src || value == 0) return false;
+        c.pos = chunk_index(value, ch.positions.size(), rel, 0);
+
+        if (src != end && *src == '/') {
+          ++src;
+          if (src != end && *src != '/') {
+            src = parse_int(value, src, end);
+            if (!src || value == 0) return false;
+            c.uv = chunk_index(value, ch.uvs.size(), rel, 1);
+          }
+          if (src != end && *src == '/') {
+            src = parse_int(value, src + 1, end);
+            if (!src || value == 0) return false;
+            c.normal = chunk_index(value, ch.normals.size(), rel, 2);
+          }
         }
+
+        if (src != end && !is_space(*src)) return false;
+        src = skip_space(src, end);
+        num_corners++;
       }
-      flush();
 
+      if (num_corners < 3) return false;
+
+      for (unsigned i = 2; i != num_corners; ++i) {
+        triangle t;
+        t.c[0] = corners[0];
+        t.c[1] = corners[i-1];
+        t.c[2] = corners[i];
+        t.relative = relative[0] | (relative[i-1] << 3) | (relative[i] << 6);
+        ch.triangles.push_back(t);
+      }
       return true;
     }
-  private:
-    dynarray<vec3p> src_vertices;
-    dynarray<vec3p> src_normals;
-    dynarray<vec2p> src_uvs;
-    dynarray<uint32_t> src_material;
-    dynarray<string> materials;
 
-    string obj_name;
-    string group_name;
-    resource_dict *dict;
-    scene_node *node;
+    // parse one chunk of lines. Called on the worker threads.
+    static void parse_chunk(chunk &ch) {
+      ch.bad_lines = 0;
+      const uint8_t *eof = ch.end;
+      for (const uint8_t *src = ch.begin; src != eof; ) {
+        const uint8_t *begin = skip_space(src, eof);
+        const uint8_t *end = (const uint8_t *)memchr(begin, '\n', eof - begin);
+        if (!end) end = eof;
+        src = end == eof ? eof : end + 1;
+        if (end != begin && end[-1] == '\r') --end;
+        if (begin == end) continue;
 
-    struct face {
-      mesh::vertex vtx[3];
-      int material_index;
+        float values[3] = { 0, 0, 0 };
+        if (is_keyword(begin, end, "v", 1)) {
+          // extra values (w or vertex colours) are ignored.
+          ch.bad_lines += parse_floats(values, 3, begin + 2, end) != 3;
+          ch.positions.push_back(vec3p(values[0], values[1], values[2]));
+        } else if (is_keyword(begin, end, "vt", 2)) {
+          // the v coordinate is optional and the w coordinate is ignored.
+          ch.bad_lines += parse_floats(values, 2, begin + 3, end) == 0;
+          ch.uvs.push_back(vec2p(values[0], values[1]));
+        } else if (is_keyword(begin, end, "vn", 2)) {
+          ch.bad_lines += parse_floats(values, 3, begin + 3, end) != 3;
+          ch.normals.push_back(vec3p(values[0], values[1], values[2]));
+        } else if (is_keyword(begin, end, "f", 1)) {
+          ch.bad_lines += !parse_face(ch, begin + 2, end);
+        } else if (is_keyword(begin, end, "o", 1) || is_keyword(begin, end, "usemtl", 6)) {
+          bool is_object = begin[0] == 'o';
+          const uint8_t *name = skip_space(begin + (is_object ? 1 : 6), end);
+          const uint8_t *name_end = end;
+          while (name_end != name && is_space(name_end[-1])) --name_end;
+          event &e = ch.events.emplace_back();
+          e.first_triangle = ch.triangles.size();
+          e.is_object = is_object;
+          e.name.set((const char*)name, (int)(name_end - name));
+        }
+        // comments, groups, smoothing groups, mtllib and lines are not used.
+      }
+    }
 
-      bool operator <(const face &rhs) {
-        return material_index < rhs.material_index;
+    // find the group for an object and material, adding it if it is new.
+    unsigned get_group(unsigned object, unsigned material) {
+      for (unsigned i = groups.size(); i-- != 0; ) {
+        if (groups[i].object == object && groups[i].material == material) return i;
       }
-    };
+      group &g = groups.emplace_back();
+      g.object = object;
+      g.material = material;
+      return groups.size() - 1;
+    }
+
+    static unsigned find_name(dynarray<string> &names, const string &name) {
+      for (unsigned i = 0; i != names.size(); ++i) {
+        if (names[i] == name) return i;
+      }
+      names.push_back(name);
+      return names.size() - 1;
+    }
 
-    dynarray<face> faces;
-    dynarray<uint32_t> indices;
-    dynarray<float> values;
-    dynarray<int> ivalues;
-    uint32_t material_index;
+    // look up one index of a corner, returning -1 if it is missing or out of range.
+    static int resolve(int32_t value, bool is_relative, unsigned base, unsigned size, unsigned &bad_indices) {
+      if (value == missing) return -1;
+      int64_t index = (int64_t)value + (is_relative ? base : 0);
+      if (index < 0 || index >= size) {
+        bad_indices++;
+        return -1;
+      }
+      return (int)index;
+    }
 
-    // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
-    void atoiv(dynarray<int> &values, unsigned &slashes, const uint8_t *src, const uint8_t *end) {
-      values.resize(0);
-      slashes = 0;
+    // make the vertices for a run of triangles. Called on the worker threads.
+    unsigned build_run(const run &r) {
+      const chunk &ch = chunks[r.chunk];
+      mesh::vertex *dest = groups[r.group].vertices.data() + r.dest * 3;
+      unsigned bad_indices = 0;
+
+      for (unsigned i = 0; i != r.num_triangles; ++i) {
+        const triangle &t = ch.triangles[r.first_triangle + i];
+        unsigned missing_normals = 0;
+        for (unsigned j = 0; j != 3; ++j) {
+          const corner &c = t.c[j];
+          unsigned rel = t.relative >> (j * 3);
+          int pos = resolve(c.pos, (rel & 1) != 0, ch.pos_base, positions.size(), bad_indices);
+          int uv = resolve(c.uv, (rel & 2) != 0, ch.uv_base, uvs.size(), bad_indices);
+          int normal = resolve(c.normal, (rel & 4) != 0, ch.normal_base, normals.size(), bad_indices);
+          mesh::vertex &v = dest[i * 3 + j];
+          v.pos = pos >= 0 ? positions[pos] : vec3p(0, 0, 0);
+          v.uv = uv >= 0 ? uvs[uv] : vec2p(0, 0);
+          v.normal = normal >= 0 ? normals[normal] : vec3p(0, 0, 0);
+          missing_normals |= (normal < 0) << j;
+        }
 
-      while (src != end && *src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        int whole = 0, msign = 1;
-        if (src != end && *src == '-') { msign = -1; src++; }
-        while (src != end && *src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (src != end && *src > 0 && *src <= ' ') ++src;
-        if (src != end && *src == '/') { slashes++; src++; }
+        if (missing_normals) {
+          // corners without a normal in the file get the face normal.
+          vec3 p0 = dest[i * 3 + 0].pos, p1 = dest[i * 3 + 1].pos, p2 = dest[i * 3 + 2].pos;
+          vec3 n = cross(p1 - p0, p2 - p0);
+          float len2 = dot(n, n);
+          n = len2 > 0 ? n * (1.0f / sqrtf(len2)) : vec3(0, 0, 1);
+          for (unsigned j = 0; j != 3; ++j) {
+            if (missing_normals & (1 << j)) dest[i * 3 + j].normal = n;
+          }
+        }
       }
+      return bad_indices;
     }
 
-    void atofv(dynarray<float> &values, const uint8_t *src, const uint8_t *end) {
-      values.resize(0);
+    // join the chunk arrays and put the triangles into groups.
+    void merge(worker_pool &pool) {
+      unsigned num_positions = 0, num_uvs = 0, num_normals = 0;
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        chunk &ch = chunks[i];
+        ch.pos_base = num_positions;
+        ch.uv_base = num_uvs;
+        ch.normal_base = num_normals;
+        num_positions += ch.positions.size();
+        num_uvs += ch.uvs.size();
+        num_normals += ch.normals.size();
+      }
 
-      while (*src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
+      positions.resize(num_positions);
+      uvs.resize(num_uvs);
+      normals.resize(num_normals);
+      pool.parallel_for(chunks.size(), 1, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          chunk &ch = chunks[i];
+          if (ch.positions.size()) memcpy((void*)&positions[ch.pos_base], ch.positions.data(), ch.positions.size() * sizeof(vec3p));
+          if (ch.uvs.size()) memcpy((void*)&uvs[ch.uv_base], ch.uvs.data(), ch.uvs.size() * sizeof(vec2p));
+          if (ch.normals.size()) memcpy((void*)&normals[ch.normal_base], ch.normals.data(), ch.normals.size() * sizeof(vec3p));
         }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
-          src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
+      });
+
+      // walk the events in file order to find runs of triangles with the same object and material.
+      // before the first 'o' line, triangles belong to an unnamed object.
+      unsigned object = 0, material = 0;
+      objects.push_back(string(""));
+      materials.push_back(string(""));
+      unsigned cur_group = get_group(object, material);
+      dynarray<unsigned> group_triangles;
+      group_triangles.push_back(0);
+
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        chunk &ch = chunks[i];
+        unsigned first = 0;
+        for (unsigned e = 0; e <= ch.events.size(); ++e) {
+          unsigned last = e == ch.events.size() ? ch.triangles.size() : ch.events[e].first_triangle;
+          if (last != first) {
+            run &r = runs.emplace_back();
+            r.chunk = i;
+            r.first_triangle = first;
+            r.num_triangles = last - first;
+            r.group = cur_group;
+            r.dest = group_triangles[cur_group];
+            group_triangles[cur_group] += r.num_triangles;
+            first = last;
+          }
+          if (e != ch.events.size()) {
+            const event &ev = ch.events[e];
+            if (ev.is_object) {
+              object = find_name(objects, ev.name);
+            } else {
+              material = find_name(materials, ev.name);
+            }
+            cur_group = get_group(object, material);
+            if (cur_group == group_triangles.size()) group_triangles.push_back(0);
+          }
         }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
+      }
+
+      for (unsigned i = 0; i != groups.size(); ++i) {
+        groups[i].vertices.resize(group_triangles[i] * 3);
       }
     }
 
-    void flush() {
-      std::sort(faces.begin(), faces.end());
-      face *f = 0;
-      gl_resource *vertices = new gl_resource(GL_ARRAY_BUFFER, faces.size() * sizeof(f->vtx));
+  public:
+    obj_loader() {
+    }
 
-      {
-        gl_resource::wolock vl(vertices);
-        for (size_t i = 0; i != faces.size(); ++i) {
-          memcpy(vl.u8() + i * sizeof(f->vtx), faces[i].vtx, sizeof(f->vtx));
+    /// Load an OBJ file
+    /// http://en.wikipedia.org/wiki/Wavefront_.obj_file
+    ///
+    /// Each object ('o' line) becomes a scene node with a mesh for each material it uses.
+    /// Materials are taken from the dictionary by name. Missing ones are added to the dictionary in grey.
+    bool load(const char *url, resource_dict &dict, visual_scene *scene, worker_pool &pool=worker_pool::get()) {
+      url_view file;
+      if (!app_utils::get_url_view(file, url) || file.size() == 0) return false;
+
+      const uint8_t *src = file.data();
+      const uint8_t *eof = src + file.size();
+
+      chunks.reset();
+      groups.reset();
+      runs.reset();
+      objects.reset();
+      materials.reset();
+
+      // cut the file into chunks that end at the end of a line.
+      while (src != eof) {
+        const uint8_t *end = (size_t)(eof - src) <= chunk_size ? eof : src + chunk_size;
+        if (end != eof) {
+          const uint8_t *nl = (const uint8_t *)memchr(end, '\n', eof - end);
+          end = nl ? nl + 1 : eof;
         }
+        chunk &ch = chunks.emplace_back();
+        ch.begin = src;
+        ch.end = end;
+        src = end;
       }
 
-      int prev_mi = -1;
-      for (size_t i = 0; i != faces.size(); ++i) {
-        if (faces[i].material_index != prev_mi) {
-          mesh *msh = new mesh();
-          msh->set_default_attributes();
-          msh->set_vertices(vertices);
-          material *mat = new material(vec4(0.5f, 0.5f, 0.5f, 1));
-          mesh_instance *mi = new mesh_instance(node, msh, mat);
+      pool.parallel_for(chunks.size(), 1, [&](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          parse_chunk(chunks[i]);
+        }
+      });
+
+      merge(pool);
+
+      std::atomic<unsigned> bad_indices(0);
+      pool.parallel_for(runs.size(), 1, [&](unsigned begin, unsigned end) {
+        unsigned bad = 0;
+        for (unsigned i = begin; i != end; ++i) {
+          bad += build_run(runs[i]);
+        }
+        bad_indices.fetch_add(bad, std::memory_order_relaxed);
+      });
+
+      unsigned bad_lines = 0;
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        bad_lines += chunks[i].bad_lines;
+      }
+      if (bad_lines || bad_indices) {
+        printf("warning: %s: %d bad lines and %d bad indices\n", url, bad_lines, (unsigned)bad_indices);
+      }
+
+      // make the scene nodes, meshes and materials.
+      dynarray<scene_node*> nodes(objects.size());
+      for (unsigned i = 0; i != nodes.size(); ++i) nodes[i] = NULL;
+      material *default_material = NULL;
+
+      for (unsigned i = 0; i != groups.size(); ++i) {
+        group &g = groups[i];
+        if (g.vertices.size() == 0) continue;
+
+        if (!nodes[g.object]) {
+          atom_t sid = objects[g.object].size() ? app_utils::get_atom(objects[g.object]) : atom_;
+          nodes[g.object] = scene->add_scene_node(new scene_node(mat4t(), sid));
+        }
+
+        mesh *msh = new mesh();
+        msh->set_default_attributes();
+        msh->set_vertices(g.vertices);
+        msh->set_index_type(0);
+        msh->calc_aabb();
+
+        const char *mat_name = materials[g.material];
+        material *mat = mat_name[0] ? dict.get_material(mat_name) : NULL;
+        if (!mat && mat_name[0]) {
+          // add a grey material with this name that the app can change later.
+          mat = new material(vec4(0.5f, 0.5f, 0.5f, 1));
+          dict.set_resource(mat_name, mat);
+        } else if (!mat) {
+          if (!default_material) default_material = new material(vec4(0.5f, 0.5f, 0.5f, 1));
+          mat = default_material;
+        }
+
+        scene->add_mesh_instance(new mesh_instance(nodes[g.object], msh, mat));
+
+        if (debug) {
+          printf("%s/%s: %d triangles\n", objects[g.object].c_str(), materials[g.material].c_str(), g.vertices.size() / 3);
         }
       }
 
-      faces.resize(0);
-      src_vertices.resize(0);
-      src_uvs.resize(0);
-      src_normals.resize(0);
+      // the file view and chunks go away now; do not keep the text.
+      chunks.reset();
+      runs.reset();
+      groups.reset();
+      positions.reset();
+      uvs.reset();
+      normals.reset();
+      return true;
     }
   };
 }}
@@ -0,0 +1,507 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// In-place XML parsing
+//
+// The parser works on the text of the file and writes zero terminators and
+// decoded entities back into it, so names, attribute values and text are
+// pointers into the buffer and nothing is copied.
+//
+// xml_pull_parser returns the file one token at a time. xml_document uses it to
+// make a flat array of elements. The document needs two allocations for the
+// whole file, where a DOM has several for every element.
+//
+namespace octet { namespace loaders {
+  /// Pull parser for XML text. Each call to next() returns one token.
+  ///
+  /// Example
+  ///
+  ///     xml_pull_parser parser(text, text + size);
+  ///     for (xml_pull_parser::token_t tok; (tok = parser.next()) > xml_pull_parser::token_end; ) {
+  ///       if (tok == xml_pull_parser::token_start) printf("<%s>\n", parser.get_name());
+  ///     }
+  class xml_pull_parser {
+  public:
+    enum token_t {
+      token_error,
+      token_end,
+      token_start,  // start of an element: get_name() and get_attribute...()
+      token_close,  // end of an element, including <empty/> ones: get_name()
+      token_text,   // text or CDATA: get_text()
+    };
+
+  private:
+    char *src;
+    char *end;
+
+    // the '<' at src was overwritten by the terminator of the last text.
+    bool at_markup;
+
+    // the last start tag was <empty/>, so a close comes next.
+    bool pending_close;
+
+    const char *name;
+    const char *text;
+    dynarray<const char *> attributes;
+    const char *error;
+    const char *error_pos;
+
+    static bool is_space(char c) {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool is_name_end(char c) {
+      return is_space(c) || c == '>' || c == '/' || c == '=' || c == 0;
+    }
+
+    char *skip_space(char *p) {
+      while (p != end && is_space(*p)) ++p;
+      return p;
+    }
+
+    token_t fail(const char *message, const char *pos) {
+      error = message;
+      error_pos = pos;
+      src = end;
+      return token_error;
+    }
+
+    // find the end of a string such as "-->". Returns NULL if it is not there.
+    char *find(char *p, const char *str) {
+      size_t len = strlen(str);
+      for (;;) {
+        p = (char*)memchr(p, str[0], end - p);
+        if (!p || (size_t)(end - p) < len) return NULL;
+        if (!memcmp(p, str, len)) return p;
+        ++p;
+      }
+    }
+
+    // decode &amp; &lt; &gt; &quot; &apos; and &#nn; in [p, p_end), returning the new end.
+    static char *decode_entities(char *p, char *p_end) {
+      char *dest = (char*)memchr(p, '&', p_end - p);
+      if (!dest) return p_end;
+      for (p = dest; p != p_end; ) {
+        if (*p != '&') {
+          *dest++ = *p++;
+          continue;
+        }
+        char *semi = (char*)memchr(p, ';', p_end - p);
+        size_t len = semi ? semi - p + 1 : 0;
+        unsigned code = 0;
+        if (len == 5 && !memcmp(p, "&amp;", 5)) code = '&';
+        else if (len == 4 && !memcmp(p, "&lt;", 4)) code = '<';
+        else if (len == 4 && !memcmp(p, "&gt;", 4)) code = '>';
+        else if (len == 6 && !memcmp(p, "&quot;", 6)) code = '"';
+        else if (len == 6 && !memcmp(p, "&apos;", 6)) code = '\'';
+        else if (len > 3 && p[1] == '#') {
+          bool hex = p[2] == 'x';
+          for (char *d = p + 2 + hex; d != semi; ++d) {
+            unsigned digit = (unsigned)(*d - '0') <= 9 ? *d - '0' : hex && (unsigned)((*d | 0x20) - 'a') < 6 ? (*d | 0x20) - 'a' + 10 : 99;
+            if (digit == 99 || code > 0x10ffff) { code = 0; break; }
+            code = code * (hex ? 16 : 10) + digit;
+          }
+        }
+
+        if (code == 0) {
+          // not an entity we know: keep the text.
+          *dest++ = *p++;
+        } else {
+          // write the character as utf-8; it is never longer than the entity.
+          if (code < 0x80) {
+            *dest++ = (char)code;
+          } else if (code < 0x800) {
+            *dest++ = (char)(0xc0 | (code >> 6));
+            *dest++ = (char)(0x80 | (code & 0x3f));
+          } else if (code < 0x10000) {
+            *dest++ = (char)(0xe0 | (code >> 12));
+            *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+            *dest++ = (char)(0x80 | (code & 0x3f));
+          } else {
+            *dest++ = (char)(0xf0 | (code >> 18));
+            *dest++ = (char)(0x80 | ((code >> 12) & 0x3f));
+            *dest++ = (char)(0x80 | ((code >> 6) & 0x3f));
+            *dest++ = (char)(0x80 | (code & 0x3f));
+          }
+          p += len;
+        }
+      }
+      return dest;
+    }
+
+    // parse a start tag after the '<'.
+    token_t parse_start(char *p) {
+      name = p;
+      while (p != end && !is_name_end(*p)) ++p;
+      if (p == name || p == end) return fail("bad element name", name);
+
+      attributes.resize(0);
+      for (;;) {
+        if (p == end) return fail("unterminated element", name);
+        char c = *p;
+        *p = 0;
+        if (is_space(c)) {
+          p = skip_space(p + 1);
+          if (p == end) return fail("unterminated element", name);
+          c = *p;
+        }
+
+        if (c == '>') {
+          src = p + 1;
+          return token_start;
+        } else if (c == '/') {
+          if (p + 1 == end || p[1] != '>') return fail("expected />", p);
+          src = p + 2;
+          pending_close = true;
+          return token_start;
+        }
+
+        // attribute name
+        char *attr_name = p;
+        while (p != end && !is_name_end(*p)) ++p;
+        if (p == attr_name || p == end) return fail("bad attribute", attr_name);
+        char *attr_name_end = p;
+        p = skip_space(p);
+        if (p == end || *p != '=') return fail("expected =", p);
+        p = skip_space(p + 1);
+        if (p == end || (*p != '"' && *p != '\'')) return fail("expected quote", p);
+        char *value = p + 1;
+        char *value_end = (char*)memchr(value, *p, end - value);
+        if (!value_end) return fail("unterminated attribute", p);
+        *attr_name_end = 0;
+        *decode_entities(value, value_end) = 0;
+        attributes.push_back(attr_name);
+        attributes.push_back(value);
+        p = value_end + 1;
+        if (p != end && !is_space(*p) && *p != '>' && *p != '/') return fail("expected space", p);
+      }
+    }
+
+    // parse a close tag after the "</".
+    token_t parse_close(char *p) {
+      name = p;
+      while (p != end && !is_name_end(*p)) ++p;
+      char *name_end = p;
+      p = skip_space(p);
+      if (p == name || p == end || *p != '>') return fail("bad close tag", name);
+      *name_end = 0;
+      src = p + 1;
+      return token_close;
+    }
+
+  public:
+    /// Parse the text in [begin, end). The text will be modified.
+    xml_pull_parser(char *begin, char *end) {
+      src = begin;
+      this->end = end;
+      at_markup = false;
+      pending_close = false;
+      name = text = error = NULL;
+      error_pos = NULL;
+    }
+
+    /// Get the next token.
+    token_t next() {
+      if (pending_close) {
+        pending_close = false;
+        return token_close;
+      }
+
+      for (;;) {
+        if (src == end) return token_end;
+
+        if (!at_markup && *src != '<') {
+          // text up to the next '<'
+          char *lt = (char*)memchr(src, '<', end - src);
+          char *text_end = lt ? lt : end;
+          char *p = src;
+          while (p != text_end && is_space(*p)) ++p;
+          if (p == text_end) {
+            // whitespace between elements is not reported.
+            src = text_end;
+            continue;
+          }
+          if (!lt) return fail("text after the last element", p);
+          char *q = text_end;
+          while (is_space(q[-1])) --q;
+          q = decode_entities(p, q);
+          at_markup = q == lt;
+          *q = 0;
+          text = p;
+          src = text_end;
+          return token_text;
+        }
+
+        // markup: src is at a '<', which may have been overwritten.
+        at_markup = false;
+        char *p = src + 1;
+        if (p == end) return fail("unterminated tag", src);
+
+        if (*p == '/') {
+          return parse_close(p + 1);
+        } else if (*p == '?') {
+          char *close = find(p, "?>");
+          if (!close) return fail("unterminated processing instruction", src);
+          src = close + 2;
+        } else if (*p == '!') {
+          if (end - p >= 3 && !memcmp(p, "!--", 3)) {
+            char *close = find(p + 3, "-->");
+            if (!close) return fail("unterminated comment", src);
+            src = close + 3;
+          } else if (end - p >= 8 && !memcmp(p, "![CDATA[", 8)) {
+            char *close = find(p + 8, "]]>");
+            if (!close) return fail("unterminated CDATA", src);
+            *close = 0;
+            text = p + 8;
+            src = close + 3;
+            return token_text;
+          } else {
+            // <!DOCTYPE ...> and friends, which may have a [...] section.
+            int depth = 0;
+            for (; p != end && (depth || *p != '>'); ++p) {
+              depth += (*p == '[') - (*p == ']');
+            }
+            if (p == end) return fail("unterminated declaration", src);
+            src = p + 1;
+          }
+        } else {
+          return parse_start(p);
+        }
+      }
+    }
+
+    /// Name of the element for token_start and token_close.
+    const char *get_name() const {
+      return name;
+    }
+
+    /// Text for token_text.
+    const char *get_text() const {
+      return text;
+    }
+
+    /// Number of attributes for token_start.
+    unsigned get_num_attributes() const {
+      return attributes.size() / 2;
+    }
+
+    /// Name of an attribute for token_start.
+    const char *get_attribute_name(unsigned i) const {
+      return attributes[i * 2];
+    }
+
+    /// Value of an attribute for token_start.
+    const char *get_attribute_value(unsigned i) const {
+      return attributes[i * 2 + 1];
+    }
+
+    /// Description of the error after token_error.
+    const char *get_error() const {
+      return error;
+    }
+
+    /// Where the error happened.
+    const char *get_error_pos() const {
+      return error_pos;
+    }
+  };
+
+  /// A name and value of an attribute in an xml_document.
+  struct xml_attribute {
+    const char *name;
+    const char *value;
+  };
+
+  /// An element in an xml_document.
+  class xml_element {
+    friend class xml_document;
+
+    const char *name;
+    const char *text;
+    xml_attribute *attributes;
+    unsigned num_attributes;
+    xml_element *parent;
+    xml_element *first_child;
+    xml_element *next_sibling;
+    void *user_data;
+
+  public:
+    /// The name of the element, eg. "node" for <node>
+    const char *get_name() const {
+      return name;
+    }
+
+    /// The text of the element if it does not start with a child element, or NULL.
+    const char *get_text() const {
+      return text;
+    }
+
+    /// The value of an attribute, or NULL if there is no such attribute.
+    const char *get_attribute(const char *attr_name) const {
+      for (unsigned i = 0; i != num_attributes; ++i) {
+        if (!strcmp(attributes[i].name, attr_name)) return attributes[i].value;
+      }
+      return NULL;
+    }
+
+    /// The first child element, or the first with a certain name.
+    xml_element *get_first_child(const char *child_name = NULL) const {
+      xml_element *elem = first_child;
+      while (elem && child_name && strcmp(elem->name, child_name)) elem = elem->next_sibling;
+      return elem;
+    }
+
+    /// The next element with the same parent, or the next with a certain name.
+    xml_element *get_next_sibling(const char *sibling_name = NULL) const {
+      xml_element *elem = next_sibling;
+      while (elem && sibling_name && strcmp(elem->name, sibling_name)) elem = elem->next_sibling;
+      return elem;
+    }
+
+    /// The parent element, or NULL for the root.
+    xml_element *get_parent() const {
+      return parent;
+    }
+
+    /// Attach some application data.
+    void set_user_data(void *value) {
+      user_data = value;
+    }
+
+    /// Get the application data.
+    void *get_user_data() const {
+      return user_data;
+    }
+  };
+
+  /// An XML document stored as a flat array of elements.
+  ///
+  /// Example
+  ///
+  ///     xml_document doc;
+  ///     app_utils::get_url(doc.access_text(), "assets/duck.dae");
+  ///     if (doc.parse()) {
+  ///       xml_element *geometries = doc.get_root()->get_first_child("library_geometries");
+  ///     }
+  class xml_document {
+    dynarray<uint8_t> text;
+    dynarray<xml_element> elements;
+    dynarray<xml_attribute> attributes;
+    string error;
+
+    // start of the text being parsed, for line numbers.
+    const char *text_begin;
+
+    // count a character, to size the arrays before parsing.
+    static unsigned count(const uint8_t *p, const uint8_t *end, uint8_t c) {
+      unsigned n = 0;
+      for (; (p = (const uint8_t*)memchr(p, c, end - p)) != NULL; ++p) ++n;
+      return n;
+    }
+
+    bool fail(const char *message, const char *pos) {
+      unsigned line = 1 + count((const uint8_t*)text_begin, (const uint8_t*)pos, '\n');
+      error.format("line %d: %s", line, message);
+      elements.reset();
+      attributes.reset();
+      return false;
+    }
+
+  public:
+    xml_document() {
+      text_begin = NULL;
+    }
+
+    /// The buffer to fill with the text of the file before calling parse().
+    dynarray<uint8_t> &access_text() {
+      return text;
+    }
+
+    /// Parse the text. Returns false and sets get_error() if the XML is not well formed.
+    bool parse() {
+      text.push_back(0);
+      return parse((char*)text.data(), (char*)text.data() + text.size() - 1);
+    }
+
+    /// Parse text in [begin, end) that belongs to the caller, such as a copy-on-write file map.
+    /// The text is modified in place and must live as long as the document.
+    bool parse(char *begin, char *end) {
+      elements.reset();
+      attributes.reset();
+      error = "";
+      text_begin = begin;
+
+      // every element starts with '<' and every attribute has an '=', so the arrays
+      // never move and the pointers between elements stay valid.
+      elements.reserve(count((const uint8_t*)begin, (const uint8_t*)end, '<') + 1);
+      attributes.reserve(count((const uint8_t*)begin, (const uint8_t*)end, '=') + 1);
+
+      xml_pull_parser parser(begin, end);
+      xml_element *parent = NULL;
+      xml_element *last_child = NULL;
+      for (;;) {
+        xml_pull_parser::token_t tok = parser.next();
+        if (tok == xml_pull_parser::token_start) {
+          if (!parent && elements.size()) return fail("more than one root element", parser.get_name());
+          xml_element &elem = elements.emplace_back();
+          elem.name = parser.get_name();
+          elem.text = NULL;
+          elem.num_attributes = parser.get_num_attributes();
+          elem.attributes = attributes.data() + attributes.size();
+          for (unsigned i = 0; i != elem.num_attributes; ++i) {
+            xml_attribute &attr = attributes.emplace_back();
+            attr.name = parser.get_attribute_name(i);
+            attr.value = parser.get_attribute_value(i);
+          }
+          elem.parent = parent;
+          elem.first_child = elem.next_sibling = NULL;
+          elem.user_data = NULL;
+          if (last_child) {
+            last_child->next_sibling = &elem;
+          } else if (parent) {
+            parent->first_child = &elem;
+          }
+          parent = &elem;
+          last_child = NULL;
+        } else if (tok == xml_pull_parser::token_close) {
+          if (!parent || strcmp(parent->name, parser.get_name())) return fail("mismatched close tag", parser.get_name());
+          last_child = parent;
+          parent = parent->parent;
+        } else if (tok == xml_pull_parser::token_text) {
+          if (!parent) return fail("text outside the root element", parser.get_text());
+          // like TinyXML's GetText(), only text before the first child counts.
+          if (!parent->first_child && !parent->text) parent->text = parser.get_text();
+        } else if (tok == xml_pull_parser::token_end) {
+          if (parent) return fail("unterminated element", parent->name);
+          if (!elements.size()) return fail("no root element", end);
+          return true;
+        } else {
+          return fail(parser.get_error(), parser.get_error_pos());
+        }
+      }
+    }
+
+    /// The top element, or NULL if the document is empty.
+    xml_element *get_root() {
+      return elements.size() ? &elements[0] : NULL;
+    }
+
+    /// Number of elements in the document.
+    unsigned get_num_elements() const {
+      return elements.size();
+    }
+
+    /// Elements in the order they appear in the file.
+    xml_element *get_element(unsigned index) {
+      return &elements[index];
+    }
+
+    /// Description of the last parse error.
+    const char *get_error() const {
+      return error;
+    }
+  };
+}}
@@ -6,352 +6,419 @@
 //
 //
 // zip deflate format decoder
-// 
+//
+// Huffman codes are decoded with lookup tables indexed by the next bits of
+// the stream. Codes up to the table's root size decode in one lookup; longer
+// codes go through one more lookup in a small sub-table. Each entry also
+// holds the base and extra bit count of length and distance codes.
+//
+// The bits are kept in a 64 bit buffer that is refilled with one unaligned
+// load, which is enough for a whole length/distance pair.
+//
 namespace octet { namespace loaders {
+  /// Deflate decoder. Keep one per thread: the tables for the current block live in the decoder.
   class zip_decoder {
-    enum { debug = 1 };
-
-    struct huffman_table {
-      uint8_t min_lit_length;
-      uint8_t max_lit_length;
-      uint8_t min_dist_length;
-      uint8_t max_dist_length;
-
-      //uint8_t lit_lengths[288];
-      uint16_t lit_codes[288];
-      uint16_t lit_limits[18];
-      uint16_t lit_base[18];
-
-      //uint8_t dist_lengths[32];
-      uint16_t dist_codes[32];
-      uint16_t dist_limits[18];
-      uint16_t dist_base[18];
+    enum {
+      lit_root_bits = 10,
+      dist_root_bits = 8,
+      clen_root_bits = 7,
+
+      // sub-tables for codes longer than the root. Enough for any complete code.
+      lit_table_size = (1 << lit_root_bits) + 2048,
+      dist_table_size = (1 << dist_root_bits) + 1024,
+      clen_table_size = 1 << clen_root_bits,
     };
 
-    huffman_table fixed_;
-    huffman_table var_;
-
-    // on ARM we can do this faster with the "rev" instruction
-    inline static uint16_t rev16(uint16_t value) {
-      // small table version.
-      //static const uint8_t r16[] = { 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf };
-      //return r16[value&0x0f] * 0x1000 | r16[(value>>4)&0x0f] * 0x100 | r16[(value>>8)&0x0f] * 0x10 | r16[value>>12];
-
-      // this table is probably too big to be efficient. L1 cache misses are very expensive.
-      static const uint8_t r256[] = {
-        0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0, 
-        0x00+0x10, 0x80+0x10, 0x40+0x10, 0xc0+0x10, 0x20+0x10, 0xa0+0x10, 0x60+0x10, 0xe0+0x10, 
-        0x00+8, 0x80+8, 0x40+8, 0xc0+8, 0x20+8, 0xa0+8, 0x60+8, 0xe0+8, 
-        0x00+0x10+8, 0x80+0x10+8, 0x40+0x10+8, 0xc0+0x10+8, 0x20+0x10+8, 0xa0+0x10+8, 0x60+0x10+8, 0xe0+0x10+8, 
-        0x00+ 4, 0x80+ 4, 0x40+ 4, 0xc0+ 4, 0x20+ 4, 0xa0+ 4, 0x60+ 4, 0xe0+ 4, 
-        0x00+0x10+ 4, 0x80+0x10+ 4, 0x40+0x10+ 4, 0xc0+0x10+ 4, 0x20+0x10+ 4, 0xa0+0x10+ 4, 0x60+0x10+ 4, 0xe0+0x10+ 4, 
-        0x00+8+ 4, 0x80+8+ 4, 0x40+8+ 4, 0xc0+8+ 4, 0x20+8+ 4, 0xa0+8+ 4, 0x60+8+ 4, 0xe0+8+ 4, 
-        0x00+0x10+8+ 4, 0x80+0x10+8+ 4, 0x40+0x10+8+ 4, 0xc0+0x10+8+ 4, 0x20+0x10+8+ 4, 0xa0+0x10+8+ 4, 0x60+0x10+8+ 4, 0xe0+0x10+8+ 4, 
-        0x00+ 2, 0x80+ 2, 0x40+ 2, 0xc0+ 2, 0x20+ 2, 0xa0+ 2, 0x60+ 2, 0xe0+ 2, 
-        0x00+0x10+ 2, 0x80+0x10+ 2, 0x40+0x10+ 2, 0xc0+0x10+ 2, 0x20+0x10+ 2, 0xa0+0x10+ 2, 0x60+0x10+ 2, 0xe0+0x10+ 2, 
-        0x00+8+ 2, 0x80+8+ 2, 0x40+8+ 2, 0xc0+8+ 2, 0x20+8+ 2, 0xa0+8+ 2, 0x60+8+ 2, 0xe0+8+ 2, 
-        0x00+0x10+8+ 2, 0x80+0x10+8+ 2, 0x40+0x10+8+ 2, 0xc0+0x10+8+ 2, 0x20+0x10+8+ 2, 0xa0+0x10+8+ 2, 0x60+0x10+8+ 2, 0xe0+0x10+8+ 2, 
-        0x00+ 4+ 2, 0x80+ 4+ 2, 0x40+ 4+ 2, 0xc0+ 4+ 2, 0x20+ 4+ 2, 0xa0+ 4+ 2, 0x60+ 4+ 2, 0xe0+ 4+ 2, 
-        0x00+0x10+ 4+ 2, 0x80+0x10+ 4+ 2, 0x40+0x10+ 4+ 2, 0xc0+0x10+ 4+ 2, 0x20+0x10+ 4+ 2, 0xa0+0x10+ 4+ 2, 0x60+0x10+ 4+ 2, 0xe0+0x10+ 4+ 2, 
-        0x00+8+ 4+ 2, 0x80+8+ 4+ 2, 0x40+8+ 4+ 2, 0xc0+8+ 4+ 2, 0x20+8+ 4+ 2, 0xa0+8+ 4+ 2, 0x60+8+ 4+ 2, 0xe0+8+ 4+ 2, 
-        0x00+0x10+8+ 4+ 2, 0x80+0x10+8+ 4+ 2, 0x40+0x10+8+ 4+ 2, 0xc0+0x10+8+ 4+ 2, 0x20+0x10+8+ 4+ 2, 0xa0+0x10+8+ 4+ 2, 0x60+0x10+8+ 4+ 2, 0xe0+0x10+8+ 4+ 2, 
-        0x00+ 1, 0x80+ 1, 0x40+ 1, 0xc0+ 1, 0x20+ 1, 0xa0+ 1, 0x60+ 1, 0xe0+ 1, 
-        0x00+0x10+ 1, 0x80+0x10+ 1, 0x40+0x10+ 1, 0xc0+0x10+ 1, 0x20+0x10+ 1, 0xa0+0x10+ 1, 0x60+0x10+ 1, 0xe0+0x10+ 1, 
-        0x00+8+ 1, 0x80+8+ 1, 0x40+8+ 1, 0xc0+8+ 1, 0x20+8+ 1, 0xa0+8+ 1, 0x60+8+ 1, 0xe0+8+ 1, 
-        0x00+0x10+8+ 1, 0x80+0x10+8+ 1, 0x40+0x10+8+ 1, 0xc0+0x10+8+ 1, 0x20+0x10+8+ 1, 0xa0+0x10+8+ 1, 0x60+0x10+8+ 1, 0xe0+0x10+8+ 1, 
-        0x00+ 4+ 1, 0x80+ 4+ 1, 0x40+ 4+ 1, 0xc0+ 4+ 1, 0x20+ 4+ 1, 0xa0+ 4+ 1, 0x60+ 4+ 1, 0xe0+ 4+ 1, 
-        0x00+0x10+ 4+ 1, 0x80+0x10+ 4+ 1, 0x40+0x10+ 4+ 1, 0xc0+0x10+ 4+ 1, 0x20+0x10+ 4+ 1, 0xa0+0x10+ 4+ 1, 0x60+0x10+ 4+ 1, 0xe0+0x10+ 4+ 1, 
-        0x00+8+ 4+ 1, 0x80+8+ 4+ 1, 0x40+8+ 4+ 1, 0xc0+8+ 4+ 1, 0x20+8+ 4+ 1, 0xa0+8+ 4+ 1, 0x60+8+ 4+ 1, 0xe0+8+ 4+ 1, 
-        0x00+0x10+8+ 4+ 1, 0x80+0x10+8+ 4+ 1, 0x40+0x10+8+ 4+ 1, 0xc0+0x10+8+ 4+ 1, 0x20+0x10+8+ 4+ 1, 0xa0+0x10+8+ 4+ 1, 0x60+0x10+8+ 4+ 1, 0xe0+0x10+8+ 4+ 1, 
-        0x00+ 2+ 1, 0x80+ 2+ 1, 0x40+ 2+ 1, 0xc0+ 2+ 1, 0x20+ 2+ 1, 0xa0+ 2+ 1, 0x60+ 2+ 1, 0xe0+ 2+ 1, 
-        0x00+0x10+ 2+ 1, 0x80+0x10+ 2+ 1, 0x40+0x10+ 2+ 1, 0xc0+0x10+ 2+ 1, 0x20+0x10+ 2+ 1, 0xa0+0x10+ 2+ 1, 0x60+0x10+ 2+ 1, 0xe0+0x10+ 2+ 1, 
-        0x00+8+ 2+ 1, 0x80+8+ 2+ 1, 0x40+8+ 2+ 1, 0xc0+8+ 2+ 1, 0x20+8+ 2+ 1, 0xa0+8+ 2+ 1, 0x60+8+ 2+ 1, 0xe0+8+ 2+ 1, 
-        0x00+0x10+8+ 2+ 1, 0x80+0x10+8+ 2+ 1, 0x40+0x10+8+ 2+ 1, 0xc0+0x10+8+ 2+ 1, 0x20+0x10+8+ 2+ 1, 0xa0+0x10+8+ 2+ 1, 0x60+0x10+8+ 2+ 1, 0xe0+0x10+8+ 2+ 1, 
-        0x00+ 4+ 2+ 1, 0x80+ 4+ 2+ 1, 0x40+ 4+ 2+ 1, 0xc0+ 4+ 2+ 1, 0x20+ 4+ 2+ 1, 0xa0+ 4+ 2+ 1, 0x60+ 4+ 2+ 1, 0xe0+ 4+ 2+ 1, 
-        0x00+0x10+ 4+ 2+ 1, 0x80+0x10+ 4+ 2+ 1, 0x40+0x10+ 4+ 2+ 1, 0xc0+0x10+ 4+ 2+ 1, 0x20+0x10+ 4+ 2+ 1, 0xa0+0x10+ 4+ 2+ 1, 0x60+0x10+ 4+ 2+ 1, 0xe0+0x10+ 4+ 2+ 1, 
-        0x00+8+ 4+ 2+ 1, 0x80+8+ 4+ 2+ 1, 0x40+8+ 4+ 2+ 1, 0xc0+8+ 4+ 2+ 1, 0x20+8+ 4+ 2+ 1, 0xa0+8+ 4+ 2+ 1, 0x60+8+ 4+ 2+ 1, 0xe0+8+ 4+ 2+ 1, 
-        0x00+0x10+8+ 4+ 2+ 1, 0x80+0x10+8+ 4+ 2+ 1, 0x40+0x10+8+ 4+ 2+ 1, 0xc0+0x10+8+ 4+ 2+ 1, 0x20+0x10+8+ 4+ 2+ 1, 0xa0+0x10+8+ 4+ 2+ 1, 0x60+0x10+8+ 4+ 2+ 1, 0xe0+0x10+8+ 4+ 2+ 1, 
-      };
-      return r256[value&0xff] << 8 | r256[(value>>8)&0xff];
+    // what a table entry means
+    enum entry_kind {
+      kind_literal,     // value is a byte (or a code length symbol)
+      kind_base,        // value is the base of a length or distance, extra bits follow
+      kind_end,         // end of block
+      kind_sub,         // value is the offset of a sub-table, extra is its index bits
+      kind_invalid,
+    };
 
-      //value = ( ( value >> 1 ) & 0x5555 ) | ( ( value & 0x5555 ) << 1 );
-      //value = ( ( value >> 2 ) & 0x3333 ) | ( ( value & 0x3333 ) << 2 );
-      //value = ( ( value >> 4 ) & 0x0f0f ) | ( ( value & 0x0f0f ) << 4 );
-      //value = ( ( value >> 8 ) & 0x00ff ) | ( ( value & 0x00ff ) << 8 );
-      //return value;
+    // table entry: value << 16 | kind << 8 | extra << 4 | code bits
+    static uint32_t make_entry(unsigned kind, unsigned value, unsigned extra, unsigned bits) {
+      return value << 16 | kind << 8 | extra << 4 | bits;
     }
 
-    bool build_huffman(uint8_t *lengths, unsigned num_lengths, uint8_t &min_length, uint8_t &max_length, uint16_t *codes, uint16_t *limits, uint16_t *base) {
-      min_length = 16;
-      max_length = 0;
-      for (unsigned i = 0; i != num_lengths; ++i) {
-        if (debug) printf("%d,", lengths[i]);
-        if (lengths[i]) {
-          if (min_length > lengths[i]) min_length = lengths[i];
-          if (max_length < lengths[i]) max_length = lengths[i];
+    static unsigned entry_bits(uint32_t e) { return e & 15; }
+    static unsigned entry_extra(uint32_t e) { return (e >> 4) & 15; }
+    static unsigned entry_kind_of(uint32_t e) { return (e >> 8) & 0xff; }
+    static unsigned entry_value(uint32_t e) { return e >> 16; }
+
+    // which alphabet a table decodes
+    enum table_kind {
+      table_lit,
+      table_dist,
+      table_clen,
+    };
+
+    uint32_t var_lit[lit_table_size];
+    uint32_t var_dist[dist_table_size];
+
+    // little-endian bit reader.
+    // note: this will have to be fixed on PPC and other big-endian devices
+    struct bit_reader {
+      const uint8_t *src;
+      const uint8_t *src_max;
+      uint64_t buf;
+      unsigned count;       // valid bits in buf
+      unsigned overrun;     // zero bytes added past the end of the data
+
+      // make sure there are at least 56 bits in the buffer.
+      void refill() {
+        if (src + 8 <= src_max) {
+          uint64_t v;
+          memcpy(&v, src, 8);
+          buf |= v << count;
+          src += (63 - count) >> 3;
+          count |= 56;
+        } else {
+          while (count <= 56) {
+            uint64_t b = 0;
+            if (src < src_max) b = *src++; else overrun++;
+            buf |= b << count;
+            count += 8;
+          }
         }
       }
-      if (debug) printf("\n");
 
-      if (debug) printf("min_length=%d\n", min_length);
-      if (debug) printf("max_length=%d\n", max_length);
+      unsigned peek(unsigned bits) const {
+        return (unsigned)buf & ((1u << bits) - 1);
+      }
 
-      if ( min_length <= 0 || min_length > max_length || max_length > 16 ) {
-        return false;
+      void consume(unsigned bits) {
+        buf >>= bits;
+        count -= bits;
       }
 
-      unsigned code = 0;
-      unsigned huffcode = 0;
-      for (unsigned length = min_length; length <= max_length; ++length) {
-        base[length-min_length] = huffcode - code;
-        for (unsigned i = 0; i != num_lengths; ++i) {
-          if (lengths[i] == length) {
-            codes[code++] = i;
-            //dump_bits(huffcode << (16-length), 16, "huffcode");
-            huffcode++;
-          }
-        }
-        limits[length-min_length] = (uint16_t)( ( huffcode << (16-length) ) - 1 );
-        if (debug) printf("length %d: lim=%04x base=%04x\n", length, ( huffcode << (16-length) ) - 1, base[length-min_length]);
-        if (( huffcode << (16-length) ) - 1 > 0xffff) {
-          if (debug) printf("invalid huffman table\n");
-          return false;
-        }
-        huffcode *= 2;
+      unsigned get(unsigned bits) {
+        unsigned value = peek(bits);
+        consume(bits);
+        return value;
       }
 
-      // prevent escape from bitstream decoding loop.
-      limits[max_length+1-min_length] = 0xffff;
-      return true;
-    }
+      // true if we have used bits beyond the end of the data
+      bool past_end() const {
+        return overrun * 8 > count;
+      }
+    };
 
-    /// debug function for dumping bit fields
-    void dump_bits(unsigned value, unsigned bits, const char *name) {
-      char tmp[64];
-      assert(bits<63);
-      for (unsigned i = 0; i != bits; ++i) tmp[i] = ( ( value >> (bits-1-i) ) & 1 ) + '0';
-      tmp[bits] = 0;
-      printf("[%s] %s\n", tmp, name);
+    static unsigned reverse_bits(unsigned code, unsigned length) {
+      unsigned result = 0;
+      for (unsigned i = 0; i != length; ++i) {
+        result = result << 1 | (code & 1);
+        code >>= 1;
+      }
+      return result;
     }
 
-    /// peek a fixed number of little-endian bits from the bitstream
-    /// note: this will have to be fixed on PPC and other big-endian devices
-    unsigned peek(const uint8_t *src, unsigned bitptr, unsigned bits, const char *name) {
-      unsigned i = bitptr >> 3, j = bitptr & 7;
-      unsigned value = ( (unsigned&)src[i] >> j ) & ( (1u << bits) - 1 );
-      if (name) dump_bits(value, bits, name);
-      return value;
+    // table entry for a symbol of an alphabet
+    static uint32_t symbol_entry(table_kind tk, unsigned sym, unsigned bits) {
+      static const uint16_t len_base[] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+      };
+      static const uint8_t len_extra[] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+      };
+      static const uint16_t dist_base[] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+      };
+      static const uint8_t dist_extra[] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+      };
+      if (tk == table_lit) {
+        if (sym < 256) return make_entry(kind_literal, sym, 0, bits);
+        if (sym == 256) return make_entry(kind_end, 0, 0, bits);
+        if (sym < 286) return make_entry(kind_base, len_base[sym-257], len_extra[sym-257], bits);
+      } else if (tk == table_dist) {
+        if (sym < 30) return make_entry(kind_base, dist_base[sym], dist_extra[sym], bits);
+      } else {
+        return make_entry(kind_literal, sym, 0, bits);
+      }
+      return make_entry(kind_invalid, 0, 0, bits);
     }
 
-    unsigned decode_uncompressed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      bitptr = ( bitptr + 7 ) & ~7;
-      unsigned bytes_to_copy = peek(src, bitptr, 16, "bytes_to_copy");
-      unsigned clength = peek(src, bitptr + 16, 16, "store length check");
-      bitptr += 32;
+    // build a two level decode table from canonical code lengths.
+    static bool build_table(uint32_t *table, unsigned capacity, unsigned root_bits, const uint8_t *lengths, unsigned num_lengths, table_kind tk) {
+      unsigned count[16] = { 0 };
+      for (unsigned i = 0; i != num_lengths; ++i) {
+        if (lengths[i] > 15) return false;
+        count[lengths[i]]++;
+      }
+      count[0] = 0;
 
-      if (bytes_to_copy != (clength^0xffff)) return ~0;
-      if (dest + bytes_to_copy > dest_max) return ~0;
-      if ((src + bitptr/8) + bytes_to_copy > src_max) return ~0;
+      // reject over-subscribed codes.
+      int left = 1;
+      for (unsigned length = 1; length <= 15; ++length) {
+        left = left * 2 - (int)count[length];
+        if (left < 0) return false;
+      }
 
-      memcpy(dest, src + bitptr/8, bytes_to_copy);
-      dest += bytes_to_copy;
-      bitptr += bytes_to_copy * 8;
-      return bitptr;
-    }
+      unsigned first_code[16];
+      unsigned code = 0;
+      first_code[0] = 0;
+      for (unsigned length = 1; length <= 15; ++length) {
+        code = (code + count[length-1]) << 1;
+        first_code[length] = code;
+      }
 
-    unsigned decode_lz77(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr, huffman_table *table_) {
-      for(;;) {
-        if (src + bitptr/8 > src_max) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > table_->lit_limits[index]) {
-          index++;
+      unsigned root_size = 1u << root_bits;
+      for (unsigned i = 0; i != root_size; ++i) {
+        table[i] = make_entry(kind_invalid, 0, 0, 0);
+      }
+
+      // size the sub-table for each root prefix by its longest code.
+      uint8_t sub_bits[1 << lit_root_bits];
+      memset(sub_bits, 0, root_size);
+      unsigned next_code[16];
+      memcpy(next_code, first_code, sizeof(next_code));
+      for (unsigned i = 0; i != num_lengths; ++i) {
+        unsigned length = lengths[i];
+        if (length > root_bits) {
+          unsigned prefix = reverse_bits(next_code[length], length) & (root_size - 1);
+          if (sub_bits[prefix] < length - root_bits) sub_bits[prefix] = (uint8_t)(length - root_bits);
         }
-        unsigned length = table_->min_lit_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = table_->lit_codes[offset - table_->lit_base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "code");
-
-        if (code < 256) {
-          if (dest+1 > dest_max) return ~0;
-          *dest++ = code;
-          if (debug) printf("%02x\n", code);
-        } else if (code == 256) {
-          return bitptr;
-        } else {
-          unsigned block_length;
-          unsigned distance;
-          {
-            if (debug) printf("[%d]\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
-            };
-            static const uint8_t base[] = {
-              3-3, 4-3, 5-3, 6-3, 7-3, 8-3, 9-3, 10-3,
-              11-3, 13-3, 15-3, 17-3, 19-3, 23-3, 27-3, 31-3,
-              35-3, 43-3, 51-3, 59-3, 67-3, 83-3, 99-3, 115-3,
-              131-3, 163-3, 195-3, 227-3, 258-3,
-            };
-            if (code-257 > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code-257 ];
-            block_length = base[ code-257 ] + 3 + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
+        if (length) next_code[length]++;
+      }
+
+      unsigned next = root_size;
+      for (unsigned prefix = 0; prefix != root_size; ++prefix) {
+        if (sub_bits[prefix]) {
+          unsigned size = 1u << sub_bits[prefix];
+          if (next + size > capacity) return false;
+          table[prefix] = make_entry(kind_sub, next, sub_bits[prefix], root_bits);
+          for (unsigned j = 0; j != size; ++j) {
+            table[next + j] = make_entry(kind_invalid, 0, 0, 0);
+          }
+          next += size;
+        }
+      }
+
+      // fill in the symbols, repeating each entry for the bits it does not use.
+      memcpy(next_code, first_code, sizeof(next_code));
+      for (unsigned i = 0; i != num_lengths; ++i) {
+        unsigned length = lengths[i];
+        if (!length) continue;
+        unsigned rev = reverse_bits(next_code[length]++, length);
+        if (length <= root_bits) {
+          uint32_t e = symbol_entry(tk, i, length);
+          for (unsigned j = rev; j < root_size; j += 1u << length) {
+            table[j] = e;
           }
-          {
-            //if (src + (bitptr + table_->max_dist_length)/8 > src_max ) return ~0;
-            unsigned peek16 = peek(src, bitptr, 16, NULL);
-            unsigned value = rev16(peek16);
-            unsigned index = 0;
-            while (value > table_->dist_limits[index]) {
-              index++;
-            }
-            unsigned length = table_->min_dist_length + index;
-            unsigned offset = ( value >> ( 16 - length ) );
-            unsigned code = table_->dist_codes[offset - table_->dist_base[index]];
-            bitptr += length;
-
-            if (debug) printf("{%d}\n", code);
-            static const uint8_t extra[] = {
-              0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 0, 0, 0,
-            };
-            static const uint16_t base[] = {
-              1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
-            };
-            if (code > sizeof(extra)) return ~0;
-            unsigned extra_length = extra[ code ];
-            distance = base[ code ] + peek(src, bitptr, extra_length, "extra");
-            bitptr += extra_length;
+        } else {
+          uint32_t root = table[rev & (root_size - 1)];
+          uint32_t *sub = table + entry_value(root);
+          unsigned sub_length = length - root_bits;
+          uint32_t e = symbol_entry(tk, i, sub_length);
+          for (unsigned j = rev >> root_bits; j < (1u << entry_extra(root)); j += 1u << sub_length) {
+            sub[j] = e;
           }
+        }
+      }
+      return true;
+    }
 
-          if (debug) printf("length=%d distance=%d\n", block_length, distance);
+    // look up the next symbol. There must be at least 30 bits in the buffer.
+    static uint32_t decode_symbol(bit_reader &br, const uint32_t *table, unsigned root_bits) {
+      uint32_t e = table[br.peek(root_bits)];
+      if (entry_kind_of(e) == kind_sub) {
+        br.consume(root_bits);
+        e = table[entry_value(e) + br.peek(entry_extra(e))];
+      }
+      br.consume(entry_bits(e));
+      return e;
+    }
 
-          if (dest+block_length > dest_max) return ~0;
+    bool decode_uncompressed(uint8_t *&dest, uint8_t *dest_max, bit_reader &br) {
+      // skip to a byte boundary
+      br.consume(br.count & 7);
+      br.refill();
+      unsigned bytes_to_copy = br.get(16);
+      unsigned clength = br.get(16);
+      if (bytes_to_copy != (clength^0xffff)) return false;
+
+      // hand the unused bytes in the buffer back to the source.
+      int back = (int)(br.count / 8) - (int)br.overrun;
+      if (back < 0) return false;
+      const uint8_t *src = br.src - back;
+      br.buf = 0;
+      br.count = 0;
+      br.overrun = 0;
+
+      if (bytes_to_copy > (size_t)(dest_max - dest)) return false;
+      if (bytes_to_copy > (size_t)(br.src_max - src)) return false;
+
+      if (bytes_to_copy) memcpy(dest, src, bytes_to_copy);
+      dest += bytes_to_copy;
+      br.src = src + bytes_to_copy;
+      return true;
+    }
 
-          for(unsigned i = 0; i != block_length; ++i) {
-            dest[0] = dest[-(int)distance];
-            dest++;
+    bool decode_lz77(uint8_t *&dest_, uint8_t *dest_min, uint8_t *dest_max, bit_reader &br, const uint32_t *lit, const uint32_t *dist) {
+      uint8_t *dest = dest_;
+      for(;;) {
+        // enough bits for a length code, its extra bits, a distance code and its extra bits.
+        br.refill();
+        if (br.overrun > 8) return false;
+
+        uint32_t e = decode_symbol(br, lit, lit_root_bits);
+        unsigned kind = entry_kind_of(e);
+        if (kind == kind_literal) {
+          if (dest == dest_max) return false;
+          *dest++ = (uint8_t)entry_value(e);
+          continue;
+        } else if (kind == kind_end) {
+          dest_ = dest;
+          return true;
+        } else if (kind != kind_base) {
+          return false;
+        }
+
+        unsigned block_length = entry_value(e) + br.get(entry_extra(e));
+
+        e = decode_symbol(br, dist, dist_root_bits);
+        if (entry_kind_of(e) != kind_base) return false;
+        unsigned distance = entry_value(e) + br.get(entry_extra(e));
+
+        if (distance > (size_t)(dest - dest_min)) return false;
+        if (block_length > (size_t)(dest_max - dest)) return false;
+
+        const uint8_t *from = dest - distance;
+        if (distance >= 8 && (size_t)(dest_max - dest) >= block_length + 8) {
+          // eight bytes at a time. Each load is of bytes already written, the last store may overrun.
+          uint8_t *end = dest + block_length;
+          do {
+            uint64_t v;
+            memcpy(&v, from, 8);
+            memcpy(dest, &v, 8);
+            from += 8;
+            dest += 8;
+          } while (dest < end);
+          dest = end;
+        } else if (distance == 1) {
+          memset(dest, dest[-1], block_length);
+          dest += block_length;
+        } else {
+          for (unsigned i = 0; i != block_length; ++i) {
+            *dest++ = *from++;
           }
         }
       }
     }
 
-    unsigned decode_fixed(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &fixed_);
-    }
-
-    unsigned decode_variable(uint8_t *&dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max, unsigned bitptr) {
-      unsigned num_lit_codes = peek(src, bitptr, 5, "num_lit_codes") + 257;
-      unsigned num_dist_codes = peek(src, bitptr+5, 5, "num_dist_codes") + 1;
-      unsigned num_length_codes = peek(src, bitptr+10, 4, "num_length_codes") + 4;
-      
-      bitptr += 14;
+    bool decode_variable(uint8_t *&dest, uint8_t *dest_min, uint8_t *dest_max, bit_reader &br) {
+      br.refill();
+      unsigned num_lit_codes = br.get(5) + 257;
+      unsigned num_dist_codes = br.get(5) + 1;
+      unsigned num_length_codes = br.get(4) + 4;
+      if (num_lit_codes > 286 || num_dist_codes > 30) return false;
 
       uint8_t lengths[288 + 32];
-      memset(lengths, 0, 20);
-      if (src + bitptr/8 + num_length_codes > src_max ) return ~0;
+      memset(lengths, 0, 19);
+      static const uint8_t order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
       for (unsigned i = 0; i != num_length_codes; ++i) {
-        static const uint8_t order[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-        lengths[order[i]] = peek(src, bitptr, 3, "length code lenghs");
-        bitptr += 3;
+        br.refill();
+        lengths[order[i]] = (uint8_t)br.get(3);
       }
-      
-      uint16_t codes[19];
-      uint16_t limits[18];
-      uint16_t base[18];
-      uint8_t min_length;
-      uint8_t max_length;
-      if (!build_huffman(lengths, 19, min_length, max_length, codes, limits, base)) return ~0;
-      
+
+      uint32_t clen[clen_table_size];
+      if (!build_table(clen, clen_table_size, clen_root_bits, lengths, 19, table_clen)) return false;
+
       unsigned todo = num_lit_codes + num_dist_codes;
-      for(unsigned done = 0; done < todo;) {
-        if (src + bitptr/8 + max_length > src_max ) return ~0;
-        unsigned peek16 = peek(src, bitptr, 16, NULL);
-        unsigned value = rev16(peek16);
-        unsigned index = 0;
-        while (value > limits[index]) {
-          index++;
-        }
-        unsigned length = min_length + index;
-        unsigned offset = ( value >> ( 16 - length ) );
-        unsigned code = codes[offset - base[index]];
-        bitptr += length;
-        if (debug) dump_bits(peek16, length, "length");
-        //fprintf(source_.debug(), "code=%03x\n", code);
+      for (unsigned done = 0; done < todo;) {
+        br.refill();
+        if (br.overrun > 8) return false;
+        uint32_t e = decode_symbol(br, clen, clen_root_bits);
+        if (entry_kind_of(e) != kind_literal) return false;
+        unsigned code = entry_value(e);
         unsigned copy = 1;
         if (code < 16) {
-        } else if(code == 16) {
-          if (src + (bitptr+2)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 2, NULL) + 3;
-          bitptr += 2;
-          if (done == 0) return ~0;
-          code = lengths[ done-1 ];
-        } else if(code == 17) {
-          if (src + (bitptr+3)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 3, NULL) + 3;
-          bitptr += 3;
-          code = 0;
-        } else if(code == 18) {
-          if (src + (bitptr+7)/8 > src_max ) return ~0;
-          copy = peek(src, bitptr, 7, NULL) + 11;
-          bitptr += 7;
+        } else if (code == 16) {
+          if (done == 0) return false;
+          copy = br.get(2) + 3;
+          code = lengths[done-1];
+        } else if (code == 17) {
+          copy = br.get(3) + 3;
           code = 0;
         } else {
-          return ~0;
+          copy = br.get(7) + 11;
+          code = 0;
         }
-        if (done + copy > todo) return ~0;
-        do {
-          lengths[done++] = code;
-        } while( --copy );
+        if (done + copy > todo) return false;
+        memset(lengths + done, code, copy);
+        done += copy;
       }
 
-      if (debug) printf("lengths done\n");
+      // there must be an end of block code
+      if (lengths[256] == 0) return false;
 
-      if(
-        !build_huffman(lengths, num_lit_codes, var_.min_lit_length, var_.max_lit_length, var_.lit_codes, var_.lit_limits, var_.lit_base) ||
-        !build_huffman(lengths+num_lit_codes, num_dist_codes, var_.min_dist_length, var_.max_dist_length, var_.dist_codes, var_.dist_limits, var_.dist_base)
+      if (
+        !build_table(var_lit, lit_table_size, lit_root_bits, lengths, num_lit_codes, table_lit) ||
+        !build_table(var_dist, dist_table_size, dist_root_bits, lengths + num_lit_codes, num_dist_codes, table_dist)
       ) {
-        return ~0;
+        return false;
+      }
+      return decode_lz77(dest, dest_min, dest_max, br, var_lit, var_dist);
+    }
+    // tables for the fixed code, shared by all decoders.
+    struct fixed_tables_t {
+      uint32_t lit[lit_table_size];
+      uint32_t dist[dist_table_size];
+
+      fixed_tables_t() {
+        uint8_t lit_lengths[288];
+        uint8_t dist_lengths[32];
+        memset(lit_lengths +   0, 8, 144 - 0);
+        memset(lit_lengths + 144, 9, 256-144);
+        memset(lit_lengths + 256, 7, 280-256);
+        memset(lit_lengths + 280, 8, 288-280);
+        memset(dist_lengths, 5, 32);
+        build_table(lit, lit_table_size, lit_root_bits, lit_lengths, 288, table_lit);
+        build_table(dist, dist_table_size, dist_root_bits, dist_lengths, 32, table_dist);
       }
-      return decode_lz77(dest, dest_max, src, src_max, bitptr, &var_);
+    };
+
+    static const fixed_tables_t &fixed() {
+      static fixed_tables_t instance;
+      return instance;
     }
+
   public:
     zip_decoder() {
-      uint8_t lit_lengths[288];
-      uint8_t dist_lengths[32];
-      memset(lit_lengths +   0, 8, 144 - 0);
-      memset(lit_lengths + 144, 9, 256-144);
-      memset(lit_lengths + 256, 7, 280-256);
-      memset(lit_lengths + 280, 8, 288-280);
-      memset(dist_lengths, 5, 32);
-      build_huffman(lit_lengths, 288, fixed_.min_lit_length, fixed_.max_lit_length, fixed_.lit_codes, fixed_.lit_limits, fixed_.lit_base);
-      build_huffman(dist_lengths, 32, fixed_.min_dist_length, fixed_.max_dist_length, fixed_.dist_codes, fixed_.dist_limits, fixed_.dist_base);
+      fixed();
     }
 
-    void decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
-      unsigned bitptr = 0;
-      unsigned is_last_block;
+    /// Inflate a deflate stream into [dest, dest_max). Returns false if the data is bad.
+    bool decode(uint8_t *dest, uint8_t *dest_max, const uint8_t *src, const uint8_t *src_max) {
+      uint8_t *dest_min = dest;
+      bit_reader br;
+      br.src = src;
+      br.src_max = src_max;
+      br.buf = 0;
+      br.count = 0;
+      br.overrun = 0;
 
       // for each "deflate" block:
-      do {
-        // prevent (bitptr / 8) from overflowing (>512Mib)
-        src += bitptr / 8;
-        bitptr %= 8;
-
+      for (;;) {
         // three bits determine kind and exit condition
-        is_last_block = peek(src, bitptr, 1, "deflate last") != 0;
-        unsigned kind = peek(src, bitptr + 1, 2, "deflate kind");
+        br.refill();
+        unsigned is_last_block = br.get(1);
+        unsigned kind = br.get(2);
 
-        bitptr += 3;
+        bool ok = false;
         switch (kind) {
-        case 0: bitptr = decode_uncompressed(dest, dest_max, src, src_max, bitptr); break;
-        case 1: bitptr = decode_fixed(dest, dest_max, src, src_max, bitptr); break;
-        case 2: bitptr = decode_variable(dest, dest_max, src, src_max, bitptr); break;
-        default: return;
+          case 0: ok = decode_uncompressed(dest, dest_max, br); break;
+          case 1: ok = decode_lz77(dest, dest_min, dest_max, br, fixed().lit, fixed().dist); break;
+          case 2: ok = decode_variable(dest, dest_min, dest_max, br); break;
         }
-      } while( !is_last_block && bitptr != ~0);
+        if (!ok || br.past_end()) return false;
+        if (is_last_block) return true;
+      }
     }
   };
 }}
-
@@ -62,7 +62,7 @@ namespace octet {
 }
 
 // numbers
-#include "scalar.h"
+// scalar.h is included by octet.h before the containers, which use its bit operations.
 #include "random.h"
 #include "rational.h"
 #include "vec2.h"
@@ -157,13 +157,48 @@ namespace octet { namespace math {
     //return *(unsigned*)src;
   }
 
+  /// return number of 1 bits in a 64 bit word
+  inline static unsigned pop_count64(uint64_t v) {
+    #if defined(__GNUC__)
+      return (unsigned)__builtin_popcountll(v);
+    #elif defined(_MSC_VER) && defined(_M_X64) && defined(__AVX2__)
+      return (unsigned)__popcnt64(v);
+    #else
+      v = v - ((v >> 1) & 0x5555555555555555ULL);
+      v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+      v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+      return (unsigned)((v * 0x0101010101010101ULL) >> 56);
+    #endif
+  }
+
+  /// count trailing zeros of a non-zero 64 bit word, ie. the index of the lowest 1 bit.
+  inline static unsigned ctz64(uint64_t v) {
+    #if defined(__GNUC__)
+      return (unsigned)__builtin_ctzll(v);
+    #elif defined(_MSC_VER) && defined(_M_X64)
+      unsigned long index;
+      _BitScanForward64(&index, v);
+      return (unsigned)index;
+    #elif defined(_MSC_VER)
+      unsigned long index;
+      if (_BitScanForward(&index, (unsigned long)v)) return (unsigned)index;
+      _BitScanForward(&index, (unsigned long)(v >> 32));
+      return (unsigned)index + 32;
+    #else
+      unsigned n = 0;
+      while (!(v & 1)) { v >>= 1; n++; }
+      return n;
+    #endif
+  }
+
   /// return number of 1 bits
   inline static int pop_count(uint32_t v) {
-    v = (v & 0x55555555) + ((v>>1) & 0x55555555);
-    v = (v & 0x33333333) + ((v>>2) & 0x33333333);
-    v = (v & 0x0f0f0f0f) + ((v>>4) & 0x0f0f0f0f);
-    v = (v & 0x00ff00ff) + ((v>>8) & 0x00ff00ff);
-    return (v + (v>>16)) & 0xff;
+    return (int)pop_count64(v);
+  }
+
+  /// count trailing zeros of a non-zero value. Examples: 1 -> 0, 0x80 -> 7
+  inline static int ctz(uint32_t v) {
+    return (int)ctz64(v);
   }
 
   /// count leading zeros. Examples: 0xffffffff -> 0, 0x00ffffff -> 8, 0x00000000 -> 32
@@ -96,12 +96,16 @@
   // defines and configuration
   #include "platform/configure.h"
 
+  // scalar helpers and bit intrinsics, also used by the containers
+  #include "math/scalar.h"
+
   // data storage in containers
   #include "containers/containers.h"
 
   // target specific support: Windows, Mac, Linux, PS Vita
   #include "platform/machine_specific.h"
   #include "platform/args_parser.h"
+  #include "platform/worker_pool.h"
 
   // math library
   #include "math/math.h"
@@ -149,6 +153,8 @@
 
   // asset loaders
   #include "loaders/collada_builder.h"
+  #include "loaders/obj_loader.h"
+  #include "loaders/mesh_cache.h"
 
   // forward references
   #include "resources/resources.inl"
@@ -164,9 +164,11 @@ namespace octet {
       return frame_number;
     }
 
-    void inc_frame_number() {
-      frame_number++;
-    }
+    // defined in resources.inl as it needs the resource class.
+    void inc_frame_number();
+
+    // called from init() before app_init(), on the thread that renders. Defined in resources.inl.
+    static void init_render_thread();
 
     dynarray<string> &access_load_queue() {
       return load_queue;
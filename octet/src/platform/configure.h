@@ -36,6 +36,71 @@
   #define GL_UNIFORM_BUFFER 0
 #endif
 
+// SSE2 intrinsics exist on every x86-64 target, but OCTET_SSE is only set for WIN32 and OSX.
+#if !defined(OCTET_SSE2) && (OCTET_SSE || defined(__SSE2__) || defined(_M_X64))
+  #define OCTET_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+// AVX2 is only used when the compiler targets it (-mavx2 or /arch:AVX2).
+#if !defined(OCTET_AVX2) && defined(__AVX2__)
+  #define OCTET_AVX2 1
+  #include <immintrin.h>
+#endif
+
+// std140 uniform blocks need OpenGL 3.1; GLES2, the Vita and legacy OSX contexts do not have them.
+#ifndef OCTET_UNIFORM_BUFFERS
+  #if OCTET_MAC || OCTET_VITA || defined(OCTET_GLES2)
+    #define OCTET_UNIFORM_BUFFERS 0
+  #else
+    #define OCTET_UNIFORM_BUFFERS 1
+  #endif
+#endif
+
+// pixel buffer objects with glMapBufferRange need OpenGL 3.0 or GLES3, like uniform buffers.
+#ifndef OCTET_PIXEL_BUFFERS
+  #define OCTET_PIXEL_BUFFERS OCTET_UNIFORM_BUFFERS
+#endif
+
+// load image files used by scenes on the texture_loader threads. Each texture is
+// grey until its file has been decoded. 0 decodes them on the render thread when first drawn.
+#ifndef OCTET_ASYNC_TEXTURES
+  #define OCTET_ASYNC_TEXTURES 1
+#endif
+
+// reference counting policy for resources:
+//   0: plain counts, ref<> must never cross threads.
+//   1: resources marked with set_shared() use atomic counts, all others stay plain.
+//   2: every resource uses atomic counts.
+#ifndef OCTET_ATOMIC_REFCOUNT
+  #define OCTET_ATOMIC_REFCOUNT 1
+#endif
+
+// allocation profiling: count allocations per tagged_allocator tag and per frame.
+// Costs a few atomic adds per allocation, so it is off unless asked for.
+#ifndef OCTET_ALLOC_PROFILE
+  #define OCTET_ALLOC_PROFILE 0
+#endif
+
+// thread local storage for plain data. Older compilers do not have C++11 thread_local.
+#ifndef OCTET_THREAD_LOCAL
+  #if defined(_MSC_VER)
+    #define OCTET_THREAD_LOCAL __declspec(thread)
+  #else
+    #define OCTET_THREAD_LOCAL __thread
+  #endif
+#endif
+
+// clean up per-thread caches when any thread exits, using a C++11 thread_local destructor.
+// Without it, threads must call allocator::release_thread_cache() themselves.
+#ifndef OCTET_THREAD_EXIT
+  #if OCTET_VITA
+    #define OCTET_THREAD_EXIT 0
+  #else
+    #define OCTET_THREAD_EXIT 1
+  #endif
+#endif
+
 // use <> to include from standard directories
 // use "" to include from our own project
 #include <stdio.h>
@@ -55,11 +120,20 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 #if defined(WIN32)
   #include <direct.h>
 #endif
 
+#if defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
 namespace octet {
   /// write some text to log.txt
   inline static FILE * log(const char *fmt, ...) {
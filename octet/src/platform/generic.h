@@ -102,6 +102,7 @@ namespace octet {
     // initialiser (it is nice to keep the two separate for aggregate memory allocation)
     void init() {
       set_viewport_size(512, 512);
+      init_render_thread();
       app_init();
     }
 
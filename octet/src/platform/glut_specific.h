@@ -76,6 +76,7 @@ namespace octet {
       #ifdef WIN32
         init_wgl();
       #endif
+      init_render_thread();
       app_init();
     }
 
@@ -179,6 +179,7 @@ namespace octet {
       GetClientRect(window_handle, &rect);
       set_viewport_size(rect.right - rect.left, rect.bottom - rect.top);
 
+      init_render_thread();
       app_init();
 
       ShowWindow (window_handle, SW_SHOW);
@@ -0,0 +1,184 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Pool of worker threads for data-parallel loops
+//
+
+namespace octet { namespace platform {
+  /// A fixed set of worker threads used to split loops across cores.
+  ///
+  /// Work is split into fixed chunks of indices and every index is visited exactly once.
+  /// If each index only writes its own data, the result is identical to a serial loop
+  /// whatever the number of threads.
+  ///
+  /// Example
+  ///
+  ///     worker_pool::get().parallel_for(num_items, 64, [&](unsigned begin, unsigned end) {
+  ///       for (unsigned i = begin; i != end; ++i) {
+  ///         results[i] = work(items[i]);
+  ///       }
+  ///     });
+  ///
+  /// Note: only copy ref<> objects inside a kernel if the resource has been through set_shared().
+  class worker_pool {
+    typedef void (*kernel_t)(void *context, unsigned begin, unsigned end);
+
+    std::thread *threads;
+    unsigned num_threads;
+
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+
+    // the current batch: only written while no worker is active
+    kernel_t kernel;
+    void *context;
+    unsigned count;
+    unsigned chunk_size;
+    unsigned num_chunks;
+    std::atomic<unsigned> next_chunk;
+    std::atomic<unsigned> chunks_done;
+
+    unsigned generation;  // incremented for every batch
+    unsigned active;      // workers inside run_chunks()
+    bool busy;            // a batch is in progress
+    bool quit;
+
+    // do chunks until there are none left. Called by workers and by the caller.
+    void run_chunks() {
+      for (;;) {
+        unsigned chunk = next_chunk.fetch_add(1);
+        if (chunk >= num_chunks) break;
+        unsigned begin = chunk * chunk_size;
+        unsigned end = count - begin < chunk_size ? count : begin + chunk_size;
+        kernel(context, begin, end);
+        chunks_done.fetch_add(1);
+      }
+    }
+
+    void worker_main() {
+      unsigned seen = 0;
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        while (!quit && generation == seen) {
+          work_ready.wait(lock);
+        }
+        if (quit) break;
+        seen = generation;
+        active++;
+        lock.unlock();
+        run_chunks();
+        lock.lock();
+        active--;
+        work_done.notify_all();
+      }
+      lock.unlock();
+
+      // blocks cached by this thread would be lost when it exits.
+      containers::frame_allocator::release_thread_arena();
+      containers::allocator::release_thread_cache();
+    }
+
+    template <class fn_t> static void thunk(void *context, unsigned begin, unsigned end) {
+      (*(fn_t*)context)(begin, end);
+    }
+
+    void run(unsigned new_count, unsigned new_chunk_size, kernel_t new_kernel, void *new_context) {
+      if (new_chunk_size == 0) new_chunk_size = 1;
+
+      std::unique_lock<std::mutex> lock(mutex);
+
+      // serial if we are small, have no workers, or are called from inside a kernel.
+      if (busy || num_threads == 0 || new_count <= new_chunk_size) {
+        lock.unlock();
+        new_kernel(new_context, 0, new_count);
+        return;
+      }
+
+      // late-waking workers from the previous batch must leave before we change the batch.
+      while (active != 0) {
+        work_done.wait(lock);
+      }
+
+      busy = true;
+      kernel = new_kernel;
+      context = new_context;
+      count = new_count;
+      chunk_size = new_chunk_size;
+      num_chunks = (new_count + new_chunk_size - 1) / new_chunk_size;
+      next_chunk = 0;
+      chunks_done = 0;
+      generation++;
+      work_ready.notify_all();
+      lock.unlock();
+
+      // the calling thread does its share too.
+      run_chunks();
+
+      lock.lock();
+      while (chunks_done != num_chunks || active != 0) {
+        work_done.wait(lock);
+      }
+      busy = false;
+    }
+
+    // do not define this!
+    worker_pool(const worker_pool &rhs);
+
+  public:
+    /// Start the workers. By default, use one thread per core, including the caller.
+    worker_pool(int threads_to_use = -1) {
+      kernel = 0;
+      context = 0;
+      count = chunk_size = num_chunks = 0;
+      next_chunk = 0;
+      chunks_done = 0;
+      generation = 0;
+      active = 0;
+      busy = false;
+      quit = false;
+
+      if (threads_to_use < 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        threads_to_use = cores > 1 ? (int)cores - 1 : 0;
+      }
+      num_threads = (unsigned)threads_to_use;
+      threads = num_threads ? new std::thread[num_threads] : 0;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i] = std::thread(&worker_pool::worker_main, this);
+      }
+    }
+
+    /// Stop and join the workers.
+    ~worker_pool() {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        quit = true;
+        work_ready.notify_all();
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+      delete [] threads;
+    }
+
+    /// The shared pool used by the framework.
+    static worker_pool &get() {
+      static worker_pool instance;
+      return instance;
+    }
+
+    /// number of threads that run kernels, including the calling thread.
+    unsigned get_num_threads() const {
+      return num_threads + 1;
+    }
+
+    /// Call fn(begin, end) for chunks of [0, count) on all threads and wait for them to finish.
+    template <class fn_t> void parallel_for(unsigned count, unsigned chunk_size, fn_t fn) {
+      run(count, chunk_size, &thunk<fn_t>, (void*)&fn);
+    }
+  };
+} }
@@ -28,33 +28,40 @@ namespace octet { namespace resources {
   /// A set of utilities   
   class app_utils {
   public:
+    // if the prefix is not set, try to find the root directory by opening README.txt
+    static const char *find_prefix() {
+      const char *rme = "../../../../README.txt";
+      const char *pfx = "../../../../";
+      for (int i = 0; i != 5; ++i) {
+        FILE *test = fopen(rme + i * 3, "rb");
+        if (test) {
+          fclose(test);
+          return pfx + i * 3;
+        }
+      }
+      return NULL;
+    }
+
     /// Set and get the file prefix. This is used to find resource files in the game.
     static const char *prefix(const char *new_prefix=NULL) {
-      static const char *value = NULL;
+      // the search happens once, even if the first call is on a loader thread.
+      static const char *value = find_prefix();
       if (new_prefix) {
         value = new_prefix;
-      } else if (value == NULL) {
-        // if the prefix is not set, try to find the root directory by opening README.txt
-        const char *rme = "../../../../README.txt";
-        const char *pfx = "../../../../";
-        for (int i = 0; i != 5; ++i) {
-          FILE *test = fopen(rme + i * 3, "rb");
-          if (test) {
-            fclose(test);
-            value = pfx + i * 3;
-            break;
-          }
-        }
       }
       return value;
     }
 
-    /// open a zip file for a given URL
+    /// open a zip file for a given URL. Zip files stay open, so the pointer is valid for the life of the app.
     static zip_file *get_zip_file(const char *url) {
+      static std::mutex mutex;
       static dictionary<ref<zip_file> > zip_files;
+      std::lock_guard<std::mutex> lock(mutex);
       int index = zip_files.get_index(url);
       if (index == -1) {
-        return zip_files[url] = new zip_file(get_path(url));
+        string path;
+        get_path(path, url);
+        return zip_files[url] = new zip_file(path.c_str());
       } else {
         return zip_files.get_value(index);
       }
@@ -68,40 +75,59 @@ namespace octet { namespace resources {
       buffer[(y*size+x)*4+3] = a;
     }
   
-    /// Convert a url into a file path.
-    static const char *get_path(const char *url) {
-      if (url == NULL) return "";
+    /// Convert a url into a file path. Safe to call from any thread.
+    static void get_path(string &path, const char *url) {
+      if (url == NULL) {
+        path = "";
+        return;
+      }
 
       string url_str;
       url_str.urldecode(url);
-      static string path;
 
       if (url[0] == '/' || (url[0] >= 'A' && url[0] <= 'Z' && url[1] == ':')) {
         path = url_str;
       } else {
         // relative path
-        path.format("%s%s", prefix(), url_str.c_str());
+        const char *pfx = prefix();
+        path.format("%s%s", pfx ? pfx : "", url_str.c_str());
       }
+    }
+
+    /// Convert a url into a file path.
+    /// Note: the result is overwritten by the next call, use get_path(string&, url) on other threads.
+    static const char *get_path(const char *url) {
+      static string path;
+      get_path(path, url);
       return path;
     }
 
+    /// Split a zip://path/archive.zip/file URL into the archive and the file within it.
+    static zip_file *get_zip_file_for_url(const char *url, const char *&file) {
+      const char *zip = strstr(url + 6, ".zip");
+      if (!zip) return 0;
+      int path_len = (int)(zip - (url + 6) + 4);
+      string zip_url;
+      zip_url.set(url + 6, path_len);
+      file = (url + 6) + path_len;
+      file += file[0] == '/';
+      return get_zip_file(zip_url.c_str());
+    }
+
     /// Get a file into a buffer, given a URL.
     static void get_url(dynarray<unsigned char> &buffer, const char *url) {
       if (!strncmp(url, "zip://", 6)) {
-        const char *zip = strstr(url + 6, ".zip");
+        const char *file = 0;
+        zip_file *zip = get_zip_file_for_url(url, file);
         if (zip) {
-          int path_len = (int)(zip - (url + 6) + 4);
-          string zip_url;
-          zip_url.set(url + 6, path_len);
-          const char *file = (url + 6) + path_len;
-          file += file[0] == '/';
-          zip_file *zip = get_zip_file(zip_url.c_str());
           zip->get_file(buffer, file);
         }
       } else if (!strncmp(url, "http://", 7)) {
         // http
       } else {
-        const char *path = get_path(url);
+        string path_str;
+        get_path(path_str, url);
+        const char *path = path_str.c_str();
         FILE *file = fopen(path, "rb");
         if (!file) {
           char tmp[1024];
@@ -118,6 +144,44 @@ namespace octet { namespace resources {
       }
     }
 
+    /// Get a read-only view of the contents of a URL without copying it.
+    /// Plain files are memory mapped. Returns false if the URL could not be read.
+    /// With copy_on_write, view.access_data() can be written to without changing the source,
+    /// for example by an in-place parser.
+    static bool get_url_view(url_view &view, const char *url, file_map::access_hint hint=file_map::access_sequential, bool copy_on_write=false) {
+      if (!strncmp(url, "zip://", 6)) {
+        // stored files are viewed in the zip's mapping, compressed ones are inflated into a buffer.
+        const char *file = 0;
+        zip_file *zip = get_zip_file_for_url(url, file);
+        if (!zip || !zip->get_file_view(view, file) || view.size() == 0) return false;
+        if (copy_on_write && !view.access_data()) {
+          // the zip is mapped read-only, so stored files are copied.
+          dynarray<uint8_t> copy;
+          copy.append(view.data(), (unsigned)view.size());
+          view.access_buffer() = std::move(copy);
+          view.update_buffer();
+        }
+        return true;
+      } else if (!strncmp(url, "http://", 7)) {
+        // remote data must be fetched into a buffer.
+        get_url(view.access_buffer(), url);
+        view.update_buffer();
+        return view.size() != 0;
+      }
+
+      string path;
+      get_path(path, url);
+      file_map *map = new file_map(path.c_str(), hint, copy_on_write);
+      if (map->get_error()) {
+        char tmp[1024];
+        printf("file %s not found. cwd=%s\n", path.c_str(), getcwd(tmp, sizeof(tmp)));
+        delete map;
+        return false;
+      }
+      view.set_map(map);
+      return true;
+    }
+
     /// Generate a stock texture. To be deprecated.
     static GLuint get_stock_texture(unsigned gl_kind, const char *name) {
       //stock_texture_generator stock;
@@ -232,12 +296,15 @@ namespace octet { namespace resources {
           (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
         }
       }
-      if (dict->contains(name)) {
-        //log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
+      // hash the name once for both the lookup and the insert.
+      string_key key(name);
+      int index = dict->get_index(key);
+      if (index != -1) {
+        //log("old atom %s %d\n", name, dict->get_value(index));
+        return dict->get_value(index);
       } else {
         //log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
+        return (*dict)[key] = (atom_t)num_atoms++;
       }
     }
 
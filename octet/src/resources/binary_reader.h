@@ -4,22 +4,40 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// visitor for writing xml files.
+// visitor for reading binary files.
 //
 
 namespace octet { namespace resources {
   /// The binary reader is a visitor that is used to load a binary file.
   /// The binary reader will use a factory to create new classes, providied the class is in classes.h
+  /// The stream is read in one go and large arrays are read straight into place; see binary_writer for the layout.
   class binary_reader : public visitor {
-    enum { debug = true };
-    hash_map<void *, int> refs;
+    enum { debug = false };
     dynarray<void *> id_to_ref;
+
+    // file atom -> atom in this run, for user atoms.
+    dynarray<atom_t> atom_map;
     FILE *file;
-    char tmp[256];
 
-    void read(uint8_t *src, size_t bytes) {
+    // the stream is read in one go. Strings point into it.
+    dynarray<uint8_t> stream;
+    const uint8_t *src;
+    const uint8_t *src_max;
+
+    // size of the blob section and how far into it the file has been read.
+    size_t blob_size;
+    size_t blob_pos;
+
+    void read(uint8_t *dest, size_t bytes) {
       //if (debug) log("read %08x bytes\n", bytes);
-      fread(src, 1, bytes, file);
+      if ((size_t)(src_max - src) < bytes) {
+        memset(dest, 0, bytes);
+        src = src_max;
+        set_error(true);
+      } else if (bytes) {
+        memcpy(dest, src, bytes);
+        src += bytes;
+      }
     }
 
     int read_int() {
@@ -39,21 +57,56 @@ namespace octet { namespace resources {
     }
 
     const char *read_string() {
-      int nchars = 0;
-      for(;;) {
-        int c = fgetc(file);
-        tmp[nchars] = c;
-        if (c == 0) break;
-        nchars += nchars != sizeof(tmp)-1;
+      const uint8_t *end = src != src_max ? (const uint8_t*)memchr(src, 0, src_max - src) : NULL;
+      if (!end) {
+        // a truncated file.
+        set_error(true);
+        src = src_max;
+        return "";
+      }
+      const char *value = (const char*)src;
+      src = end + 1;
+      if (debug) log("%*sread %s\n", get_depth()*2, "", value);
+      return value;
+    }
+
+    // read a blob from the file into place. Blobs are read in the order they were written.
+    void read_blob(uint8_t *dest, size_t bytes, size_t offset) {
+      if (debug) log("%*sread blob %08x at %08x\n", get_depth()*2, "", bytes, offset);
+      if (offset < blob_pos || offset > blob_size || bytes > blob_size - offset) {
+        log("error: bad blob offset\n");
+        set_error(true);
+      }
+
+      // skip the alignment padding.
+      uint8_t padding[binary_writer::blob_alignment];
+      while (!get_error() && blob_pos != offset) {
+        size_t skip = offset - blob_pos < sizeof(padding) ? offset - blob_pos : sizeof(padding);
+        if (fread(padding, 1, skip, file) != skip) set_error(true);
+        blob_pos += skip;
+      }
+
+      if (get_error() || fread(dest, 1, bytes, file) != bytes) {
+        memset(dest, 0, bytes);
+        set_error(true);
+      }
+      blob_pos = offset + bytes;
+    }
+
+    // read the contents of a visit_bin, inline or from the blob section.
+    void read_bytes(uint8_t *dest, size_t bytes) {
+      if (bytes < binary_writer::min_blob_size) {
+        read(dest, bytes);
+      } else {
+        size_t offset = (unsigned)read_int();
+        read_blob(dest, bytes, offset);
       }
-      if (debug) log("%*sread %s\n", get_depth()*2, "", tmp);
-      return tmp;
     }
 
     bool check_atom(atom_t sid) {
       if (!get_error()) {
         atom_t test = read_atom();
-        log("%*scheck_atom %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
+        if (debug) log("%*scheck_atom %s\n", get_depth()*2, "", app_utils::get_atom_name(sid));
         if (test != sid) {
           log("error: expected %s\n", app_utils::get_atom_name(sid));
           set_error(true);
@@ -65,7 +118,7 @@ namespace octet { namespace resources {
     bool check_size(size_t size) {
       if (!get_error()) {
         int test = read_int();
-        log("%*scheck_size %d\n", get_depth()*2, "", size);
+        if (debug) log("%*scheck_size %d\n", get_depth()*2, "", size);
         if (test != (int)size) {
           log("error: expected %d bytes\n", size);
           set_error(true);
@@ -75,7 +128,7 @@ namespace octet { namespace resources {
     }
 
     void *get_ref(int id) {
-      log("%*sget_ref %d/%d\n", get_depth()*2, "", id, id_to_ref.size());
+      if (debug) log("%*sget_ref %d/%d\n", get_depth()*2, "", id, id_to_ref.size());
       if (id == (int)id_to_ref.size()) {
         return NULL;
       } else if (id > (int)id_to_ref.size()) {
@@ -95,10 +148,45 @@ namespace octet { namespace resources {
       id_to_ref.push_back(NULL);
 
       this->file = file;
-      char tmp[8];
-      fread(tmp, 1, sizeof(tmp), file);
-      if (memcmp(tmp, "octet", 5)) {
+      src = src_max = NULL;
+      blob_size = blob_pos = 0;
+
+      uint8_t header[binary_writer::header_size];
+      if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, "octet\r\n\x02", 8)) {
+        set_error(true);
+        return;
+      }
+
+      uint32_t sizes[2] = { 0, 0 };
+      for (unsigned i = 0; i != 8; ++i) {
+        sizes[i/4] |= (uint32_t)header[8 + i] << (i % 4 * 8);
+      }
+      blob_size = sizes[0];
+
+      // everything except the blobs in one read, then go back to the blobs.
+      stream.resize(sizes[1]);
+      if (
+        fseek(file, (long)blob_size, SEEK_CUR) ||
+        (sizes[1] && fread(stream.data(), 1, sizes[1], file) != sizes[1]) ||
+        fseek(file, -(long)(blob_size + sizes[1]), SEEK_CUR)
+      ) {
         set_error(true);
+        return;
+      }
+      src = stream.data();
+      src_max = src + stream.size();
+
+      // names of the writer's user atoms.
+      int num_user_atoms = read_int();
+      for (int i = 0; i < num_user_atoms && !get_error(); ++i) {
+        int value = read_int();
+        atom_t atom = app_utils::get_atom(read_string());
+        if (value <= 0 || value >= atom_class_base) {
+          set_error(true);
+          return;
+        }
+        while ((int)atom_map.size() <= value) atom_map.push_back(atom_);
+        atom_map[value] = atom;
       }
     }
 
@@ -112,6 +200,11 @@ namespace octet { namespace resources {
       return true;
     }
 
+    /// map an atom from the file to one in this run.
+    atom_t translate_atom(atom_t value) {
+      return (unsigned)value < atom_map.size() && atom_map[value] ? atom_map[value] : value;
+    }
+
     /// register a reference after creating a new object
     void add_new_ref(void *ref) {
       id_to_ref.push_back(ref);
@@ -176,14 +269,20 @@ namespace octet { namespace resources {
     /// Begin reading a dynarray
     unsigned begin_read_dynarray(unsigned elem_size, atom_t &sid) {
       if (!check_atom(atom_dynarray) && !check_atom(sid)) {
-        return (unsigned)read_int() / elem_size;
+        unsigned bytes = (unsigned)read_int();
+        size_t available = bytes < binary_writer::min_blob_size ? src_max - src : blob_size;
+        if (bytes % elem_size == 0 && bytes <= available) {
+          return bytes / elem_size;
+        }
+        log("error: bad dynarray size\n");
+        set_error(true);
       }
       return 0;
     }
 
     /// finish reading a dynarray
     void end_read_dynarray(void *ptr, unsigned bytes) {
-      read((uint8_t*)ptr, bytes);
+      read_bytes((uint8_t*)ptr, bytes);
     }
 
     /// called after visiting a new object
@@ -212,7 +311,7 @@ namespace octet { namespace resources {
     void visit_bin(void *value, size_t size, atom_t sid, atom_t type) {
       if (debug) log("%*svisit_bin %s %d\n", get_depth()*2, "", app_utils::get_atom_name(sid), size);
       if (!check_atom(type) && !check_atom(sid) && !check_size(size)) {
-        read((uint8_t*)value, size);
+        read_bytes((uint8_t*)value, size);
       }
     }
 
@@ -4,21 +4,60 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// visitor for writing xml files.
+// visitor for writing binary files.
 //
 
 namespace octet { namespace resources {
   /// The binary writer is a visitor that writes binary files.
   /// Use this to save game worlds or to do game saves.
+  ///
+  /// Layout:
+  ///
+  ///     magic "octet\r\n\x02", blob section size, stream size
+  ///     blob section: large arrays and GL buffers, each 16 byte aligned
+  ///     stream: atom names, then the visited objects
+  ///
+  /// Small values are stored inline in the stream. Anything of min_blob_size bytes
+  /// or more goes straight to the blob section and the stream holds its offset, so
+  /// the reader can load the stream in one go and read each blob straight into place.
+  ///
+  /// The stream is written and the header filled in when the writer is destroyed,
+  /// so the file must be seekable.
   class binary_writer : public visitor {
-    enum { debug = true };
+    enum { debug = false };
     hash_map<void *, int> refs;
     int next_id;
     FILE *file;
+    long header_pos;
+    dynarray<uint8_t> stream;
+    size_t blob_size;
+
+  public:
+    /// blobs at least this big are stored out of line.
+    enum { min_blob_size = 64 };
+
+    /// blobs start on this boundary, counting from the magic.
+    enum { blob_alignment = 16 };
+
+    /// magic and section sizes.
+    enum { header_size = 16 };
+
+  private:
+    // add space to the end of a buffer. resize() only grows by the amount asked for.
+    static uint8_t *append(dynarray<uint8_t> &buffer, size_t bytes) {
+      size_t size = buffer.size();
+      if (size + bytes > buffer.capacity()) {
+        size_t capacity = buffer.capacity() ? buffer.capacity() * 2 : 4096;
+        while (capacity < size + bytes) capacity *= 2;
+        buffer.reserve((unsigned)capacity);
+      }
+      buffer.resize((unsigned)(size + bytes));
+      return buffer.data() + size;
+    }
 
     void write(const uint8_t *src, size_t bytes) {
       //if (debug) log("%*swrite %08x bytes\n", get_depth()*2, "", bytes);
-      fwrite(src, 1, bytes, file);
+      if (bytes) memcpy(append(stream, bytes), src, bytes);
     }
 
     void write_int(int value) {
@@ -38,18 +77,59 @@ namespace octet { namespace resources {
       write((const uint8_t*)value, (int)strlen(value)+1);
     }
 
+    // write the contents of a visit_bin, inline or in the blob section.
+    void write_bytes(const uint8_t *src, size_t bytes) {
+      if (bytes < min_blob_size) {
+        write(src, bytes);
+      } else {
+        static const uint8_t zeros[blob_alignment] = { 0 };
+        size_t offset = (blob_size + blob_alignment - 1) & ~(size_t)(blob_alignment - 1);
+        if (debug) log("%*swrite blob %08x at %08x\n", get_depth()*2, "", bytes, offset);
+        fwrite(zeros, 1, offset - blob_size, file);
+        fwrite(src, 1, bytes, file);
+        blob_size = offset + bytes;
+        write_int((int)offset);
+      }
+    }
+
   public:
     /// Construct a binary writer from a file
     binary_writer(FILE *file) {
       if (debug) log("%*sbinary_writer\n", get_depth()*2, "");
       next_id = 1;
       this->file = file;
+      blob_size = 0;
+
+      // the sizes are filled in at the end.
+      header_pos = ftell(file);
+      fwrite("octet\r\n\x02\0\0\0\0\0\0\0\0", 1, header_size, file);
 
-      fwrite("octet\r\n\x1a", 1, 8, file);
+      // user atoms are numbered in the order they are made, so save their names for the reader.
+      dictionary<atom_t> *atoms = app_utils::get_atom_dict();
+      int num_user_atoms = 0;
+      for (unsigned i = 0; i != atoms->get_num_indices(); ++i) {
+        num_user_atoms += atoms->get_key(i) && !app_utils::predefined_atom(atoms->get_value(i));
+      }
+      write_int(num_user_atoms);
+      for (unsigned i = 0; i != atoms->get_num_indices(); ++i) {
+        if (atoms->get_key(i) && !app_utils::predefined_atom(atoms->get_value(i))) {
+          write_int(atoms->get_value(i));
+          write_string(atoms->get_key(i));
+        }
+      }
     }
 
-    /// Destroy the writer
+    /// Destroy the writer, writing the stream and the header.
     ~binary_writer() {
+      if (stream.size()) fwrite(stream.data(), 1, stream.size(), file);
+
+      uint8_t sizes[8];
+      for (unsigned i = 0; i != 8; ++i) {
+        sizes[i] = (uint8_t)((i < 4 ? blob_size : stream.size()) >> (i % 4 * 8));
+      }
+      fseek(file, header_pos + 8, SEEK_SET);
+      fwrite(sizes, 1, sizeof(sizes), file);
+      fseek(file, 0, SEEK_END);
     }
 
     /// Write a dictionary entry.
@@ -158,7 +238,7 @@ namespace octet { namespace resources {
       write_atom(type);
       write_atom(sid);
       write_int((int)size);
-      write((const uint8_t*)value, size);
+      write_bytes((const uint8_t*)value, size);
     }
 
     /// Write a string
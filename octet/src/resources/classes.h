@@ -36,4 +36,7 @@ OCTET_CLASS(scene, mesh_voxel_grid)
 #endif
 OCTET_CLASS(scene, mesh_points)
 OCTET_CLASS(scene, mesh_cylinder)
+OCTET_CLASS(resources, uniform_buffer)
+OCTET_CLASS(scene, transform_store)
+OCTET_CLASS(scene, occlusion_culler)
 //OCTET_CLASS(scene, value)
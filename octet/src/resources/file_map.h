@@ -5,76 +5,267 @@
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
 // map a file to memory
+//
+// A mapped file is read straight from the operating system's page cache,
+// with no copy and no buffer to allocate. Pages are read on first touch,
+// so the access hint tells the kernel whether to read ahead.
+//
+// A copy-on-write mapping can also be written to, for in-place parsers.
+// Only the pages that are written get private copies; the file is unchanged.
+//
 
-class file_map {
-  #ifdef WIN32
-    HANDLE file_handle;
-    HANDLE mapping_handle;
-  #else
-    int file_handle;
-  #endif
-  uint64_t size;
-  const uint8_t *data;
-  const char *error;
-public:
-  file_map(const char *file_name) {
-    error = 0;
-    data = 0;
-    size = 0;
-
-    if (file_name == NULL) {
-      error = "no file name";
-      return;
-    }
+namespace octet { namespace resources {
+  /// Read-only (or copy-on-write) memory map of a whole file.
+  class file_map {
+  public:
+    /// how the data will be read. Passed to madvise on POSIX systems.
+    enum access_hint {
+      access_normal,
+      access_sequential,    // one pass from start to end, eg. decoding an image
+      access_random,        // scattered reads, eg. a zip directory
+    };
 
+  private:
     #ifdef WIN32
-      mapping_handle = INVALID_HANDLE_VALUE;
+      HANDLE file_handle;
+      HANDLE mapping_handle;
+    #else
+      int file_handle;
+    #endif
+    std::atomic<int> ref_cnt;
+    uint64_t size;
+    const uint8_t *data;
+    const char *error;
+    bool copy_on_write;
+
+    // do not define these!
+    file_map(const file_map &rhs);
+    void operator=(const file_map &rhs);
+
+  public:
+    /// Map a file. With copy_on_write, access_data() gives pages that can be written privately.
+    file_map(const char *file_name, access_hint hint=access_sequential, bool copy_on_write=false) {
+      ref_cnt = 0;
+      error = 0;
+      data = 0;
+      size = 0;
+      this->copy_on_write = copy_on_write;
 
-      file_handle = CreateFileA(
-        file_name, GENERIC_READ, FILE_SHARE_READ, 0,
-        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
-      );
+      #ifdef WIN32
+        file_handle = INVALID_HANDLE_VALUE;
+        mapping_handle = NULL;
+      #else
+        file_handle = -1;
+      #endif
 
-      if (file_handle == INVALID_HANDLE_VALUE) {
-        error = "could not open file";
+      if (file_name == NULL) {
+        error = "no file name";
         return;
       }
 
-      DWORD sizehi = 0, sizelo = GetFileSize(file_handle, &sizehi);
-      size = ((uint64_t)sizehi << 32) | sizelo;
-      mapping_handle = CreateFileMappingA(file_handle, 0, PAGE_READONLY, 0, 0, 0);
+      #ifdef WIN32
+        file_handle = CreateFileA(
+          file_name, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+          hint == access_sequential ? FILE_FLAG_SEQUENTIAL_SCAN : hint == access_random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL,
+          0
+        );
+
+        if (file_handle == INVALID_HANDLE_VALUE) {
+          error = "could not open file";
+          return;
+        }
+
+        DWORD sizehi = 0, sizelo = GetFileSize(file_handle, &sizehi);
+        size = ((uint64_t)sizehi << 32) | sizelo;
+
+        // empty files can not be mapped
+        if (size == 0) return;
+
+        mapping_handle = CreateFileMappingA(file_handle, 0, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+
+        if (mapping_handle == NULL) {
+          error = "could not map file";
+          return;
+        }
+
+        data = (const uint8_t *)MapViewOfFile(mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+      #else
+        file_handle = open(file_name, O_RDONLY);
+        if (file_handle < 0) {
+          error = "could not open file";
+          return;
+        }
+
+        struct stat st;
+        if (fstat(file_handle, &st) != 0) {
+          error = "could not stat file";
+          return;
+        }
+        size = (uint64_t)st.st_size;
 
-      if (mapping_handle == INVALID_HANDLE_VALUE) {
+        // empty files can not be mapped
+        if (size == 0) return;
+
+        void *ptr = mmap(0, (size_t)size, copy_on_write ? PROT_READ|PROT_WRITE : PROT_READ, MAP_PRIVATE, file_handle, 0);
+        if (ptr == MAP_FAILED) {
+          error = "could not map file";
+          size = 0;
+          return;
+        }
+        data = (const uint8_t *)ptr;
+
+        if (hint != access_normal) {
+          madvise(ptr, (size_t)size, hint == access_sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+        }
+      #endif
+
+      if (!data) {
         error = "could not map file";
-        return;
+        size = 0;
       }
+    }
 
-      data = (const uint8_t *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
-    #else
-      //file_handle = open(file_name, O_RDONLY);
-      //mmap
-    #endif
-  }
+    ~file_map() {
+      #ifdef WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping_handle != NULL) CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+      #else
+        if (data) munmap((void*)data, (size_t)size);
+        if (file_handle >= 0) close(file_handle);
+      #endif
+    }
 
-  ~file_map() {
-    #ifdef WIN32
-      UnmapViewOfFile(data);
-      CloseHandle(file_handle);
-      CloseHandle(mapping_handle);
-    #else
-    #endif
-  }
+    /// ask the system to start reading part of the file before we touch it.
+    void prefetch(uint64_t offset, uint64_t bytes) const {
+      #ifndef WIN32
+        if (!data || offset >= size) return;
+        // madvise needs a page aligned address
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t start = offset & ~(page - 1);
+        uint64_t end = offset + bytes > size ? size : offset + bytes;
+        madvise((void*)(data + start), (size_t)(end - start), MADV_WILLNEED);
+      #endif
+    }
+
+    /// NULL if the file was mapped successfully, otherwise a message.
+    const char *get_error() const {
+      return error;
+    }
 
-  const char *get_error() const {
-    return error;
-  }
+    /// the contents of the file, or NULL if the file is empty or missing.
+    const uint8_t *get_data() const {
+      return data;
+    }
+
+    /// the contents of the file for writing, or NULL if the map is not copy-on-write.
+    uint8_t *access_data() const {
+      return copy_on_write ? (uint8_t *)data : NULL;
+    }
+
+    /// the size of the file in bytes
+    uint64_t get_size() const {
+      return size;
+    }
 
-  const uint8_t *get_data() const {
-    return data;
-  }
+    /// used by ref<file_map>
+    void add_ref() {
+      ref_cnt.fetch_add(1, std::memory_order_relaxed);
+    }
 
-  uint64_t get_size() const {
-    return size;
-  }
-};
+    /// used by ref<file_map>
+    void release() {
+      if (ref_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+      }
+    }
+  };
 
+  /// Read-only view of the contents of a URL.
+  ///
+  /// Plain files are memory mapped, so nothing is copied. Other sources,
+  /// such as compressed files in a zip, are decoded into a buffer owned by
+  /// the view. Either way, the bytes stay valid while the view lives.
+  ///
+  /// Note: unlike get_url, the data is not followed by a zero terminator.
+  ///
+  /// Example
+  ///
+  ///     url_view view;
+  ///     app_utils::get_url_view(view, "assets/big.jpg");
+  ///     decoder.get_image(..., view.data(), view.data() + view.size());
+  class url_view {
+    ref<file_map> map;
+    dynarray<uint8_t> buffer;
+    const uint8_t *data_;
+    uint8_t *writable_data_;
+    size_t size_;
+
+    // do not define these!
+    url_view(const url_view &rhs);
+    void operator=(const url_view &rhs);
+
+  public:
+    url_view() {
+      data_ = 0;
+      writable_data_ = 0;
+      size_ = 0;
+    }
+
+    /// look at a mapped file.
+    void set_map(file_map *new_map) {
+      buffer.reset();
+      map = new_map;
+      data_ = new_map->get_data();
+      writable_data_ = new_map->access_data();
+      size_ = (size_t)new_map->get_size();
+    }
+
+    /// look at part of a mapped file, eg. a stored file in a zip.
+    void set_map(file_map *new_map, const uint8_t *data, size_t size) {
+      buffer.reset();
+      map = new_map;
+      data_ = data;
+      writable_data_ = 0;
+      size_ = size;
+    }
+
+    /// get a buffer to decode into. Call update_buffer() when it is filled.
+    dynarray<uint8_t> &access_buffer() {
+      map = 0;
+      return buffer;
+    }
+
+    /// look at the contents of the buffer.
+    void update_buffer() {
+      data_ = buffer.data();
+      writable_data_ = buffer.data();
+      size_ = buffer.size();
+    }
+
+    /// true if the view is of a mapped file.
+    bool is_mapped() const {
+      return (const file_map*)map != 0;
+    }
+
+    /// first byte of the contents, or NULL if empty.
+    const uint8_t *data() const {
+      return data_;
+    }
+
+    /// the contents for writing, or NULL if they are in a read-only mapping.
+    uint8_t *access_data() const {
+      return writable_data_;
+    }
+
+    /// number of bytes
+    size_t size() const {
+      return size_;
+    }
+
+    /// byte access
+    uint8_t operator[](size_t i) const {
+      return data_[i];
+    }
+  };
+} }
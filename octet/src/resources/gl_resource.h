@@ -70,18 +70,45 @@ namespace octet { namespace resources {
     /// Make a new OpenGL Resource
     gl_resource(unsigned target=0, unsigned size=0) {
       buffer = 0;
+      #ifndef OCTET_GLES2
+        this->size = 0;
+      #endif
       this->target = target;
       if (size) {
         allocate(target, size);
       }
     }
 
-    /// serialize this object.
+    /// serialize this object, including the contents of the buffer.
+    /// When reading, the contents go straight into the new GL buffer.
     void visit(visitor &v) {
+      v.visit(target, atom_target);
       #ifdef OCTET_GLES2
         v.visit(bytes, atom_bytes);
+        // resources that were never allocated (such as the indices of unindexed meshes) have no target.
+        if (v.is_reader() && target) {
+          if (buffer == 0) glGenBuffers(1, &buffer);
+          glBindBuffer(target, buffer);
+          glBufferData(target, bytes.size(), bytes.data(), GL_STATIC_DRAW);
+          glBindBuffer(target, 0);
+        }
+      #else
+        uint32_t num_bytes = (uint32_t)size;
+        v.visit(num_bytes, atom_size);
+        if (v.is_reader()) {
+          // resources that were never allocated (such as the indices of unindexed meshes) have no target.
+          if (target) allocate(target, num_bytes);
+          if (target && num_bytes) {
+            void *ptr = lock_write_only();
+            v.visit_bin(ptr, num_bytes, atom_bytes, atom_uint8);
+            unlock_write_only();
+          }
+        } else if (num_bytes) {
+          const void *ptr = lock_read_only();
+          v.visit_bin((void*)ptr, num_bytes, atom_bytes, atom_uint8);
+          unlock_read_only();
+        }
       #endif
-      v.visit(target, atom_target);
     }
 
     /// Allocate a new OpenGL object.
@@ -8,9 +8,20 @@
 // This visitor writes the JSON format required by jquery.jstree.js
 
 namespace octet { namespace resources {
+  // allocation profiler tag for building web responses
+  OCTET_ALLOC_TAG(http_response)
+
   /// Visitor to serialize game data to JSON format for use by web browsers.
   class http_writer : public visitor {
-    hash_map<void *, int> refs;
+  public:
+    /// the writer only lives while one request is answered, so it uses frame memory.
+    typedef tagged_allocator<http_response, frame_allocator> allocator_t;
+
+    /// lines of the response
+    typedef dynarray<string, allocator_t> response_t;
+
+  private:
+    hash_map<void *, int, hash_map_cmp, allocator_t> refs;
     int next_id;
 
     char hex_digit(unsigned i) {
@@ -28,7 +39,7 @@ namespace octet { namespace resources {
       return tmp;
     }
 
-    dynarray<string> &response;
+    response_t &response;
     int depth;
     int max_depth;
 
@@ -38,7 +49,7 @@ namespace octet { namespace resources {
     }
   public:
     /// Use as a visitor to generate response text for game data
-    http_writer(int depth_, int max_depth_, dynarray<string> &response_) : response(response_) {
+    http_writer(int depth_, int max_depth_, response_t &response_) : response(response_) {
       depth = depth_;
       max_depth = max_depth_;
       response.resize(0);
@@ -17,15 +17,75 @@
 
 namespace octet { namespace resources {
   /// Base class for resources; provides aligned allocation and reference counting.
+  ///
+  /// Reference counts are plain integers unless the resource is shared between threads.
+  /// Call set_shared() before handing a resource to another thread; see OCTET_ATOMIC_REFCOUNT.
+  ///
+  /// Resources that die on a thread other than the render thread are deleted
+  /// by flush_deferred_releases(), as their destructors may free OpenGL objects.
   class resource {
     // how many lives do we have?
-    int ref_count;
+    #if OCTET_ATOMIC_REFCOUNT
+      std::atomic<int> ref_count;
+    #else
+      int ref_count;
+    #endif
+
+    #if OCTET_ATOMIC_REFCOUNT == 1
+      // true if ref_count is changed by more than one thread.
+      bool shared;
+    #endif
+
+    // resources that died on other threads, waiting for the render thread.
+    // render_thread is written once, by set_render_thread() or the first flush.
+    struct deferred_t {
+      std::mutex mutex;
+      dynarray<resource*> resources;
+      std::atomic<std::thread::id> render_thread;
+
+      deferred_t() : render_thread(std::thread::id()) {
+      }
+    };
+
+    static deferred_t &deferred() {
+      static deferred_t instance;
+      return instance;
+    }
+
+    // the last life of a shared resource has gone.
+    void destroy() {
+      deferred_t &d = deferred();
+      // before set_render_thread() there is no GL context to protect.
+      std::thread::id render_thread = d.render_thread.load(std::memory_order_acquire);
+      if (render_thread != std::thread::id() && std::this_thread::get_id() != render_thread) {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.resources.push_back(this);
+      } else {
+        delete this;
+      }
+    }
 
   public:
     /// Make a new resource with no lives.
     /// Adding it to a ref<> will give it a life.
     resource() {
       ref_count = 0;
+      #if OCTET_ATOMIC_REFCOUNT == 1
+        shared = false;
+      #endif
+    }
+
+    /// Copies of a resource start with no lives of their own.
+    resource(const resource &rhs) {
+      ref_count = 0;
+      #if OCTET_ATOMIC_REFCOUNT == 1
+        shared = false;
+      #endif
+    }
+
+    /// Assigning a resource copies nothing of the base class: the lives stay with the object.
+    resource &operator=(const resource &rhs) {
+      return *this;
     }
 
     /// factory for making new resources of various kinds
@@ -53,15 +113,78 @@ namespace octet { namespace resources {
     virtual ~resource() {
     }
 
+    /// Mark a resource as used by more than one thread.
+    /// Call this while only one thread can see the resource, for example just after loading it.
+    void set_shared(bool value=true) {
+      #if OCTET_ATOMIC_REFCOUNT == 1
+        shared = value;
+      #endif
+    }
+
+    /// True if the reference count is thread safe.
+    bool is_shared() const {
+      #if OCTET_ATOMIC_REFCOUNT == 1
+        return shared;
+      #else
+        return OCTET_ATOMIC_REFCOUNT == 2;
+      #endif
+    }
+
     /// Give this resource an extra life; see the %ref class.
     void add_ref() {
-      ref_count++;
+      #if OCTET_ATOMIC_REFCOUNT
+        if (is_shared()) {
+          ref_count.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          // unshared: a plain increment, not a locked instruction.
+          ref_count.store(ref_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+      #else
+        ref_count++;
+      #endif
     }
 
     /// Remove a life from this resource and delete it if it is dead; see the %ref class.
     void release() {
-      if (--ref_count == 0) {
-        delete this;
+      #if OCTET_ATOMIC_REFCOUNT
+        if (is_shared()) {
+          if (ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy();
+          }
+        } else {
+          int count = ref_count.load(std::memory_order_relaxed) - 1;
+          ref_count.store(count, std::memory_order_relaxed);
+          if (count == 0) {
+            delete this;
+          }
+        }
+      #else
+        if (--ref_count == 0) {
+          delete this;
+        }
+      #endif
+    }
+
+    /// Make the calling thread the render thread. The app calls this once from init(),
+    /// before any worker can release a resource. Later calls from other threads are ignored.
+    static void set_render_thread() {
+      std::thread::id none;
+      deferred().render_thread.compare_exchange_strong(none, std::this_thread::get_id(), std::memory_order_acq_rel);
+    }
+
+    /// Delete shared resources that died on other threads. The frame loop calls this on the render thread.
+    static void flush_deferred_releases() {
+      set_render_thread();
+      deferred_t &d = deferred();
+      assert(d.render_thread.load(std::memory_order_relaxed) == std::this_thread::get_id());
+      dynarray<resource*> dead;
+      {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (d.resources.empty()) return;
+        dead = std::move(d.resources);
+      }
+      for (unsigned i = 0; i != dead.size(); ++i) {
+        delete dead[i];
       }
     }
 
@@ -8,12 +8,15 @@
 //
 
 namespace octet { namespace resources {
+  // allocation profiler tag for the named resources
+  OCTET_ALLOC_TAG(resource_dict_entries)
+
   /// Resource dictionary / game world class.
   ///
   /// Used to hold resources in a game and access them by name.
   ///
   class resource_dict : public resource {
-    dictionary<ref<resource> > dict;
+    dictionary<ref<resource>, tagged_allocator<resource_dict_entries> > dict;
     ref<scene::visual_scene> active_scene;
 
     #ifdef WIN32
@@ -92,11 +95,13 @@ namespace octet { namespace resources {
       }
       if (name[0] == '#') name++;
 
-      if (!dict.contains(name)) {
-        return NULL;
-      } else {
-        return dict[name];
-      }
+      return get_resource(string_key(name));
+    }
+
+    /// Get a generic resource by a pre-hashed name (without the '#').
+    resource *get_resource(const string_key &key) {
+      int index = dict.get_index(key);
+      return index == -1 ? NULL : (resource*)dict.get_value(index);
     }
 
     /// As this dict represents a game world, what is the active scene?
@@ -115,6 +120,16 @@ namespace octet { namespace resources {
       }
     }
 
+    /// Add all the resources of another dictionary, replacing any with the same name.
+    void add_resources(resource_dict &rhs) {
+      for (unsigned i = 0; i != rhs.dict.get_num_indices(); ++i) {
+        const char *key = rhs.dict.get_key(i);
+        if (key) {
+          dict[key] = rhs.dict.get_value(i);
+        }
+      }
+    }
+
     /// factory for textures: Deprecated will use Image object in future
     static GLuint get_texture_handle(unsigned gl_kind, const char *name) {
       GLuint &result = textures()[name];
@@ -124,6 +139,20 @@ namespace octet { namespace resources {
       return result;
     }
 
+    /// factory for textures that returns at once. The texture is grey until the file
+    /// has been loaded in the background, see texture_loader.
+    static GLuint get_texture_handle_async(unsigned gl_kind, const char *name) {
+      if (name[0] == '!' || name[0] == '#') {
+        // stock and solid textures are quick to make.
+        return get_texture_handle(gl_kind, name);
+      }
+      GLuint &result = textures()[name];
+      if (result == 0) {
+        result = texture_loader::get().load(gl_kind, name);
+      }
+      return result;
+    }
+
     /// factory for sounds: Deprecated will use Sound object in future
     static int get_sound_handle(unsigned al_kind, const char *name) {
       int &result = sounds()[name];
@@ -20,6 +20,7 @@
   #include "../resources/file_map.h"
   #include "../resources/zip_file.h"
   #include "../resources/app_utils.h"
+  #include "../resources/texture_loader.h"
   #include "../resources/visitor.h"
   #include "../resources/binary_writer.h"
   #include "../resources/binary_reader.h"
@@ -28,6 +29,7 @@
   #include "../resources/resource.h"
   #include "../resources/resource_dict.h"
   #include "../resources/gl_resource.h"
+  #include "../resources/uniform_buffer.h"
   #include "../resources/bitmap_font.h"
   #include "../resources/mesh_builder.h"
 
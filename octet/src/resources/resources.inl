@@ -14,32 +14,15 @@ GLuint octet::resources::resource_dict::get_texture_handle_internal(unsigned gl_
   } else if (url[0] == '#') {
     return app_utils::get_solid_texture(gl_kind, url+1);
   } else {
-    dynarray<uint8_t> buffer;
+    url_view buffer;
     dynarray<uint8_t> image;
-    app_utils::get_url(buffer, url);
+    app_utils::get_url_view(buffer, url);
     uint16_t format = 0;
     uint16_t width = 0;
     uint16_t height = 0;
-    const unsigned char *src = &buffer[0];
-    const unsigned char *src_max = src + buffer.size();
-    if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
-      gif_decoder dec;
-      dec.get_image(image, format, width, height, src, src_max);
-    } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
-      jpeg_decoder dec;
-      dec.get_image(image, format, width, height, src, src_max);
-    } else if (buffer.size() >= 6 && buffer[0] == 0 && buffer[1] == 0 && buffer[2] == 2) {
-      tga_decoder dec;
-      dec.get_image(image, format, width, height, src, src_max);
-    } else {
-      printf("warning: unknown texture format\n");
-      return 0;
-    }
-
-    if (width > 0 && height > 0 && format) {
+    if (texture_loader::decode_image(image, format, width, height, buffer.data(), buffer.data() + buffer.size())) {
       return app_utils::make_texture(format, &image[0], image.size(), format, width, height);
-    } else
-    {
+    } else {
       return 0;
     }
   }
@@ -55,3 +38,21 @@ inline octet::resources::resource *octet::resources::resource::new_type(atom_t t
   return NULL;
 }
 
+// resources that die on other threads wait for this thread to delete them
+inline void octet::app_common::init_render_thread() {
+  resources::resource::set_render_thread();
+}
+
+// end of frame housekeeping for all platforms
+inline void octet::app_common::inc_frame_number() {
+  frame_number++;
+  // per-frame temporaries are finished with.
+  frame_allocator::reset_all();
+  alloc_profiler::end_frame();
+
+  // delete resources whose last ref<> went away on another thread.
+  resources::resource::flush_deferred_releases();
+
+  // send textures that finished loading to OpenGL.
+  resources::texture_loader::end_frame();
+}
@@ -0,0 +1,259 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Background texture loading
+//
+// load() returns a texture handle straight away. Until the file arrives,
+// the texture is a single grey pixel. Files are read and decoded on the
+// loader's own threads, and the pixels are sent to OpenGL at the end of each
+// frame, a few megabytes at a time. A level full of textures no longer
+// stops the render loop.
+//
+// With pixel buffer objects (OCTET_PIXEL_BUFFERS), the pixels are copied to
+// a buffer and glTexImage2D reads from there. The driver can then make the
+// transfer without stalling the render thread.
+//
+
+namespace octet { namespace resources {
+  /// Loads textures on background threads and uploads them at the end of each frame.
+  ///
+  /// Example
+  ///
+  ///     GLuint texture = texture_loader::get().load(GL_RGBA, "assets/big.jpg");
+  ///     // draw with texture: it is grey until the image has been uploaded.
+  class texture_loader {
+    struct job {
+      GLuint handle;
+      unsigned gl_kind;
+      string url;
+      dynarray<uint8_t> image;
+      uint16_t format;
+      uint16_t width;
+      uint16_t height;
+    };
+
+    std::thread *threads;
+    unsigned num_threads;
+
+    // shared with the loader threads
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::deque<job*> to_decode;
+    std::deque<job*> to_upload;
+    unsigned num_decoding;
+    bool quit;
+
+    // render thread only
+    size_t upload_budget;
+    GLuint pixel_buffer;
+
+    // set when the loader is first used, so end_frame costs nothing until then.
+    static texture_loader *&current() {
+      static texture_loader *ptr = NULL;
+      return ptr;
+    }
+
+    // decode images until the loader quits.
+    void decode_jobs() {
+      // each image is decoded on this thread, the shared worker_pool belongs to the render loop.
+      worker_pool serial(0);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        while (!quit && to_decode.empty()) {
+          work_ready.wait(lock);
+        }
+        if (quit) return;
+
+        job *j = to_decode.front();
+        to_decode.pop_front();
+        num_decoding++;
+        lock.unlock();
+
+        url_view view;
+        j->format = j->width = j->height = 0;
+        if (app_utils::get_url_view(view, j->url.c_str())) {
+          decode_image(j->image, j->format, j->width, j->height, view.data(), view.data() + view.size(), serial);
+        }
+
+        lock.lock();
+        num_decoding--;
+        to_upload.push_back(j);
+      }
+    }
+
+    void thread_main() {
+      decode_jobs();
+
+      // blocks cached by this thread would be lost when it exits.
+      containers::frame_allocator::release_thread_arena();
+      containers::allocator::release_thread_cache();
+    }
+
+    // send one decoded image to OpenGL. Called on the render thread.
+    void upload_image(job *j) {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, j->handle);
+      const uint8_t *pixels = j->image.data();
+      size_t size = j->image.size();
+
+      #if OCTET_PIXEL_BUFFERS
+        if (pixel_buffer == 0) {
+          glGenBuffers(1, &pixel_buffer);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+        // orphan the last image, so we do not wait for the GPU to finish with it.
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        void *dest = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dest) {
+          memcpy(dest, pixels, size);
+          glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+          // with a buffer bound, the pointer is an offset into the buffer.
+          pixels = NULL;
+        } else {
+          glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+      #endif
+
+      glTexImage2D(GL_TEXTURE_2D, 0, j->gl_kind, j->width, j->height, 0, j->format, GL_UNSIGNED_BYTE, (void*)pixels);
+
+      #if OCTET_PIXEL_BUFFERS
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+      #endif
+
+      glGenerateMipmap(GL_TEXTURE_2D);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // do not define these!
+    texture_loader(const texture_loader &rhs);
+    void operator=(const texture_loader &rhs);
+
+  public:
+    /// Start the loader threads. Decoding is mostly waiting for the disk, so a couple is enough.
+    texture_loader(unsigned threads_to_use = 2) {
+      num_decoding = 0;
+      quit = false;
+      upload_budget = 4 * 1024 * 1024;
+      pixel_buffer = 0;
+
+      num_threads = threads_to_use ? threads_to_use : 1;
+      threads = new std::thread[num_threads];
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i] = std::thread(&texture_loader::thread_main, this);
+      }
+    }
+
+    /// Stop and join the threads. Images that have not been uploaded are dropped.
+    /// The pixel buffer is left for the GL context to clean up, as it may already be gone.
+    ~texture_loader() {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        quit = true;
+        work_ready.notify_all();
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+      delete [] threads;
+
+      for (size_t i = 0; i != to_decode.size(); ++i) delete to_decode[i];
+      for (size_t i = 0; i != to_upload.size(); ++i) delete to_upload[i];
+      if (current() == this) current() = NULL;
+    }
+
+    /// The shared loader. Call from the render thread.
+    static texture_loader &get() {
+      static texture_loader instance;
+      current() = &instance;
+      return instance;
+    }
+
+    /// Upload textures decoded since the last frame. Called by app_common::inc_frame_number().
+    static void end_frame() {
+      if (current()) current()->upload();
+    }
+
+    /// Decode a GIF, JPEG or TGA file in memory. Returns false if the format is unknown.
+    static bool decode_image(dynarray<uint8_t> &image, uint16_t &format, uint16_t &width, uint16_t &height, const uint8_t *src, const uint8_t *src_max, worker_pool &pool=worker_pool::get()) {
+      size_t size = src_max - src;
+      if (size >= 6 && !memcmp(src, "GIF89a", 6)) {
+        gif_decoder dec;
+        dec.get_image(image, format, width, height, src, src_max);
+      } else if (size >= 6 && src[0] == 0xff && src[1] == 0xd8) {
+        jpeg_decoder dec;
+        dec.get_image(image, format, width, height, src, src_max, pool);
+      } else if (size >= 6 && src[0] == 0 && src[1] == 0 && src[2] == 2) {
+        tga_decoder dec;
+        dec.get_image(image, format, width, height, src, src_max);
+      } else {
+        printf("warning: unknown texture format\n");
+        return false;
+      }
+      return width > 0 && height > 0 && format != 0;
+    }
+
+    /// Make a texture handle and start loading "url" into it. Call from the render thread.
+    GLuint load(unsigned gl_kind, const char *url) {
+      static const uint8_t grey[] = { 0x80, 0x80, 0x80, 0xff };
+      GLuint handle = 0;
+      glGenTextures(1, &handle);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, handle);
+      glTexImage2D(GL_TEXTURE_2D, 0, gl_kind, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)grey);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+      job *j = new job();
+      j->handle = handle;
+      j->gl_kind = gl_kind;
+      j->url = url;
+      j->format = j->width = j->height = 0;
+
+      std::unique_lock<std::mutex> lock(mutex);
+      to_decode.push_back(j);
+      work_ready.notify_one();
+      return handle;
+    }
+
+    /// Upload decoded images to OpenGL, up to the budget. Call once a frame on the render thread.
+    /// At least one image is uploaded each frame, however big.
+    void upload() {
+      size_t bytes_sent = 0;
+      for (;;) {
+        job *j = NULL;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if (to_upload.empty()) break;
+          size_t bytes = to_upload.front()->image.size();
+          if (bytes_sent != 0 && bytes_sent + bytes > upload_budget) break;
+          j = to_upload.front();
+          to_upload.pop_front();
+        }
+
+        if (j->width && j->height && j->format) {
+          upload_image(j);
+          bytes_sent += j->image.size();
+        } else {
+          printf("warning: could not load texture %s\n", j->url.c_str());
+        }
+        delete j;
+      }
+    }
+
+    /// Set the number of bytes of pixels to send to OpenGL each frame.
+    void set_upload_budget(size_t bytes) {
+      upload_budget = bytes;
+    }
+
+    /// Number of textures still being read, decoded or uploaded. Zero when everything has arrived.
+    unsigned get_num_pending() {
+      std::unique_lock<std::mutex> lock(mutex);
+      return (unsigned)(to_decode.size() + to_upload.size()) + num_decoding;
+    }
+  };
+} }
@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// std140 uniform buffer object
+//
+// A copy of the block is kept in CPU memory and only sent to OpenGL when
+// a value actually changes. This replaces many glUniform* calls with one
+// glBindBufferBase per block.
+//
+
+namespace octet { namespace resources {
+  /// Uniform buffer object with a CPU-side shadow copy.
+  ///
+  /// Example
+  ///
+  ///     ref<uniform_buffer> ubo = new uniform_buffer(256);
+  ///     ubo->set_value(0, &worldToCamera, sizeof(worldToCamera));
+  ///     ubo->bind(uniform_buffer::frame_binding);
+  class uniform_buffer : public resource {
+    // std140 image of the block
+    dynarray<uint8_t> bytes;
+
+    // OpenGL buffer object, created on first upload
+    GLuint buffer;
+
+    // true if bytes differs from the GPU copy
+    bool dirty;
+
+  public:
+    RESOURCE_META(uniform_buffer)
+
+    /// fixed binding points shared by all shaders.
+    enum {
+      frame_binding = 0,      // "octet_frame": camera and lights, set once per frame by visual_scene or by a material drawn alone
+      material_binding = 1,   // "octet_material": colours and scalars of one material
+    };
+
+    /// make a new uniform buffer of "size" bytes.
+    uniform_buffer(unsigned size=0) {
+      buffer = 0;
+      dirty = true;
+      allocate(size);
+    }
+
+    ~uniform_buffer() {
+      reset();
+    }
+
+    /// resize the CPU copy, clearing it to zero.
+    void allocate(unsigned size) {
+      reset();
+      // std140 blocks are sized in multiples of vec4
+      bytes.resize((size + 15) & ~15);
+      if (bytes.size()) memset(bytes.data(), 0, bytes.size());
+      dirty = true;
+    }
+
+    /// free the OpenGL buffer.
+    void reset() {
+      #if OCTET_UNIFORM_BUFFERS
+        if (buffer != 0) {
+          glDeleteBuffers(1, &buffer);
+        }
+      #endif
+      buffer = 0;
+      dirty = true;
+    }
+
+    /// get the size of the block in bytes
+    unsigned get_size() const {
+      return bytes.size();
+    }
+
+    /// read the CPU copy of the block
+    const uint8_t *get_data() const {
+      return bytes.data();
+    }
+
+    /// copy a value into the block. The buffer only becomes dirty if the bytes changed.
+    void set_value(unsigned offset, const void *value, unsigned size) {
+      assert(offset + size <= bytes.size());
+      uint8_t *dest = bytes.data() + offset;
+      if (memcmp(dest, value, size)) {
+        memcpy(dest, value, size);
+        dirty = true;
+      }
+    }
+
+    /// true if set_value has changed the block since the last upload.
+    bool is_dirty() const {
+      return dirty;
+    }
+
+    /// send the block to OpenGL if it has changed.
+    void upload() {
+      #if OCTET_UNIFORM_BUFFERS
+        if (!dirty || bytes.size() == 0) return;
+        if (buffer == 0) {
+          glGenBuffers(1, &buffer);
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+          glBufferData(GL_UNIFORM_BUFFER, bytes.size(), bytes.data(), GL_DYNAMIC_DRAW);
+        } else {
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+          glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes.size(), bytes.data());
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        dirty = false;
+      #endif
+    }
+
+    /// upload if needed and attach the buffer to one of the binding points.
+    void bind(unsigned binding) {
+      #if OCTET_UNIFORM_BUFFERS
+        upload();
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+      #endif
+    }
+
+    /// get the GL buffer object we are wrapping.
+    GLuint get_buffer() const {
+      return buffer;
+    }
+  };
+} }
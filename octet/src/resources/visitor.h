@@ -20,7 +20,7 @@ namespace octet { namespace resources {
   /// A visitor pattern can be used to solve a number of problems and provides
   /// "Metadata" for the classes.
   class visitor {
-    enum { debug = true };
+    enum { debug = false };
     unsigned depth;
     bool error;
 
@@ -105,6 +105,9 @@ namespace octet { namespace resources {
     /// readers use this to add a new reference
     virtual void add_new_ref(void *ref) {}
 
+    /// Readers map atoms from the file to atoms in this run. User atoms are numbered as they are made.
+    virtual atom_t translate_atom(atom_t value) { return value; }
+
     /// begin an aggregate
     virtual bool begin_agg(void *ref, atom_t sid, atom_t type) { return true; }
 
@@ -164,6 +167,17 @@ namespace octet { namespace resources {
     /// Call this in your "visit" method
     void visit(atom_t &value, atom_t sid) {
       visit_bin(&value, sizeof(value), sid, atom_atom);
+      if (is_reader()) value = translate_atom(value);
+    }
+
+    /// Call this in your "visit" method for arrays of atoms
+    void visit(dynarray<atom_t> &value, atom_t sid) {
+      visit<atom_t>(value, sid);
+      if (is_reader()) {
+        for (unsigned i = 0; i != value.size(); ++i) {
+          value[i] = translate_atom(value[i]);
+        }
+      }
     }
 
     /// Call this in your "visit" method
@@ -218,7 +232,7 @@ namespace octet { namespace resources {
     }
 
     /// Call this in your "visit" method for dynarrays of references
-    template <class type> void visit(dynarray<ref<type> > &value, atom_t sid) {
+    template <class type, class allocator_t> void visit(dynarray<ref<type>, allocator_t> &value, atom_t sid) {
       if (error) return;
       int size = value.size();
       if (begin_refs(sid, size, false)) {
@@ -264,7 +278,7 @@ namespace octet { namespace resources {
     }
 
     /// Call this in your "visit" method for dictionaries
-    template <class type> void visit(dictionary<ref<type> > &value, atom_t sid) {
+    template <class type, class allocator_t> void visit(dictionary<ref<type>, allocator_t> &value, atom_t sid) {
       if (error) return;
       int size = value.get_size();
       if (begin_refs(sid, size, true)) {
@@ -316,12 +330,12 @@ namespace octet { namespace resources {
     }
 
     /// Call this in your "visit" method for dynarrays of POD types (except references)
-    template <class type> void visit(dynarray<type> &value, atom_t sid) {
+    template <class type, class allocator_t> void visit(dynarray<type, allocator_t> &value, atom_t sid) {
       if (error) return;
       if (is_reader()) {
         unsigned size = begin_read_dynarray(sizeof(value[0]), sid);
         value.resize(size);
-        end_read_dynarray((void*)&value[0], sizeof(type) * value.size());
+        end_read_dynarray((void*)value.data(), sizeof(type) * value.size());
       } else {
         if (value.size()) {
           visit_bin((void*)&value[0], sizeof(type) * value.size(), sid, atom_dynarray);
@@ -4,17 +4,22 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
+// The archive is memory mapped, so files are inflated straight from the
+// mapping into their destination and stored files can be viewed in place.
+// Nothing is shared between calls except read-only data, so any number of
+// threads can get files at the same time.
+//
 
 namespace octet { namespace resources {
   /// Zip file reader, uses zip_decoder to inflate compressed files.
   /// Zip files are smaller and faster than regular files.
   /// They make updates easier and work will over the internet.
   class zip_file {
-    int ref_cnt;
-    FILE *the_file;
+    std::atomic<int> ref_cnt;
+    ref<file_map> map;
 
     struct dir_entry {
-      uint32_t offset;
+      uint32_t offset;      // start of the file data in the archive
       uint32_t csize;
       uint32_t usize;
       uint32_t compression;
@@ -22,8 +27,6 @@ namespace octet { namespace resources {
 
     dictionary<dir_entry> directory;
 
-    zip_decoder decoder;
-
     // read little endian bytes on any machine
     static unsigned u4(const uint8_t *src) {
       return src[0] + src[1] * 256 + src[2] * 65536 + src[3] * 0x1000000;
@@ -41,102 +44,185 @@ namespace octet { namespace resources {
       return (int16_t)(src[0] + src[1] * 256);
     }
 
+    // read the central directory at the end of the archive.
+    void read_directory() {
+      const uint8_t *data = map->get_data();
+      size_t size = (size_t)map->get_size();
+      if (size < 22) return;
+
+      // the end record is 22 bytes plus a comment of up to 64k.
+      size_t search_min = size > 22 + 0xffff ? size - 22 - 0xffff : 0;
+      const uint8_t *end_record = 0;
+      for (size_t i = size - 22 + 1; i-- > search_min; ) {
+        if (u4(data + i) == 0x06054b50) {
+          end_record = data + i;
+          break;
+        }
+      }
+      if (!end_record) return;
+
+      size_t dir_size = u4(end_record + 12);
+      size_t dir_offset = u4(end_record + 16);
+      if (dir_offset > size || dir_size > size - dir_offset) return;
+
+      const uint8_t *p = data + dir_offset;
+      const uint8_t *dir_end = p + dir_size;
+      while (p + 46 <= dir_end && u4(p) == 0x02014b50) {
+        dir_entry d;
+        d.compression = u2(p + 10);
+        d.csize = u4(p + 20);
+        d.usize = u4(p + 24);
+        unsigned file_name_len = u2(p + 28);
+        unsigned extra_len = u2(p + 30);
+        unsigned comment_len = u2(p + 32);
+        size_t header = u4(p + 42);
+        if (p + 46 + file_name_len > dir_end) break;
+
+        string file;
+        file.set((const char*)(p + 46), file_name_len);
+        for (unsigned i = 0; file[i]; ++i) {
+          if (file[i] == '\\') file[i] = '/';
+        }
+        p += 46 + file_name_len + extra_len + comment_len;
+
+        /*local file header signature     4 bytes  (0x04034b50) 0
+        version needed to extract       2 bytes 4
+        general purpose bit flag        2 bytes 6
+        compression method              2 bytes 8
+        last mod file time              2 bytes 10
+        last mod file date              2 bytes 12
+        crc-32                          4 bytes 14
+        compressed size                 4 bytes 18
+        uncompressed size               4 bytes 22
+        file name length                2 bytes 26
+        extra field length              2 bytes 28 / 30*/
+        if (header + 30 > size || u4(data + header) != 0x04034b50) continue;
+        size_t offset = header + 30 + u2(data + header + 26) + u2(data + header + 28);
+        if (offset > size || d.csize > size - offset) continue;
+        d.offset = (uint32_t)offset;
+
+        //printf("%s\n", file.c_str());
+        directory[file] = d;
+      }
+    }
+
+    // inflate or copy one file into a buffer. Safe to call from many threads at once.
+    bool extract(const dir_entry &d, dynarray<uint8_t> &buffer, zip_decoder &decoder) const {
+      const uint8_t *src = map->get_data() + d.offset;
+      if (d.compression == 0) {
+        buffer.resize(d.csize);
+        if (d.csize) memcpy(buffer.data(), src, d.csize);
+        return true;
+      } else if (d.compression == 8) {
+        buffer.resize(d.usize);
+        return decoder.decode(buffer.data(), buffer.data() + d.usize, src, src + d.csize);
+      }
+      return false;
+    }
+
   public:
     /// Open a zip file for reading
     zip_file(const char *filename) {
       ref_cnt = 0;
-      the_file = fopen(filename, "rb");
-      if (!the_file) {
+      map = new file_map(filename, file_map::access_random);
+      if (map->get_error()) {
         printf("file %s not found\n", filename);
       } else {
-        uint8_t tmp[256];
-        unsigned tmp_size = (unsigned)sizeof(tmp);
-        fseek(the_file, 0, SEEK_END);
-        long file_size = ftell(the_file);
-        long search_offset = file_size - (long)tmp_size;
-        search_offset = search_offset < 0 ? 0 : search_offset;
-        fseek(the_file, search_offset, SEEK_SET);
-        fread(&tmp, 1, tmp_size, the_file);
-        for( unsigned i = 0; i != tmp_size; ++i) {
-          if (u4(tmp + i) == 0x06054b50) {
-            dynarray<uint8_t> dir;
-            dir.resize(u4(tmp + i + 12));
-            fseek(the_file, (long)u4(tmp + i + 16), SEEK_SET);
-            fread(&dir[0], 1, dir.size(), the_file);
-            for (unsigned i = 0; i + 4 < dir.size();) {
-              uint8_t *p = &dir[i];
-              if (u4(p) != 0x02014b50) break;
-              struct dir_entry d;
-              d.compression = u2(p + 10);
-              d.csize = u4(p + 20);
-              d.usize = u4(p + 24);
-              unsigned file_name_len = u2(p + 28);
-              unsigned extra_len = u2(p + 30);
-              string file;
-              file.set((const char*)(p + 46), file_name_len);
-              i += 46 + file_name_len + extra_len;
-              d.offset = u4(p + 42);// + (46 + file_name_len + extra_len);
-              for (unsigned i = 0; file[i]; ++i) {
-                if (file[i] == '\\') file[i] = '/';
-              }
-              //printf("%s\n", file.c_str());
-              directory[file] = d;
-            }
-            break;
-          }
-        }
+        read_directory();
       }
     }
 
-    /// close the zip file
-    ~zip_file() {
-      if (the_file) fclose(the_file);
-    }
-
     /// allow ref<zip_file>
     void add_ref() {
-      ref_cnt++;
+      ref_cnt.fetch_add(1, std::memory_order_relaxed);
     }
 
     /// allow ref<zip_file>
     void release() {
-      if (--ref_cnt) {
+      if (ref_cnt.fetch_sub(1, std::memory_order_acq_rel) == 1) {
         delete this;
       }
     }
 
+    /// true if the archive has this file
+    bool has_file(const char *file) {
+      return directory.get_index(file) >= 0;
+    }
+
     /// get a file from a zip file, this is called from get_url with a zip:// prefix.
-    void get_file(dynarray<uint8_t> &buffer, const char *file) {
+    /// Any number of threads can call this at once.
+    bool get_file(dynarray<uint8_t> &buffer, const char *file) {
+      int index = directory.get_index(file);
+      if (index < 0) return false;
+      zip_decoder decoder;
+      if (!extract(directory.get_value(index), buffer, decoder)) {
+        printf("zip_file: bad compressed data in %s\n", file);
+        return false;
+      }
+      return true;
+    }
+
+    /// get a read-only view of a file. Stored files are viewed in the mapping without a copy.
+    bool get_file_view(url_view &view, const char *file) {
       int index = directory.get_index(file);
-      if (index < 0) return;
-      if (!the_file) return;
+      if (index < 0) return false;
       const dir_entry &d = directory.get_value(index);
-      buffer.resize(d.usize);
-      fseek(the_file, d.offset, SEEK_SET);
-      /*local file header signature     4 bytes  (0x04034b50) 0
-      version needed to extract       2 bytes 4
-      general purpose bit flag        2 bytes 6
-      compression method              2 bytes 8
-      last mod file time              2 bytes 10
-      last mod file date              2 bytes 12
-      crc-32                          4 bytes 14
-      compressed size                 4 bytes 18
-      uncompressed size               4 bytes 22
-      file name length                2 bytes 26
-      extra field length              2 bytes 28 / 30*/
-
-      uint8_t tmp[30];
-      fread(tmp, 1, sizeof(tmp), the_file);
-      if (u4(tmp) != 0x04034b50) return;
-      unsigned extra = u2(tmp + 26) + u2(tmp + 28);
-      fseek(the_file, d.offset + 30 + extra, SEEK_SET);
       if (d.compression == 0) {
-        fread(buffer.data(), 1, d.usize, the_file);
-      } else if (d.compression == 8) {
-        dynarray<uint8_t> uncomp(d.csize + 4); // note: + 4 bytes prevents decode() overflowing
-        fread(uncomp.data(), 1, d.csize, the_file);
-        decoder.decode(buffer.data(), buffer.data() + d.usize, uncomp.data(), uncomp.data() + d.csize);
+        view.set_map(map, map->get_data() + d.offset, d.csize);
+        return true;
+      }
+      bool ok = get_file(view.access_buffer(), file);
+      view.update_buffer();
+      return ok;
+    }
+
+    /// Extract many files at once, spreading them over the worker threads.
+    /// buffers[i] receives files[i]. Returns the number of files extracted.
+    ///
+    /// Example
+    ///
+    ///     const char *names[] = { "level1.dae", "level1.jpg", "music.wav" };
+    ///     dynarray<uint8_t> data[3];
+    ///     zip->get_files(data, names, 3);
+    unsigned get_files(dynarray<uint8_t> *buffers, const char *const *files, unsigned num_files, worker_pool &pool=worker_pool::get()) {
+      std::atomic<unsigned> num_done(0);
+      pool.parallel_for(num_files, 1, [&](unsigned begin, unsigned end) {
+        // one decoder for each chunk of files
+        zip_decoder decoder;
+        for (unsigned i = begin; i != end; ++i) {
+          int index = directory.get_index(files[i]);
+          if (index >= 0 && extract(directory.get_value(index), buffers[i], decoder)) {
+            num_done.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+      });
+      return num_done.load();
+    }
+
+    /// Time the inflate of every compressed file, "repeats" times over, and print the throughput.
+    /// eg. zip_file("assets/big.zip").benchmark();
+    void benchmark(unsigned repeats=10) {
+      zip_decoder decoder;
+      dynarray<uint8_t> buffer;
+      uint64_t total = 0;
+      unsigned num_files = 0;
+      unsigned errors = 0;
+      std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+      for (unsigned r = 0; r != repeats; ++r) {
+        for (unsigned i = 0; i != directory.get_num_indices(); ++i) {
+          if (!directory.get_key(i)) continue;
+          const dir_entry &d = directory.get_value(i);
+          if (d.compression != 8) continue;
+          errors += !extract(d, buffer, decoder);
+          total += d.usize;
+          num_files += r == 0;
+        }
       }
+      double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+      printf(
+        "zip_file benchmark: %d files x %d, %.2f MB in %.3fs = %.1f MB/s, %d errors\n",
+        num_files, repeats, total / 1e6, seconds, seconds > 0 ? total / 1e6 / seconds : 0.0, errors
+      );
     }
   };
 } }
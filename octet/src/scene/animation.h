@@ -43,6 +43,14 @@ namespace octet { namespace scene {
     void visit(visitor &v) {
       v.visit(data, atom_data);
       v.visit(channels, atom_channels);
+      if (v.is_reader()) {
+        for (unsigned i = 0; i != channels.size(); ++i) {
+          channel &ch = channels[i];
+          ch.sid = v.translate_atom(ch.sid);
+          ch.sub_target = v.translate_atom(ch.sub_target);
+          ch.component = v.translate_atom(ch.component);
+        }
+      }
       v.visit(targets, atom_targets);
       v.visit(end_time, atom_end_time);
     }
@@ -213,6 +213,20 @@ namespace octet { namespace scene {
       mip_levels = new_mip_levels;
     }
 
+    // true if texture_loader can load this image: a single 2D GIF, JPEG or TGA file.
+    bool can_load_async() const {
+      if (gl_target != GL_TEXTURE_2D || cube_faces != 1) return false;
+      const char *ext = strrchr(url.c_str(), '.');
+      if (!ext) return false;
+      char lower[8];
+      unsigned i = 0;
+      for (; ext[i] && i != sizeof(lower) - 1; ++i) {
+        lower[i] = (char)tolower(ext[i]);
+      }
+      lower[i] = 0;
+      return !strcmp(lower, ".gif") || !strcmp(lower, ".jpg") || !strcmp(lower, ".jpeg") || !strcmp(lower, ".tga");
+    }
+
     void add_texture() {
       glBindTexture(gl_target, gl_texture);
 
@@ -335,11 +349,12 @@ namespace octet { namespace scene {
     }
 
     void load_part(const char *_url) {
-      dynarray<uint8_t> buffer;
-      app_utils::get_url(buffer, _url);
-      const unsigned char *src = &buffer[0];
+      // decode straight from the mapped file.
+      url_view buffer;
+      app_utils::get_url_view(buffer, _url);
+      const unsigned char *src = buffer.data();
       const unsigned char *src_max = src + buffer.size();
-      if (buffer.size() >= 6 && !memcmp(&buffer[0], "GIF89a", 6)) {
+      if (buffer.size() >= 6 && !memcmp(src, "GIF89a", 6)) {
         gif_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
       } else if (buffer.size() >= 6 && buffer[0] == 0xff && buffer[1] == 0xd8) {
@@ -351,7 +366,7 @@ namespace octet { namespace scene {
       } else if (buffer.size() >= 4 && buffer[0] == 'D' && buffer[1] == 'D' && buffer[2] == 'S' && buffer[3] == ' ') {
         dds_decoder dec;
         dec.get_image(bytes, format, width, height, src, src_max);
-      } else if (buffer.size() >= 348 && (!memcmp(&buffer[344], "ni1", 4) || !memcmp(&buffer[344], "n+1", 4))) {
+      } else if (buffer.size() >= 348 && (!memcmp(src + 344, "ni1", 4) || !memcmp(src + 344, "n+1", 4))) {
         nifti_decoder dec;
         gl_target = GL_TEXTURE_3D;
         dec.get_image(bytes, format, width, height, depth, frames, src, src_max);
@@ -365,8 +380,17 @@ namespace octet { namespace scene {
     }
 
     /// get the OpenGL texture handle for this image.
+    /// With OCTET_ASYNC_TEXTURES, an image that has not been loaded yet is loaded in the background
+    /// and is grey until it arrives. Call load() first to have the pixels and size straight away.
     GLuint get_gl_texture() {
       if (!gl_texture) {
+        #if OCTET_ASYNC_TEXTURES
+          if (bytes.size() == 0 && can_load_async()) {
+            gl_texture = resource_dict::get_texture_handle_async(GL_RGBA, url.c_str());
+            return gl_texture;
+          }
+        #endif
+
         if (bytes.size() == 0 || width == 0 || height == 0) {
           load();
         }
@@ -24,6 +24,31 @@ namespace octet { namespace scene {
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // std140 copy of the parameters that the shader declares in its "octet_material" block.
+    ref<uniform_buffer> material_block;
+
+    // set when a parameter changes, so the block is only rebuilt after set_diffuse() etc.
+    bool material_block_dirty;
+
+    // true for a diffuse colour with the default shader, which is all that visit() saves.
+    bool plain_color;
+
+    // "octet_frame" blocks for shaders that read the lights from it. Render thread only.
+    struct frame_state_t {
+      uniform_buffer *scene_block;  // bound by a visual_scene that is drawing, or NULL
+      uniform_buffer *own_block;    // filled from the render() arguments otherwise, kept for the life of the program
+
+      frame_state_t() {
+        scene_block = NULL;
+        own_block = NULL;
+      }
+    };
+
+    static frame_state_t &frame_state() {
+      static frame_state_t instance;
+      return instance;
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
@@ -35,6 +60,47 @@ namespace octet { namespace scene {
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
     }
 
+    // if the shader has an "octet_material" block, make a uniform buffer to hold it.
+    void create_material_block() {
+      unsigned size = custom_shader ? custom_shader->get_material_block_size() : 0;
+      material_block = size ? new uniform_buffer(size) : NULL;
+      material_block_dirty = true;
+    }
+
+    // copy parameters into the material block if any have been set since the last draw.
+    void update_material_block() {
+      if (material_block_dirty) {
+        for (unsigned i = 0; i != params.size(); ++i) {
+          param_uniform *pu = params[i]->get_param_uniform();
+          if (pu && pu->get_block_offset() >= 0) {
+            material_block->set_value(pu->get_block_offset(), pu->get_value(buffer.data()), pu->get_block_size());
+          }
+        }
+        material_block_dirty = false;
+      }
+      material_block->bind(uniform_buffer::material_binding);
+    }
+
+    // copy a per-draw value into the buffer.
+    // shaders that read the camera and lights from the "octet_frame" block have no location for them, so they are skipped.
+    void set_dynamic(atom_t name, const void *value, unsigned size) {
+      param_uniform *pu = get_param_uniform(name);
+      if (pu && pu->get_uniform() != -1) {
+        pu->set_value(buffer.data(), value, size);
+      }
+    }
+
+    // when drawn outside a visual_scene, make the "octet_frame" block from the lights passed to render().
+    // the camera matrices in the block are not known here; the default shaders only read the lights.
+    void bind_own_frame_block(vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      frame_state_t &fs = frame_state();
+      if (!fs.own_block) fs.own_block = new uniform_buffer(frame_block_size);
+      fs.own_block->set_value(frame_lighting, light_uniforms, sizeof(vec4) * num_light_uniforms);
+      int32_t n = num_lights;
+      fs.own_block->set_value(frame_num_lights, &n, sizeof(int32_t));
+      fs.own_block->bind(uniform_buffer::frame_binding);
+    }
+
     // create the attribute parameters
     void create_attribute_params() {
       params.push_back(new param_attribute(atom_pos, GL_FLOAT_VEC4));
@@ -42,6 +108,31 @@ namespace octet { namespace scene {
       params.push_back(new param_attribute(atom_normal, GL_FLOAT_VEC3));
     }
 
+    // set up a solid colour material.
+    void init_solid(const vec4 &color, param_shader *shader) {
+      // materials are constructed from parameters which build the final shader.
+      // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
+      params.reserve(16);
+
+      create_dynamic_params();
+      create_attribute_params();
+
+      param_buffer_info static_pbi(buffer);
+      params.push_back(new param_color(static_pbi, color, atom_diffuse, param::stage_fragment));
+
+      plain_color = shader == NULL;
+      if (shader == NULL) {
+        #if OCTET_UNIFORM_BUFFERS
+          shader = new param_shader("shaders/default_ubo.vs", "shaders/default_solid_ubo.fs");
+        #else
+          shader = new param_shader("shaders/default.vs", "shaders/default_solid.fs");
+        #endif
+      }
+      shader->init(params);
+      custom_shader = shader;
+      create_material_block();
+    }
+
   public:
     RESOURCE_META(material)
 
@@ -51,32 +142,36 @@ namespace octet { namespace scene {
       light_size = 4,
     };
 
+    /// layout of the std140 "octet_frame" uniform block (see shaders/default_ubo.vs)
+    enum {
+      frame_cameraToProjection = 0,
+      frame_worldToCamera = 64,
+      frame_lighting = 128,
+      frame_num_lights = frame_lighting + (ambient_size + max_lights * light_size) * 16,
+      frame_block_size = frame_num_lights + 16,
+    };
+
+    /// Called by visual_scene with the "octet_frame" block it has bound, and with NULL when it has
+    /// finished drawing. Materials drawn at other times use the lights passed to render().
+    static void set_scene_frame_block(uniform_buffer *block) {
+      frame_state().scene_block = block;
+    }
+
     /// Default constructor makes a blank material.
     material() {
+      material_block_dirty = true;
+      plain_color = false;
     }
 
     /// Alternative constructor.
     material(const vec4 &color, param_shader *shader = NULL) {
-      // materials are constructed from parameters which build the final shader.
-      // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
-      params.reserve(16);
-
-      create_dynamic_params();
-      create_attribute_params();
-
-      param_buffer_info static_pbi(buffer);
-      params.push_back(new param_color(static_pbi, color, atom_diffuse, param::stage_fragment));
-
-      if (shader == NULL) {
-        shader = new param_shader("shaders/default.vs", "shaders/default_solid.fs");
-      }
-      shader->init(params);
-      custom_shader = shader;
+      init_solid(color, shader);
     }
 
     /// create a material from an existing image
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
       if (!smpl) smpl = new sampler();
+      plain_color = false;
 
       params.reserve(16);
 
@@ -87,17 +182,31 @@ namespace octet { namespace scene {
       params.push_back(new param_sampler(static_pbi, atom_diffuse_sampler, img, smpl, param::stage_fragment));
 
       if (shader == NULL) {
-        shader = new param_shader("shaders/default.vs", "shaders/default_textured.fs");
+        #if OCTET_UNIFORM_BUFFERS
+          shader = new param_shader("shaders/default_ubo.vs", "shaders/default_textured_ubo.fs");
+        #else
+          shader = new param_shader("shaders/default.vs", "shaders/default_textured.fs");
+        #endif
         shader->init(params);
       }
       custom_shader = shader;
+      create_material_block();
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      material_block_dirty = true;
+      plain_color = false;
     }
 
-    /// Serialize.
+    /// Serialize. Shaders and parameters are not saved yet, only the diffuse colour,
+    /// so a loaded material is a solid colour. Check is_plain_color() before saving.
     void visit(visitor &v) {
+      param_uniform *diffuse = v.is_reader() ? NULL : get_param_uniform(atom_diffuse);
+      vec4 color = diffuse ? *(const vec4*)diffuse->get_value(buffer.data()) : vec4(0.5f, 0.5f, 0.5f, 1);
+      v.visit(color, atom_diffuse);
+      if (v.is_reader() && !custom_shader) {
+        init_solid(color, NULL);
+      }
     }
 
     /// Set the uniforms for this material.
@@ -107,25 +216,25 @@ namespace octet { namespace scene {
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      // matrices and lighting go in the dynamic uniform buffer
+      set_dynamic(atom_modelToProjection, modelToProjection.get(), sizeof(modelToProjection));
+      set_dynamic(atom_modelToCamera, modelToCamera.get(), sizeof(modelToCamera));
+      set_dynamic(atom_lighting, light_uniforms, sizeof(vec4) * num_light_uniforms);
+      set_dynamic(atom_num_lights, &num_lights, sizeof(int32_t));
 
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
-
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      custom_shader->render();
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+      if (custom_shader->get_frame_block() != (GLuint)-1 && !frame_state().scene_block) {
+        bind_own_frame_block(light_uniforms, num_light_uniforms, num_lights);
       }
 
-      custom_shader->render();
+      if (material_block) {
+        update_material_block();
+      }
 
       {
         // colours and textures go in the static uniform buffer
+        // parameters in the material block have no uniform location and are skipped by render()
         for (unsigned i = 0; i != params.size(); ++i) {
           param_uniform *pu = params[i]->get_param_uniform();
           if (pu) {
@@ -142,6 +251,11 @@ namespace octet { namespace scene {
       //bind_textures();
     }
 
+    /// true if visit() saves everything about this material: a diffuse colour with the default shader.
+    bool is_plain_color() const {
+      return plain_color;
+    }
+
     /// get a named parameter
     param *get_param(atom_t name) {
       for (unsigned i = 0; i != params.size(); ++i) {
@@ -162,11 +276,13 @@ namespace octet { namespace scene {
     void set_diffuse(const vec4 &color) {
       if (param *p = get_param_uniform(atom_diffuse)) {
         p->get_param_uniform()->set_value(buffer.data(), &color, sizeof(color));
+        material_block_dirty = true;
       }
     }
 
     void set_uniform(param_uniform *param, const void *data, size_t size) {
       memcpy(buffer.data() + param->get_offset(), data, size);
+      material_block_dirty = true;
     }
 
     dynarray<ref<param> > &get_params() {
@@ -177,10 +293,13 @@ namespace octet { namespace scene {
       param_buffer_info pbi(buffer);
       param_uniform *result = new param_uniform(pbi, data, name, _type, _repeat, _stage);
       params.push_back(result);
+      plain_color = false;
 
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
+      pbind.material_block = custom_shader->get_material_block();
       result->bind(pbind);
+      material_block_dirty = true;
       return result;
     }
 
@@ -189,9 +308,11 @@ namespace octet { namespace scene {
       pbi.texture_slot = texture_slot;
       param_sampler *result = new param_sampler(pbi, name, _image, _sampler, _stage);
       params.push_back(result);
+      plain_color = false;
 
       param_bind_info pbind;
       pbind.program = custom_shader->get_program();
+      pbind.material_block = custom_shader->get_material_block();
       result->bind(pbind);
       return result;
     }
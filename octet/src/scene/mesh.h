@@ -5,6 +5,10 @@
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
 namespace octet { namespace scene {
+  // allocation profiler tags for building meshes
+  OCTET_ALLOC_TAG(mesh_build)
+  OCTET_ALLOC_TAG(mesh_reindex)
+
   /// General mesh class. This is a base class for all meshes such as mesh_box.
   /// Meshes may be dynamic or static.
   class mesh : public resource {
@@ -637,7 +641,7 @@ namespace octet { namespace scene {
     }
 
     /// assign a vector to the vertex buffer and set params
-    template <class elem_t> void set_vertices(const dynarray<elem_t> &rhs) {
+    template <class elem_t, class allocator_t, bool use_new_delete> void set_vertices(const dynarray<elem_t, allocator_t, use_new_delete> &rhs) {
       if (!vertices || vertices->get_size() != rhs.size() * sizeof(elem_t)) {
         vertices = new gl_resource();
         vertices->allocate(GL_ARRAY_BUFFER, rhs.size() * sizeof(elem_t));
@@ -653,7 +657,7 @@ namespace octet { namespace scene {
     }
 
     /// assign a vector to the index buffer and set params
-    template <class elem_t> void set_indices(const dynarray<elem_t> &rhs) {
+    template <class elem_t, class allocator_t, bool use_new_delete> void set_indices(const dynarray<elem_t, allocator_t, use_new_delete> &rhs) {
       if (!indices || indices->get_size() != rhs.size() * sizeof(elem_t)) {
         indices = new gl_resource();
         indices->allocate(GL_ELEMENT_ARRAY_BUFFER, rhs.size() * sizeof(elem_t));
@@ -792,10 +796,12 @@ namespace octet { namespace scene {
     void reindex() {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
-      hash_map<general_vertex, unsigned, vertex_cmp> vertex_to_index;
+      // scratch containers, copied to the GL buffers below.
+      typedef tagged_allocator<mesh_reindex, frame_allocator> scratch_allocator;
+      hash_map<general_vertex, unsigned, vertex_cmp, scratch_allocator> vertex_to_index;
 
-      dynarray<uint8_t> dest_vertices;
-      dynarray<uint32_t> dest_indices;
+      dynarray<uint8_t, scratch_allocator> dest_vertices;
+      dynarray<uint32_t, scratch_allocator> dest_indices;
       dest_indices.reserve(get_num_indices());
 
       //The code below is inside a new scope { ... } with the purpose of be sure that outside the scope idx_lock will be deleted
@@ -959,8 +965,8 @@ namespace octet { namespace scene {
 
     template <class vertex_t> struct sink {
       mesh *mesh_;
-      dynarray<vertex_t> vertices;
-      dynarray<uint32_t> indices;
+      dynarray<vertex_t, tagged_allocator<mesh_build> > vertices;
+      dynarray<uint32_t, tagged_allocator<mesh_build> > indices;
       mat4t transform;
 
       sink(mesh *mesh_, mat4t_in transform) :
@@ -45,9 +45,9 @@ namespace octet { namespace scene {
     };
 
     /// animator for particles
-    /// link points to particle
+    /// link is the handle of the billboard particle
     struct particle_animator {
-      int link;
+      pool_handle link;
       vec3p vel;
       vec3p acceleration;
       uint32_t lifetime;      /// time to live in frames
@@ -74,17 +74,17 @@ namespace octet { namespace scene {
     };
   private:
 
-    // POD (plain-old-data) structure dynarray of camera-facing particles
-    dynarray<billboard_particle> billboard_particles;
-    int free_billboard_particle;
+    // POD (plain-old-data) structure pool of camera-facing particles
+    object_pool<billboard_particle> billboard_particles;
+    unsigned billboard_capacity;
 
-    // POD structure dynarray of trail particles.
-    dynarray<trail_particle> trail_particles;
-    int free_trail_particle;
+    // POD structure pool of trail particles.
+    object_pool<trail_particle> trail_particles;
+    unsigned trail_capacity;
 
-    // POD structure dynarray of animators for particles.
-    dynarray<particle_animator> particle_animators;
-    int free_particle_animator;
+    // POD structure pool of animators for particles.
+    object_pool<particle_animator> particle_animators;
+    unsigned animator_capacity;
 
     // camera matrix
     mat4t cameraToWorld;
@@ -95,32 +95,19 @@ namespace octet { namespace scene {
       billboard_particles.reserve(bbcap);
       trail_particles.reserve(tpcap);
       particle_animators.reserve(pacap);
-      free_billboard_particle = -1;
-      free_trail_particle = -1;
-      free_particle_animator = -1;
+      billboard_capacity = bbcap;
+      trail_capacity = tpcap;
+      animator_capacity = pacap;
 
       unsigned vsize = (bbcap * 4 + tpcap * 2) * sizeof(vertex);
       unsigned isize = (bbcap * 6 + tpcap * 6) * sizeof(uint32_t);
       mesh::allocate(vsize, isize);
     }
 
-    // pool allocation of particles.
-    // note: we won't allocate beyond the capacity
-    template <class Type> int allocate(dynarray<Type> &array, int &free) {
-      int result = free;
-      if (free != -1) {
-        free = array[free].link;
-      } else if (array.size() < array.capacity()) {
-        result = (int)array.size();
-        array.resize(result+1);
-      }
-      return result;
-    }
-
-    // return to pool
-    template <class Type> void free(dynarray<Type> &array, int &free, int element) {
-      array[free].link = free;
-      free = element;
+    // add to a pool.
+    // note: we won't allocate beyond the capacity, the mesh buffers are sized for it.
+    template <class Type> pool_handle allocate(object_pool<Type> &pool, unsigned capacity, const Type &value) {
+      return pool.size() < capacity ? pool.add(value) : pool_handle();
     }
 
   public:
@@ -132,22 +119,21 @@ namespace octet { namespace scene {
     }
 
     /// Update the vertices for newtonian physics.
+    /// Animators that reach the end of their lifetime are removed with their particle.
     void animate(float time_step) {
-      for (unsigned i = 0; i != particle_animators.size(); ++i) {
+      for (unsigned i = 0; i < particle_animators.size(); ) {
         particle_animator &g = particle_animators[i];
-        if (g.link >= 0) {
-          billboard_particle &p = billboard_particles[g.link];
-          if (g.age >= g.lifetime) {
-            p.enabled = false;
-            free(billboard_particles, free_billboard_particle, g.link);
-            g.link = -1;
-            free(particle_animators, free_particle_animator, i);
-          } else {
-            p.pos = (vec3)p.pos + (vec3)g.vel * time_step;
-            g.vel = (vec3)g.vel + (vec3)g.acceleration * time_step;
-            p.angle += (uint32_t)(g.spin * time_step);
-            g.age++;
-          }
+        billboard_particle *p = billboard_particles.get(g.link);
+        if (!p || g.age >= g.lifetime) {
+          billboard_particles.remove(g.link);
+          // the last animator moves into slot i, so do not advance.
+          particle_animators.remove(particle_animators.get_handle(i));
+        } else {
+          p->pos = (vec3)p->pos + (vec3)g.vel * time_step;
+          g.vel = (vec3)g.vel + (vec3)g.acceleration * time_step;
+          p->angle += (uint32_t)(g.spin * time_step);
+          g.age++;
+          ++i;
         }
       }
     }
@@ -201,47 +187,42 @@ namespace octet { namespace scene {
       //dump(log("mesh\n"));
     }
 
-    /// Add a billboard particle. Returns -1 if capacity reached.
-    int add_billboard_particle(const billboard_particle &p) {
-      int i = allocate(billboard_particles, free_billboard_particle);
-      if (i != -1) {
-        billboard_particles[i] = p;
-      }
-      return i;
+    /// Add a billboard particle. Returns a null handle if capacity reached.
+    pool_handle add_billboard_particle(const billboard_particle &p) {
+      return allocate(billboard_particles, billboard_capacity, p);
     }
 
-    /// Add a particle animator. Returns -1 if capacity reached.
-    int add_particle_animator(const particle_animator &p) {
-      int i = allocate(particle_animators, free_particle_animator);
-      if (i != -1) {
-        particle_animators[i] = p;
-      }
-      return i;
+    /// Add a particle animator. Returns a null handle if capacity reached.
+    pool_handle add_particle_animator(const particle_animator &p) {
+      return allocate(particle_animators, animator_capacity, p);
     }
 
-    /// Add a trail particle. Returns -1 if capacity reached.
-    int add_trail_particle(const trail_particle &p) {
-      int i = allocate(trail_particles, free_trail_particle);
-      if (i != -1) {
-        trail_particles[i] = p;
-      }
-      return i;
+    /// Add a trail particle. Returns a null handle if capacity reached.
+    pool_handle add_trail_particle(const trail_particle &p) {
+      return allocate(trail_particles, trail_capacity, p);
     }
 
-    billboard_particle &access_billboard_particle(int i) { return billboard_particles[i]; }
-    trail_particle &access_trail_particle(int i) { return trail_particles[i]; }
-    particle_animator &access_particle_animator(int i) { return particle_animators[i]; }
+    /// Remove a billboard particle. Stale handles are ignored.
+    void remove_billboard_particle(pool_handle h) { billboard_particles.remove(h); }
+
+    /// Remove a trail particle. Stale handles are ignored.
+    void remove_trail_particle(pool_handle h) { trail_particles.remove(h); }
+
+    /// Remove a particle animator. Stale handles are ignored.
+    void remove_particle_animator(pool_handle h) { particle_animators.remove(h); }
+
+    /// Access particles by handle. Returns NULL if the particle has been removed.
+    billboard_particle *access_billboard_particle(pool_handle h) { return billboard_particles.get(h); }
+    trail_particle *access_trail_particle(pool_handle h) { return trail_particles.get(h); }
+    particle_animator *access_particle_animator(pool_handle h) { return particle_animators.get(h); }
 
     /// Serialise
     void visit(visitor &v) {
       mesh::visit(v);
       /*
       v.visit(billboard_particles);
-      v.visit(free_billboard_particle);
       v.visit(trail_particles);
-      v.visit(free_trail_particle);
       v.visit(particle_animators);
-      v.visit(free_particle_animator);
       v.visit(cameraToWorld);
       */
     }
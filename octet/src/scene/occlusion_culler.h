@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Hierarchical depth occlusion culling
+//
+// At the end of each frame, the depth buffer is copied to a texture on the GPU
+// and a shader reduces it to a quarter size image of "furthest depth", which is
+// read into a pixel buffer object. Each copy is read num_pbos frames later, just
+// before its buffer is reused, when the GPU has long finished with it, so we
+// never wait for the GPU. The CPU halves the image into a pyramid of levels.
+// Mesh instance bounding boxes are projected with the same camera and skipped
+// if they are behind everything in their screen rectangle.
+//
+// Because the depth is from an earlier frame, fast camera moves can make objects
+// appear a couple of frames late. This suits dense static scenery such as
+// buildings and trees.
+//
+// Needs pixel buffer objects (OCTET_PIXEL_BUFFERS). Without them every object
+// is visible.
+//
+
+namespace octet { namespace scene {
+  /// CPU occlusion test against a depth pyramid from an earlier frame.
+  class occlusion_culler : public resource {
+    enum {
+      num_pbos = 2,       // frames in flight
+      base_reduce = 4,    // level 0 is 1/4 of the screen size
+      max_levels = 16,
+    };
+
+    // pixel buffers receiving the reduced depth and the camera used to draw it
+    GLuint pbos[num_pbos];
+    int pbo_width[num_pbos];
+    int pbo_height[num_pbos];
+    mat4t pbo_worldToProjection[num_pbos];
+    unsigned frame;
+
+    // GPU reduction: full size copy of the depth buffer and the reduced float target
+    GLuint depth_texture;
+    GLuint reduced_texture;
+    GLuint reduced_fbo;
+    int depth_width;
+    int depth_height;
+    ref<depth_reduce_shader> reduce_shader;
+
+    // furthest depth in each texel, level 0 is the finest
+    dynarray<float> levels[max_levels];
+    int level_width[max_levels];
+    int level_height[max_levels];
+    int num_levels;
+
+    // camera used to draw the depth in the pyramid
+    mat4t worldToProjection;
+
+    // results for this frame: bit i is set if object i was found to be hidden.
+    dynamic_bitset<> culled;
+    unsigned num_tested;
+
+    static float max4(const float *src) {
+      #if OCTET_SSE2
+        __m128 v = _mm_loadu_ps(src);
+        v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+        v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(v);
+      #else
+        float a = src[0] > src[1] ? src[0] : src[1];
+        float b = src[2] > src[3] ? src[2] : src[3];
+        return a > b ? a : b;
+      #endif
+    }
+
+    // furthest depth of a row of texels
+    static float row_max(const float *src, int n) {
+      float result = 0;
+      int i = 0;
+      #if OCTET_SSE2
+        if (n >= 4) {
+          __m128 m = _mm_loadu_ps(src);
+          for (i = 4; i + 4 <= n; i += 4) {
+            m = _mm_max_ps(m, _mm_loadu_ps(src + i));
+          }
+          float tmp[4];
+          _mm_storeu_ps(tmp, m);
+          result = max4(tmp);
+        }
+      #endif
+      for (; i != n; ++i) {
+        result = src[i] > result ? src[i] : result;
+      }
+      return result;
+    }
+
+    // level 0 is the reduced depth from the GPU. Halve it until it is one texel.
+    void build_pyramid(const float *depth, int w, int h) {
+      level_width[0] = w;
+      level_height[0] = h;
+      levels[0].resize(w * h);
+      memcpy(levels[0].data(), depth, w * h * sizeof(float));
+
+      num_levels = 1;
+      while ((w > 1 || h > 1) && num_levels != max_levels) {
+        const float *src = levels[num_levels-1].data();
+        int sw = w, sh = h;
+        w = (w + 1) >> 1;
+        h = (h + 1) >> 1;
+        levels[num_levels].resize(w * h);
+        float *dst = levels[num_levels].data();
+        for (int y = 0; y != h; ++y) {
+          const float *r0 = src + (y * 2) * sw;
+          const float *r1 = y * 2 + 1 < sh ? r0 + sw : r0;
+          for (int x = 0; x != w; ++x) {
+            int x1 = x * 2 + 1 < sw ? x * 2 + 1 : x * 2;
+            float a = r0[x*2] > r0[x1] ? r0[x*2] : r0[x1];
+            float b = r1[x*2] > r1[x1] ? r1[x*2] : r1[x1];
+            dst[y * w + x] = a > b ? a : b;
+          }
+        }
+        level_width[num_levels] = w;
+        level_height[num_levels] = h;
+        num_levels++;
+      }
+    }
+
+  public:
+    RESOURCE_META(occlusion_culler)
+
+    occlusion_culler() {
+      for (int i = 0; i != num_pbos; ++i) {
+        pbos[i] = 0;
+        pbo_width[i] = pbo_height[i] = 0;
+      }
+      frame = 0;
+      num_levels = 0;
+      num_tested = 0;
+      depth_texture = reduced_texture = reduced_fbo = 0;
+      depth_width = depth_height = 0;
+    }
+
+    ~occlusion_culler() {
+      #if OCTET_PIXEL_BUFFERS
+        for (int i = 0; i != num_pbos; ++i) {
+          if (pbos[i]) glDeleteBuffers(1, &pbos[i]);
+        }
+        if (reduced_fbo) glDeleteFramebuffers(1, &reduced_fbo);
+        if (depth_texture) glDeleteTextures(1, &depth_texture);
+        if (reduced_texture) glDeleteTextures(1, &reduced_texture);
+      #endif
+    }
+
+    /// Call before drawing "num_objects" objects. Collects the depth buffer copied num_pbos frames ago.
+    void begin_frame(unsigned num_objects) {
+      num_tested = 0;
+      culled.resize(num_objects);
+      culled.clear_all();
+      num_levels = 0;
+
+      #if OCTET_PIXEL_BUFFERS
+        // the oldest copy, which the GPU should have finished by now.
+        // end_frame() wrote this slot num_pbos frames ago and is about to reuse it.
+        unsigned slot = frame % num_pbos;
+        if (!pbos[slot] || !pbo_width[slot]) return;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+        #ifdef __APPLE__
+          const float *depth = (const float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        #else
+          const float *depth = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pbo_width[slot] * pbo_height[slot] * sizeof(float), GL_MAP_READ_BIT);
+        #endif
+        if (depth) {
+          build_pyramid(depth, pbo_width[slot], pbo_height[slot]);
+          worldToProjection = pbo_worldToProjection[slot];
+          glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      #endif
+    }
+
+    /// Call after drawing. Reduces this frame's depth buffer on the GPU and starts reading it back without waiting.
+    void end_frame(const mat4t &worldToProjection) {
+      #if OCTET_PIXEL_BUFFERS
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        int width = viewport[2], height = viewport[3];
+        int w = (width + base_reduce - 1) / base_reduce;
+        int h = (height + base_reduce - 1) / base_reduce;
+        if (width <= 0 || height <= 0) return;
+
+        GLint old_fbo = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fbo);
+
+        if (!reduce_shader) {
+          reduce_shader = new depth_reduce_shader();
+          reduce_shader->init();
+          glGenTextures(1, &depth_texture);
+          glGenTextures(1, &reduced_texture);
+          glGenFramebuffers(1, &reduced_fbo);
+        }
+
+        // copy the depth buffer to a texture. This stays on the GPU.
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depth_texture);
+        if (width != depth_width || height != depth_height) {
+          glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+          glBindTexture(GL_TEXTURE_2D, reduced_texture);
+          glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+          glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+          glBindFramebuffer(GL_FRAMEBUFFER, reduced_fbo);
+          glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reduced_texture, 0);
+          glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+
+          glBindTexture(GL_TEXTURE_2D, depth_texture);
+          depth_width = width;
+          depth_height = height;
+        }
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], width, height);
+
+        // reduce it to the furthest depth of each block with one full screen triangle.
+        GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean cull_face = glIsEnabled(GL_CULL_FACE);
+        GLboolean blend = glIsEnabled(GL_BLEND);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, reduced_fbo);
+        glViewport(0, 0, w, h);
+        reduce_shader->render(0, width, height, base_reduce);
+
+        static const float triangle[] = { -1, -1, 0, 1,  3, -1, 0, 1,  -1, 3, 0, 1 };
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glVertexAttribPointer(attribute_pos, 4, GL_FLOAT, GL_FALSE, 0, (void*)triangle);
+        glEnableVertexAttribArray(attribute_pos);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glDisableVertexAttribArray(attribute_pos);
+
+        // start reading the small image back into this frame's pixel buffer.
+        unsigned slot = frame % num_pbos;
+        if (!pbos[slot]) glGenBuffers(1, &pbos[slot]);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+        if (w != pbo_width[slot] || h != pbo_height[slot]) {
+          glBufferData(GL_PIXEL_PACK_BUFFER, w * h * sizeof(float), NULL, GL_STREAM_READ);
+          pbo_width[slot] = w;
+          pbo_height[slot] = h;
+        }
+        glReadPixels(0, 0, w, h, GL_RED, GL_FLOAT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        pbo_worldToProjection[slot] = worldToProjection;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, old_fbo);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        if (depth_test) glEnable(GL_DEPTH_TEST);
+        if (cull_face) glEnable(GL_CULL_FACE);
+        if (blend) glEnable(GL_BLEND);
+        frame++;
+      #endif
+    }
+
+    /// Return false if the box of object "index" is hidden behind the depth of an earlier frame.
+    bool is_visible(unsigned index, const aabb &bb, const mat4t &modelToWorld) {
+      num_tested++;
+      if (num_levels == 0) return true;
+
+      mat4t modelToProjection = modelToWorld * worldToProjection;
+      vec3 center = bb.get_center();
+      vec3 half = bb.get_half_extent();
+      float min_x = 1e37f, min_y = 1e37f, max_x = -1e37f, max_y = -1e37f, min_z = 1e37f;
+      for (int i = 0; i != 8; ++i) {
+        vec3 corner = center + half * vec3(
+          (i & 1 ? 1.0f : -1.0f),
+          (i & 2 ? 1.0f : -1.0f),
+          (i & 4 ? 1.0f : -1.0f)
+        );
+        vec4 p = corner.xyz1() * modelToProjection;
+        // crossing the near plane: can not project safely.
+        if (p.w() <= 1e-5f) return true;
+        float rw = 1.0f / p.w();
+        float x = p.x() * rw, y = p.y() * rw, z = p.z() * rw;
+        min_x = x < min_x ? x : min_x; max_x = x > max_x ? x : max_x;
+        min_y = y < min_y ? y : min_y; max_y = y > max_y ? y : max_y;
+        min_z = z < min_z ? z : min_z;
+      }
+
+      // off screen in the old frame: nothing to test against.
+      if (max_x < -1 || min_x > 1 || max_y < -1 || min_y > 1) return true;
+
+      // screen rectangle in level 0 texels
+      float w0 = (float)level_width[0], h0 = (float)level_height[0];
+      int x0 = (int)((min_x * 0.5f + 0.5f) * w0), x1 = (int)((max_x * 0.5f + 0.5f) * w0);
+      int y0 = (int)((min_y * 0.5f + 0.5f) * h0), y1 = (int)((max_y * 0.5f + 0.5f) * h0);
+      x0 = x0 < 0 ? 0 : x0; y0 = y0 < 0 ? 0 : y0;
+      x1 = x1 >= level_width[0] ? level_width[0] - 1 : x1;
+      y1 = y1 >= level_height[0] ? level_height[0] - 1 : y1;
+
+      // pick the level where the rectangle is a few texels across.
+      int level = 0;
+      while (level + 1 < num_levels && ((x1 - x0) > 3 || (y1 - y0) > 3)) {
+        x0 >>= 1; x1 >>= 1; y0 >>= 1; y1 >>= 1;
+        level++;
+      }
+
+      const float *src = levels[level].data();
+      int w = level_width[level];
+      float furthest = 0;
+      for (int y = y0; y <= y1; ++y) {
+        float r = row_max(src + y * w + x0, x1 - x0 + 1);
+        furthest = r > furthest ? r : furthest;
+      }
+
+      // nearest point of the box is behind everything drawn there.
+      float nearest = min_z * 0.5f + 0.5f;
+      if (nearest > furthest) {
+        culled.set(index);
+        return false;
+      }
+      return true;
+    }
+
+    /// number of boxes tested this frame
+    unsigned get_num_tested() const {
+      return num_tested;
+    }
+
+    /// number of boxes found to be hidden this frame
+    unsigned get_num_culled() const {
+      return (unsigned)culled.count();
+    }
+
+    /// the objects found to be hidden this frame, by the index passed to is_visible().
+    const dynamic_bitset<> &get_culled() const {
+      return culled;
+    }
+  };
+}}
@@ -45,7 +45,7 @@ namespace octet { namespace scene {
       return name;
     }
 
-    uint16_t get_gl_type() {
+    uint16_t get_gl_type() const {
       return type;
     }
 
@@ -86,6 +86,12 @@ namespace octet { namespace scene {
 
   struct param_bind_info {
     GLint program;
+    GLuint material_block;  // index of the "octet_material" uniform block or GL_INVALID_INDEX
+
+    param_bind_info() {
+      program = 0;
+      material_block = (GLuint)-1;
+    }
   };
 
   struct param_buffer_info {
@@ -109,10 +115,12 @@ namespace octet { namespace scene {
     uint16_t offset;         // offset in uniform buffer
     uint16_t repeat;         // how many in array?
     uint8_t uniform_buffer;  // Which uniform buffer? 0 = dynamic, 1 = static.
+    int block_offset;        // std140 offset in the material uniform block, -1 if not in the block
   public:
     RESOURCE_META(param_uniform)
 
     param_uniform() {
+      block_offset = -1;
     }
 
     /// create a new uniform parameter with a prototype in "buffer"
@@ -121,6 +129,7 @@ namespace octet { namespace scene {
       param(name, _type, _stage)
     {
       repeat = _repeat;
+      block_offset = -1;
 
       // in uniform buffers, everything is in units of 16 bytes
       // matrices are repeats of vec4s
@@ -171,6 +180,24 @@ namespace octet { namespace scene {
     void bind(param_bind_info &pbi) {
       uniform = glGetUniformLocation(pbi.program, get_atom_name());
       //log("bind %d %s\n", uniform, get_atom_name());
+
+      // members of a uniform block have no location; find their offset in the block instead.
+      block_offset = -1;
+      #if OCTET_UNIFORM_BUFFERS
+        if (uniform == -1 && pbi.material_block != (GLuint)-1) {
+          const char *name = get_atom_name();
+          GLuint index = (GLuint)-1;
+          glGetUniformIndices(pbi.program, 1, &name, &index);
+          if (index != (GLuint)-1) {
+            GLint block = -1, offset = -1;
+            glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+            glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_OFFSET, &offset);
+            if (block == (GLint)pbi.material_block) {
+              block_offset = offset;
+            }
+          }
+        }
+      #endif
     }
 
     /// get the uniform location
@@ -192,6 +219,29 @@ namespace octet { namespace scene {
       return buffer + offset;
     }
 
+    /// offset of this parameter in the material uniform block or -1 if it is set with glUniform*
+    int get_block_offset() const {
+      return block_offset;
+    }
+
+    /// number of bytes this parameter occupies in a std140 block.
+    /// arrays use a 16 byte stride, the same as the param buffer, but single scalars are packed.
+    unsigned get_block_size() const {
+      unsigned size = repeat * 16;
+      switch (get_gl_type()) {
+        case GL_FLOAT_MAT2: return size * 2;
+        case GL_FLOAT_MAT3: return size * 3;
+        case GL_FLOAT_MAT4: return size * 4;
+        case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: return size;
+      }
+      if (repeat != 1) return size;
+      switch (get_gl_type()) {
+        case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+        case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+        default: return 4;
+      }
+    }
+
     /// which uniform buffer does this parameter belong to?
     uint8_t get_uniform_buffer_index() {
       return uniform_buffer;
@@ -302,13 +352,35 @@ namespace octet { namespace scene {
     std::string vertex_shader;
     std::string fragment_shader;
 
+    // uniform blocks declared by the shader, or GL_INVALID_INDEX
+    GLuint frame_block;
+    GLuint material_block;
+
+    // attach the std140 blocks to the fixed binding points used by visual_scene and material.
+    void bind_blocks() {
+      frame_block = material_block = (GLuint)-1;
+      #if OCTET_UNIFORM_BUFFERS
+        GLuint program = get_program();
+        frame_block = glGetUniformBlockIndex(program, "octet_frame");
+        material_block = glGetUniformBlockIndex(program, "octet_material");
+        if (frame_block != (GLuint)-1) {
+          glUniformBlockBinding(program, frame_block, uniform_buffer::frame_binding);
+        }
+        if (material_block != (GLuint)-1) {
+          glUniformBlockBinding(program, material_block, uniform_buffer::material_binding);
+        }
+      #endif
+    }
+
   public:
     RESOURCE_META(param_shader)
 
     param_shader() {
+      frame_block = material_block = (GLuint)-1;
     }
 
     param_shader(const char *vs_url, const char *fs_url) {
+      frame_block = material_block = (GLuint)-1;
       dynarray<uint8_t> vs;
       dynarray<uint8_t> fs;
       app_utils::get_url(vs, vs_url);
@@ -320,14 +392,37 @@ namespace octet { namespace scene {
 
     void init(dynarray<ref<param> > &params) {
       shader::init(vertex_shader.data(), fragment_shader.data());
+      bind_blocks();
 
       param_bind_info pbi;
       pbi.program = get_program();
+      pbi.material_block = material_block;
 
       for (unsigned i = 0; i != params.size(); ++i) {
         params[i]->bind(pbi);
       }
     }
+
+    /// index of the "octet_frame" block in this program, or GL_INVALID_INDEX.
+    GLuint get_frame_block() const {
+      return frame_block;
+    }
+
+    /// index of the "octet_material" block in this program, or GL_INVALID_INDEX.
+    GLuint get_material_block() const {
+      return material_block;
+    }
+
+    /// size in bytes of the "octet_material" block, 0 if the shader does not use one.
+    unsigned get_material_block_size() const {
+      GLint size = 0;
+      #if OCTET_UNIFORM_BUFFERS
+        if (material_block != (GLuint)-1) {
+          glGetActiveUniformBlockiv(get_program(), material_block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        }
+      #endif
+      return (unsigned)size;
+    }
   };
 }}
 
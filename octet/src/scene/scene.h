@@ -10,6 +10,7 @@
 #ifndef OCTET_SCENE_INCLUDED
 #define OCTET_SCENE_INCLUDED
 
+#include "../scene/transform_store.h"
 #include "../scene/scene_node.h"
 #include "../scene/skin.h"
 #include "../scene/skeleton.h"
@@ -24,6 +25,7 @@
 #include "../scene/light_instance.h"
 #include "../scene/mesh_instance.h"
 #include "../scene/animation_instance.h"
+#include "../scene/occlusion_culler.h"
 #include "../scene/visual_scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
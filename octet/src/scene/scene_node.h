@@ -27,6 +27,40 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // optional flat storage for the transform and enabled flag (see transform_store)
+    ref<transform_store> store;
+    int store_index;
+
+    // the node to parent matrix, wherever it lives.
+    mat4t &local() {
+      return store ? store->access_nodeToParent(store_index) : nodeToParent;
+    }
+
+    const mat4t &local() const {
+      return store ? store->get_nodeToParent(store_index) : nodeToParent;
+    }
+
+    // move this node and its children into a store.
+    void attach_tree(transform_store *new_store, int parent_index) {
+      dynarray<scene_node*> nodes;
+      dynarray<int> parents;
+      get_all_child_nodes(nodes, parents);
+      dynarray<int> indices(nodes.size());
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        scene_node *node = nodes[i];
+        assert(!node->store && "scene_node: already in a transform store");
+        int p = parents[i] == -1 ? parent_index : indices[parents[i]];
+        indices[i] = new_store->add(p, node->nodeToParent, node->enabled);
+        node->store = new_store;
+        node->store_index = indices[i];
+        #ifdef OCTET_BULLET
+          // the store drives the body write-back from now on.
+          new_store->set_rigid_body(indices[i], node->rigid_body);
+          if (node->has_prev_transform) new_store->set_prev_transform(indices[i], node->prev_transform);
+        #endif
+      }
+    }
+
   public:
     RESOURCE_META(scene_node)
 
@@ -35,6 +69,11 @@ namespace octet { namespace scene {
       nodeToParent.loadIdentity();
       sid = atom_;
       enabled = true;
+      store_index = -1;
+      #ifdef OCTET_BULLET
+        rigid_body = NULL;
+        has_prev_transform = false;
+      #endif
       if (parent) {
         parent->add_child(this);
       }
@@ -45,6 +84,18 @@ namespace octet { namespace scene {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
       enabled = true;
+      store_index = -1;
+      #ifdef OCTET_BULLET
+        rigid_body = NULL;
+        has_prev_transform = false;
+      #endif
+    }
+
+    /// a stored node gives its slot back to the store.
+    ~scene_node() {
+      if (store) {
+        store->remove(store_index);
+      }
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -60,7 +111,7 @@ namespace octet { namespace scene {
     /// animation input: for now, we only support skeleton animation
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
-        nodeToParent.init_transpose(value);
+        local().init_transpose(value);
       }
     }
 
@@ -71,7 +122,7 @@ namespace octet { namespace scene {
       //log("visit scene_node children\n");
       v.visit(children, atom_children);
       //log("visit scene_node nodeToParent\n");
-      v.visit(nodeToParent, atom_nodeToParent);
+      v.visit(local(), atom_nodeToParent);
       v.visit(sid, atom_sid);
     }
 
@@ -80,6 +131,26 @@ namespace octet { namespace scene {
     void add_child(scene_node *new_node) {
       new_node->parent = this;
       children.push_back(new_node);
+      if (store && !new_node->store) {
+        new_node->attach_tree(store, store_index);
+      }
+    }
+
+    /// Move this root node and all its children into a transform store.
+    /// Children added later join the same store.
+    void attach_to_store(transform_store *new_store) {
+      assert(!parent && "scene_node: only root nodes can be attached to a store");
+      attach_tree(new_store, -1);
+    }
+
+    /// get the store holding this node's transform, or NULL.
+    transform_store *get_transform_store() const {
+      return store;
+    }
+
+    /// get this node's index in its transform store, or -1.
+    int get_store_index() const {
+      return store_index;
     }
 
     /// Get the parent node of this node.
@@ -99,17 +170,23 @@ namespace octet { namespace scene {
 
     // compute the scene_node to world matrix for an individual scene_node;
     mat4t calcModelToWorld() {
+      if (store) {
+        return store->calc_nodeToWorld(store_index);
+      }
       mat4t result = nodeToParent;
       for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
+        result = result * p->local();
       }
       return result;
     }
 
     // calculate whether this node is enabled (recursively)
     bool calcEnabled() {
+      if (store) {
+        return store->calc_enabled(store_index);
+      }
       for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
+        if (!p->get_enabled()) return false;
       }
       return true;
     }
@@ -130,12 +207,12 @@ namespace octet { namespace scene {
 
     /// read the node to parent transform matrix
     const mat4t &get_nodeToParent() const {
-      return nodeToParent;
+      return local();
     }
 
     /// access the node to parent transform matrix for writing.
     mat4t &access_nodeToParent() {
-      return nodeToParent;
+      return local();
     }
 
     /// get the x axis (left, right) of the node
@@ -160,32 +237,33 @@ namespace octet { namespace scene {
 
     /// get enabled state
     bool get_enabled() const {
-      return enabled;
+      return store ? store->get_enabled(store_index) : enabled;
     }
 
     /// set enabled state
     void set_enabled(bool value) {
       enabled = value;
+      if (store) store->set_enabled(store_index, value);
     }
 
     /// reset the matrix
     void loadIdentity() {
-      nodeToParent.loadIdentity();
+      local().loadIdentity();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
-      nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      local().translate(xyz[0], xyz[1], xyz[2]);
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
-      nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      local().rotate(angle, axis[0], axis[1], axis[2]);
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
-      nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      local().scale(xyz[0], xyz[1], xyz[2]);
     }
 
     /// Get the identifying sid
@@ -217,6 +295,10 @@ namespace octet { namespace scene {
     #ifdef OCTET_BULLET
     private:
       btRigidBody *rigid_body;
+
+      // the body's transform before the last fixed physics step, for interpolation.
+      btTransform prev_transform;
+      bool has_prev_transform;
     public:
       /// get the rigid body associated with this node (used for physics)
       btRigidBody *get_rigid_body() const {
@@ -226,6 +308,30 @@ namespace octet { namespace scene {
       /// set the rigid body associated with this node (used for physics)      
       void set_rigid_body(btRigidBody *value) {
         rigid_body = value;
+        has_prev_transform = false;
+        if (store) store->set_rigid_body(store_index, value);
+      }
+
+      /// remember the body's transform before a physics step (see visual_scene::set_physics_rate).
+      void set_prev_transform(const btTransform &value) {
+        if (store) {
+          store->set_prev_transform(store_index, value);
+        } else {
+          prev_transform = value;
+          has_prev_transform = true;
+        }
+      }
+
+      /// the transform saved before the last physics step, or NULL if the body has not been stepped yet.
+      const btTransform *get_prev_transform() const {
+        if (store) return store->get_prev_transform(store_index);
+        return has_prev_transform ? &prev_transform : NULL;
+      }
+
+      /// forget the previous transform after moving the body by hand.
+      void clear_prev_transform() {
+        has_prev_transform = false;
+        if (store) store->clear_prev_transform(store_index);
       }
 
       /// set the mass and inertia tensor
@@ -283,6 +389,7 @@ namespace octet { namespace scene {
         btTransform trans;// = rigid_body->getWorldTransform();
         trans.setFromOpenGLMatrix(value.get());
         rigid_body->setWorldTransform(trans);
+        clear_prev_transform();
       }
 
       /// brute force transform set: warning, this may break something!
@@ -290,6 +397,7 @@ namespace octet { namespace scene {
         btTransform trans = rigid_body->getWorldTransform();
         trans.setOrigin(get_btVector3(value));
         rigid_body->setWorldTransform(trans);
+        clear_prev_transform();
       }
 
       /// brute force tranform set: warning, this may break something!
@@ -297,6 +405,7 @@ namespace octet { namespace scene {
         btTransform trans = rigid_body->getWorldTransform();
         trans.setBasis(get_btMatrix3x3(value));
         rigid_body->setWorldTransform(trans);
+        clear_prev_transform();
       }
 
       /// activate the rigid body. You must do this periodicaly if you want your object to stay awake (see fps example).
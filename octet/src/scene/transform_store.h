@@ -0,0 +1,274 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Structure of arrays storage for scene node transforms
+//
+// Walking scene_node parent pointers touches memory all over the heap.
+// A transform_store keeps the matrices, parent indices and flags of a whole
+// hierarchy in flat arrays. Parents always come before their children, so
+// world matrices can be calculated in a single linear pass.
+//
+// Matrices live in fixed size chunks that never move, so references returned
+// by access_nodeToParent() stay valid when more nodes are added.
+//
+
+namespace octet { namespace scene {
+  /// Flat arrays of node transforms. Scene nodes that are attached to a store become handles into it.
+  ///
+  /// Example
+  ///
+  ///     app_scene->use_transform_store();  // move all the nodes of a scene into a store
+  ///     ...
+  ///     store->update_world();             // one linear pass over all nodes
+  ///     mat4t modelToWorld = store->get_nodeToWorld(node->get_store_index());
+  class transform_store : public resource {
+    enum {
+      chunk_shift = 8,
+      chunk_size = 1 << chunk_shift,
+      chunk_mask = chunk_size - 1,
+    };
+
+    // matrices for chunk_size consecutive slots.
+    struct chunk {
+      mat4t nodeToParent[chunk_size];
+      mat4t nodeToWorld[chunk_size];
+      #ifdef OCTET_BULLET
+        btTransform prev_transform[chunk_size];
+      #endif
+    };
+
+    dynarray<chunk*> chunks;
+
+    // per-node data, indexed by the node's store index.
+    dynarray<int> parents;
+    dynarray<uint8_t> flags;
+
+    // results of update_world()
+    dynarray<uint8_t> world_enabled;
+
+    // slots of dead nodes, kept as a max-heap so that the highest slot is reused first.
+    dynarray<int> free_slots;
+
+    #ifdef OCTET_BULLET
+      // the rigid body driving each slot, or NULL.
+      dynarray<btRigidBody*> bodies;
+      unsigned num_bodies;
+    #endif
+
+    mat4t &local_at(int index) const {
+      return chunks[index >> chunk_shift]->nodeToParent[index & chunk_mask];
+    }
+
+    mat4t &world_at(int index) const {
+      return chunks[index >> chunk_shift]->nodeToWorld[index & chunk_mask];
+    }
+
+  public:
+    RESOURCE_META(transform_store)
+
+    enum {
+      flag_enabled = 1,   // node and its children are renderable
+      flag_live = 2,      // the scene_node using this slot still exists
+      flag_has_prev = 4,  // prev_transform is valid for this slot's body
+    };
+
+    /// make an empty store
+    transform_store() {
+      #ifdef OCTET_BULLET
+        num_bodies = 0;
+      #endif
+    }
+
+    ~transform_store() {
+      for (unsigned i = 0; i != chunks.size(); ++i) {
+        delete chunks[i];
+      }
+    }
+
+    /// add a node, returning its index. The parent must already be in the store (or -1 for a root).
+    /// Free slots are reused when they come after the parent, so the linear update order still holds.
+    int add(int parent, const mat4t &matrix, bool enabled) {
+      int index;
+      if (!free_slots.empty() && free_slots[0] > parent) {
+        index = free_slots[0];
+        std::pop_heap(free_slots.data(), free_slots.data() + free_slots.size());
+        free_slots.pop_back();
+      } else {
+        index = (int)parents.size();
+        if ((index >> chunk_shift) == (int)chunks.size()) {
+          chunks.push_back(new chunk());
+        }
+        parents.push_back(-1);
+        flags.push_back(0);
+        world_enabled.push_back(0);
+        #ifdef OCTET_BULLET
+          bodies.push_back(NULL);
+        #endif
+      }
+      assert(parent < index);
+      local_at(index) = matrix;
+      world_at(index) = matrix;
+      parents[index] = parent;
+      flags[index] = (uint8_t)(flag_live | (enabled ? flag_enabled : 0));
+      world_enabled[index] = enabled;
+      return index;
+    }
+
+    /// called when a node dies. The slot goes on the free list for a later add().
+    void remove(int index) {
+      #ifdef OCTET_BULLET
+        set_rigid_body(index, NULL);
+      #endif
+      flags[index] = 0;
+      free_slots.push_back(index);
+      std::push_heap(free_slots.data(), free_slots.data() + free_slots.size());
+    }
+
+    /// number of slots in the store
+    unsigned size() const {
+      return parents.size();
+    }
+
+    /// get the parent index of a node, or -1 for a root.
+    int get_parent(int index) const {
+      return parents[index];
+    }
+
+    /// access the node to parent transform of a node. The reference stays valid until the node is removed.
+    mat4t &access_nodeToParent(int index) {
+      return local_at(index);
+    }
+
+    /// read the node to parent transform of a node.
+    const mat4t &get_nodeToParent(int index) const {
+      return local_at(index);
+    }
+
+    /// get the local enabled flag of a node.
+    bool get_enabled(int index) const {
+      return (flags[index] & flag_enabled) != 0;
+    }
+
+    /// set the local enabled flag of a node.
+    void set_enabled(int index, bool value) {
+      flags[index] = (uint8_t)((flags[index] & ~flag_enabled) | (value ? flag_enabled : 0));
+    }
+
+    /// calculate the node to world matrix of one node by walking up the parent indices.
+    mat4t calc_nodeToWorld(int index) const {
+      mat4t result = local_at(index);
+      for (int p = parents[index]; p != -1; p = parents[p]) {
+        result = result * local_at(p);
+      }
+      return result;
+    }
+
+    /// calculate whether a node and all its parents are enabled.
+    bool calc_enabled(int index) const {
+      for (int p = index; p != -1; p = parents[p]) {
+        if (!(flags[p] & flag_enabled)) return false;
+      }
+      return true;
+    }
+
+    /// calculate all the world matrices and enabled states in one pass.
+    void update_world() {
+      unsigned num = parents.size();
+      const int *parent = parents.data();
+      const uint8_t *flag = flags.data();
+      uint8_t *enabled = world_enabled.data();
+      for (unsigned base = 0; base < num; base += chunk_size) {
+        chunk *c = chunks[base >> chunk_shift];
+        unsigned end = num - base < (unsigned)chunk_size ? num - base : (unsigned)chunk_size;
+        for (unsigned j = 0; j != end; ++j) {
+          unsigned i = base + j;
+          int p = parent[i];
+          if (p == -1) {
+            c->nodeToWorld[j] = c->nodeToParent[j];
+            enabled[i] = flag[i] & flag_enabled;
+          } else {
+            c->nodeToWorld[j] = c->nodeToParent[j] * world_at(p);
+            enabled[i] = enabled[p] & flag[i] & flag_enabled;
+          }
+        }
+      }
+    }
+
+    /// get the world matrix computed by the last update_world()
+    const mat4t &get_nodeToWorld(int index) const {
+      return world_at(index);
+    }
+
+    /// get the enabled state computed by the last update_world()
+    bool get_world_enabled(int index) const {
+      return world_enabled[index] != 0;
+    }
+
+    #ifdef OCTET_BULLET
+      /// get the rigid body driving a slot, or NULL.
+      btRigidBody *get_rigid_body(int index) const {
+        return bodies[index];
+      }
+
+      /// set the rigid body driving a slot. This forgets the previous transform.
+      void set_rigid_body(int index, btRigidBody *value) {
+        num_bodies += (value != NULL) - (bodies[index] != NULL);
+        bodies[index] = value;
+        flags[index] &= ~flag_has_prev;
+      }
+
+      /// number of slots driven by a rigid body.
+      unsigned get_num_bodies() const {
+        return num_bodies;
+      }
+
+      /// remember a body's transform before a physics step.
+      void set_prev_transform(int index, const btTransform &value) {
+        chunks[index >> chunk_shift]->prev_transform[index & chunk_mask] = value;
+        flags[index] |= flag_has_prev;
+      }
+
+      /// forget the previous transform, for example when the body is moved by hand.
+      void clear_prev_transform(int index) {
+        flags[index] &= ~flag_has_prev;
+      }
+
+      /// the transform saved before the last physics step, or NULL.
+      const btTransform *get_prev_transform(int index) const {
+        return (flags[index] & flag_has_prev) ? &chunks[index >> chunk_shift]->prev_transform[index & chunk_mask] : NULL;
+      }
+
+      /// save the current transforms of the bodies in slots [begin, end) before a physics step.
+      void save_prev_transforms(unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          if (bodies[i]) set_prev_transform(i, bodies[i]->getWorldTransform());
+        }
+      }
+
+      /// copy body transforms in slots [begin, end) to the nodes, blending with the previous
+      /// transform by alpha when interpolating.
+      void write_back_bodies(unsigned begin, unsigned end, btScalar alpha, bool interpolate) {
+        for (unsigned i = begin; i != end; ++i) {
+          btRigidBody *body = bodies[i];
+          if (!body) continue;
+          chunk *c = chunks[i >> chunk_shift];
+          unsigned j = i & chunk_mask;
+          const btTransform &cur = body->getWorldTransform();
+          if (interpolate && (flags[i] & flag_has_prev)) {
+            const btTransform &prev = c->prev_transform[j];
+            btTransform blend(
+              prev.getRotation().slerp(cur.getRotation(), alpha),
+              prev.getOrigin().lerp(cur.getOrigin(), alpha)
+            );
+            blend.getOpenGLMatrix(c->nodeToParent[j].get());
+          } else {
+            cur.getOpenGLMatrix(c->nodeToParent[j].get());
+          }
+        }
+      }
+    #endif
+  };
+}}
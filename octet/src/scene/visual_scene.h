@@ -8,6 +8,10 @@
 //
 
 namespace octet { namespace scene {
+  // allocation profiler tags
+  OCTET_ALLOC_TAG(visual_scene_instances)
+  OCTET_ALLOC_TAG(visual_scene_render_list)
+
   /// Visual scene; contains instances of meshes, cameras and lights required to draw a scene.
   class visual_scene : public scene_node {
     ///////////////////////////////////////////
@@ -16,23 +20,23 @@ namespace octet { namespace scene {
     //
 
     /// each of these is a set of (scene_node, mesh, material)
-    dynarray<ref<mesh_instance> > mesh_instances;
+    dynarray<ref<mesh_instance>, tagged_allocator<visual_scene_instances> > mesh_instances;
 
     /// animations playing at the moment
-    dynarray<ref<animation_instance> > animation_instances;
+    dynarray<ref<animation_instance>, tagged_allocator<visual_scene_instances> > animation_instances;
 
     /// cameras available
-    dynarray<ref<camera_instance> > camera_instances;
+    dynarray<ref<camera_instance>, tagged_allocator<visual_scene_instances> > camera_instances;
 
     /// lights available
-    dynarray<ref<light_instance> > light_instances;
+    dynarray<ref<light_instance>, tagged_allocator<visual_scene_instances> > light_instances;
 
     /// set this to draw bounding boxes
     bool render_aabbs;
     bool render_debug_lines;
     bool dump_vertices;
     ref<material> debug_material;
-    dynarray<vec3p> debug_line_buffer;
+    dynarray<vec3p, tagged_allocator<visual_scene_instances> > debug_line_buffer;
     unsigned debug_in_ptr;
 
     /// derived light information
@@ -43,6 +47,28 @@ namespace octet { namespace scene {
 
     int frame_number;
 
+    /// split update() across the worker pool
+    bool parallel_update;
+
+    /// fixed rate physics simulation
+    float physics_step;         /// seconds per physics step, 0 to step by frame time
+    int max_physics_steps;      /// most steps in one update(); time beyond this is dropped
+    float physics_budget;       /// most seconds of physics in one update(), 0 for no limit
+    float physics_accumulator;  /// simulation time not yet stepped
+    int physics_steps;          /// steps taken in the last update()
+
+    /// how many objects each worker job handles in update()
+    enum { update_chunk_size = 64 };
+
+    /// camera and lighting uniforms, uploaded once per frame for all materials
+    ref<uniform_buffer> frame_block;
+
+    /// optional flat storage for the node transforms (see use_transform_store)
+    ref<transform_store> transforms;
+
+    /// optional occlusion culling against an earlier frame's depth (see set_occlusion_culling)
+    ref<occlusion_culler> culler;
+
     /// shaders to draw triangles
     ref<bump_shader> object_shader;
     ref<bump_shader> skin_shader;
@@ -58,7 +84,27 @@ namespace octet { namespace scene {
       typedef void collison_shape_t;
     #endif
 
-    void draw_aabb(const aabb &bb) {
+    /// call fn(begin, end) over [0, count) on the worker pool, or serially for small counts.
+    template <class fn_t> void for_each_chunk(unsigned count, fn_t fn) {
+      if (parallel_update && count > update_chunk_size) {
+        worker_pool::get().parallel_for(count, update_chunk_size, fn);
+      } else {
+        fn(0, count);
+      }
+    }
+
+    // one visible mesh instance in this frame's render list.
+    struct draw_item {
+      mat4t modelToWorld;
+      mesh_instance *mi;
+    };
+
+    // per-frame lists, emptied with the frame allocator.
+    typedef dynarray<draw_item, tagged_allocator<visual_scene_render_list, frame_allocator> > draw_list_t;
+    typedef dynarray<vec3p, tagged_allocator<visual_scene_render_list, frame_allocator> > line_list_t;
+
+    /// add the twelve edges of a box to a list of lines.
+    static void add_aabb_lines(line_list_t &lines, const aabb &bb) {
       vec3 pos[8];
       vec3 center = bb.get_center();
       vec3 half = bb.get_half_extent();
@@ -76,13 +122,19 @@ namespace octet { namespace scene {
         0, 4, 1, 5, 2, 6, 3, 7
       };
 
-      /// render immediate data (this is inefficient!)
+      for (int i = 0; i != 24; ++i) {
+        lines.push_back(pos[indices[i]]);
+      }
+    }
+
+    /// render immediate line data in one draw call.
+    void draw_lines(const vec3p *pos, unsigned num_vertices) {
+      if (!num_vertices) return;
       glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 0, (void*)pos );
+      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, sizeof(vec3p), (void*)pos );
       glEnableVertexAttribArray(attribute_pos);
-    
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-      glDrawElements(GL_LINES, 24, GL_UNSIGNED_SHORT, indices);
+
+      glDrawArrays(GL_LINES, 0, num_vertices);
       glDisableVertexAttribArray(attribute_pos);
     }
 
@@ -110,24 +162,27 @@ namespace octet { namespace scene {
       num_light_uniforms = ambient_size + num_lights * light_size;
     }
 
-    void render_mesh_aabbs() {
+    void update_frame_block(const mat4t &cameraToProjection, const mat4t &worldToCamera) {
+      frame_block->set_value(material::frame_cameraToProjection, cameraToProjection.get(), sizeof(mat4t));
+      frame_block->set_value(material::frame_worldToCamera, worldToCamera.get(), sizeof(mat4t));
+      frame_block->set_value(material::frame_lighting, light_uniforms, sizeof(vec4) * num_light_uniforms);
+      frame_block->set_value(material::frame_num_lights, &num_lights, sizeof(int32_t));
+      frame_block->bind(uniform_buffer::frame_binding);
+
+      // materials drawn from now until the end of render_impl() read the lights from this block.
+      material::set_scene_frame_block(frame_block);
+    }
+
+    void add_mesh_aabb_lines(line_list_t &lines) {
+      lines.reserve(lines.size() + mesh_instances.size() * 24);
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
         aabb bb = mi->get_mesh()->get_aabb();
         bb = bb.get_transform(mi->get_node()->calcModelToWorld());
-        draw_aabb(bb);
+        add_aabb_lines(lines, bb);
       }
     }
 
-    void render_debug_line_buffer() {
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glVertexAttribPointer(attribute_pos, 3, GL_FLOAT, GL_FALSE, 12, (void*)debug_line_buffer.data() );
-      glEnableVertexAttribArray(attribute_pos);
-    
-      glDrawArrays(GL_LINES, 0, debug_line_buffer.size());
-      glDisableVertexAttribArray(attribute_pos);
-    }
-
     void dump_mesh_vertices(camera_instance &cam) {
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
@@ -173,11 +228,14 @@ namespace octet { namespace scene {
 
       /// debug lines are a useful way of showing dynamic behaviour in the scene.
       if (render_debug_lines) {
-        render_debug_line_buffer();
+        draw_lines(debug_line_buffer.data(), debug_line_buffer.size());
       }
 
+      // the boxes are gathered for this frame and drawn in one call.
       if (render_aabbs) {
-        render_mesh_aabbs();
+        line_list_t lines;
+        add_mesh_aabb_lines(lines);
+        draw_lines(lines.data(), lines.size());
       }
     }
 
@@ -192,32 +250,43 @@ namespace octet { namespace scene {
       cam.set_cameraToWorld(cameraToWorld, aspect_ratio);
       mat4t cameraToProjection = cam.get_cameraToProjection();
 
+      update_frame_block(cameraToProjection, worldToCamera);
+
       draw_debug_data(cam);
 
+      // with a transform store, all the world matrices are made in one linear pass
+      if (transforms) {
+        transforms->update_world();
+      }
+
+      if (culler) {
+        culler->begin_frame(mesh_instances.size());
+      }
+
+      // this frame's render list: the instances that pass the enable, LOD and occlusion tests.
+      draw_list_t draw_list;
+      draw_list.reserve(mesh_instances.size());
+
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
 
         scene_node *node = mi->get_node();
         unsigned flags = mi->get_flags();
+        int store_index = transforms && node->get_transform_store() == transforms ? node->get_store_index() : -1;
 
         if (
           !(flags & mesh_instance::flag_enabled) ||
-          !node->calcEnabled()
+          !(store_index != -1 ? transforms->get_world_enabled(store_index) : node->calcEnabled())
         ) continue;
 
-        mesh *msh = mi->get_mesh();
-        skin *skn = msh->get_skin();
-        skeleton *skel = mi->get_skeleton();
-        material *mat = mi->get_material();
-
-        mat4t modelToWorld = node->calcModelToWorld();
-        mat4t modelToCamera;
-        mat4t modelToProjection;
-        cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
+        mat4t modelToWorld = store_index != -1 ? transforms->get_nodeToWorld(store_index) : node->calcModelToWorld();
         //printf("%d %f\n", mesh_index, modelToWorld.w().y());
 
         // selecting LOD meshes by distance
         if (flags & mesh_instance::flag_lod) {
+          mat4t modelToCamera;
+          mat4t modelToProjection;
+          cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
           float distance = -modelToCamera.w().z();
           //printf("%f %f %f\n", distance, mi->get_min_draw_distance(), mi->get_max_draw_distance());
           if (
@@ -228,6 +297,31 @@ namespace octet { namespace scene {
           }
         }
 
+        // skip objects hidden behind the scenery drawn in an earlier frame
+        if (culler && !culler->is_visible(mesh_index, mi->get_mesh()->get_aabb(), modelToWorld)) {
+          continue;
+        }
+
+        draw_item &item = draw_list.emplace_back();
+        item.modelToWorld = modelToWorld;
+        item.mi = mi;
+      }
+
+      // boxes around selected instances, drawn after the meshes.
+      line_list_t selected_lines;
+
+      for (unsigned i = 0; i != draw_list.size(); ++i) {
+        mesh_instance *mi = draw_list[i].mi;
+        const mat4t &modelToWorld = draw_list[i].modelToWorld;
+        mesh *msh = mi->get_mesh();
+        skin *skn = msh->get_skin();
+        skeleton *skel = mi->get_skeleton();
+        material *mat = mi->get_material();
+
+        mat4t modelToCamera;
+        mat4t modelToProjection;
+        cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
+
         if (!skel || !skn) {
           /// normal rendering for single matrix objects
           /// build a projection matrix: model -> world -> camera_instance -> projection
@@ -256,10 +350,20 @@ namespace octet { namespace scene {
 
         if (mi->get_flags() & mesh_instance::flag_selected) {
           aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(mi->get_node()->calcModelToWorld());
-          draw_aabb(bb);
+          add_aabb_lines(selected_lines, bb.get_transform(modelToWorld));
         }
       }
+
+      if (selected_lines.size()) {
+        mat4t worldToProjection = worldToCamera * cameraToProjection;
+        debug_material->render(worldToProjection, worldToCamera, light_uniforms, num_light_uniforms, num_lights);
+        draw_lines(selected_lines.data(), selected_lines.size());
+      }
+
+      if (culler) {
+        culler->end_frame(worldToCamera * cameraToProjection);
+      }
+      material::set_scene_frame_block(NULL);
       frame_number++;
     }
   public:
@@ -268,11 +372,18 @@ namespace octet { namespace scene {
     /// Create an empty visual_scene; Use add_* functions to add components to the scene.
     visual_scene() {
       frame_number = 0;
+      parallel_update = true;
+      physics_step = 1.0f / 60;
+      max_physics_steps = 4;
+      physics_budget = 0;
+      physics_accumulator = 0;
+      physics_steps = 0;
       num_light_uniforms = 0;
       num_lights = 0;
       render_aabbs = false;
       dump_vertices = false;
       render_debug_lines = false;
+      frame_block = new uniform_buffer(material::frame_block_size);
       debug_material = new material(vec4(1, 0, 0, 1));
       debug_line_buffer.resize(256);
       assert(is_power_of_two(debug_line_buffer.size()));
@@ -526,34 +637,169 @@ namespace octet { namespace scene {
       return light_instances[index];
     }
 
+    /// Move the transforms of all the nodes in this scene into a flat transform_store.
+    /// Nodes added later join the store. Rendering then reads world matrices linearly
+    /// instead of walking parent pointers for every mesh instance.
+    transform_store *use_transform_store() {
+      if (!transforms) {
+        transforms = new transform_store();
+        attach_to_store(transforms);
+      }
+      return transforms;
+    }
+
+    /// get the transform store, if use_transform_store() has been called.
+    transform_store *get_transform_store() {
+      return transforms;
+    }
+
+    /// Skip mesh instances hidden behind others, using the depth buffer of an earlier frame.
+    /// Needs the depth buffer to be readable (not GLES2). Off by default.
+    void set_occlusion_culling(bool value) {
+      culler = value ? (culler ? (occlusion_culler*)culler : new occlusion_culler()) : NULL;
+    }
+
+    /// get the occlusion culler, for example to read get_num_culled() for profiling.
+    occlusion_culler *get_occlusion_culler() {
+      return culler;
+    }
+
+    /// use the worker pool in update(). On by default.
+    /// Parallel updates assume that each scene_node is driven by at most one rigid body
+    /// and one animation instance; turn this off if animations share targets.
+    void set_parallel_update(bool value) {
+      parallel_update = value;
+    }
+
+    /// Set the physics rate. Each update() takes as many steps of "step" seconds as fit
+    /// in the elapsed time, up to "max_steps" steps and "budget" seconds of real time.
+    /// Time that does not fit is dropped, so the simulation slows down instead of blowing up.
+    /// A step of zero steps by the frame time instead (not recommended).
+    void set_physics_rate(float step, int max_steps=4, float budget=0) {
+      physics_step = step;
+      max_physics_steps = max_steps < 1 ? 1 : max_steps;
+      physics_budget = budget;
+      physics_accumulator = 0;
+    }
+
+    /// how far we are between the last two physics steps (0..1), used to blend transforms.
+    float get_physics_alpha() const {
+      return physics_step > 0 ? physics_accumulator / physics_step : 1.0f;
+    }
+
+    /// how many physics steps were taken by the last update()
+    int get_physics_steps() const {
+      return physics_steps;
+    }
+
     /// advance all the animation instances
     /// note that we want to update before rendering or doing physics and AI actions.
+    /// Physics write-back, animations and meshes are each split across the worker pool.
     void update(float delta_time) {
       #ifdef OCTET_BULLET
-        world->stepSimulation(delta_time, 1, delta_time);
+        step_physics(delta_time);
+
+        // nodes get the transform blended between the last two steps
         btCollisionObjectArray &array = world->getCollisionObjectArray();
-        for (int i = 0; i != array.size(); ++i) {
-          btCollisionObject *co = array[i];
-          scene_node *node = (scene_node *)co->getUserPointer();
-          if (node) {
-            mat4t &mat = node->access_nodeToParent();
-            co->getWorldTransform().getOpenGLMatrix(mat.get());
-            //printf("%d %f\n", i, mat.w().y());
-          }
+        bool interpolate = physics_step > 0;
+        btScalar alpha = get_physics_alpha();
+
+        // with a transform store, walk its slots in order instead of chasing node pointers.
+        if (transforms) {
+          for_each_chunk(transforms->size(), [&](unsigned begin, unsigned end) {
+            transforms->write_back_bodies(begin, end, alpha, interpolate);
+          });
+        }
+
+        // the remaining bodies, if any, are written through their nodes.
+        if (!transforms || transforms->get_num_bodies() != (unsigned)array.size()) {
+          for_each_chunk((unsigned)array.size(), [&](unsigned begin, unsigned end) {
+            for (unsigned i = begin; i != end; ++i) {
+              btCollisionObject *co = array[i];
+              scene_node *node = (scene_node *)co->getUserPointer();
+              if (node && (!transforms || node->get_transform_store() != transforms)) {
+                mat4t &mat = node->access_nodeToParent();
+                const btTransform &cur = co->getWorldTransform();
+                // each node keeps its own body's previous transform, so bodies can come and go between steps.
+                const btTransform *prev = node->get_prev_transform();
+                if (interpolate && prev) {
+                  btTransform blend(
+                    prev->getRotation().slerp(cur.getRotation(), alpha),
+                    prev->getOrigin().lerp(cur.getOrigin(), alpha)
+                  );
+                  blend.getOpenGLMatrix(mat.get());
+                } else {
+                  cur.getOpenGLMatrix(mat.get());
+                }
+                //printf("%d %f\n", i, mat.w().y());
+              }
+            }
+          });
         }
       #endif
 
-      for (int idx = 0; idx != animation_instances.size(); ++idx) {
-        animation_instance *inst = animation_instances[idx];
-        inst->update(delta_time);
-      }
+      for_each_chunk(animation_instances.size(), [&](unsigned begin, unsigned end) {
+        for (unsigned idx = begin; idx != end; ++idx) {
+          animation_instance *inst = animation_instances[idx];
+          inst->update(delta_time);
+        }
+      });
 
-      for (int idx = 0; idx != mesh_instances.size(); ++idx) {
-        mesh_instance *inst = mesh_instances[idx];
-        inst->update(delta_time);
-      }
+      for_each_chunk(mesh_instances.size(), [&](unsigned begin, unsigned end) {
+        for (unsigned idx = begin; idx != end; ++idx) {
+          mesh_instance *inst = mesh_instances[idx];
+          inst->update(delta_time);
+        }
+      });
     }
 
+    #ifdef OCTET_BULLET
+      /// run the fixed step physics loop for one frame.
+      void step_physics(float delta_time) {
+        physics_steps = 0;
+        if (physics_step <= 0) {
+          world->stepSimulation(delta_time, 1, delta_time);
+          physics_steps = 1;
+          return;
+        }
+
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+        physics_accumulator += delta_time;
+        btCollisionObjectArray &array = world->getCollisionObjectArray();
+
+        while (physics_accumulator >= physics_step) {
+          if (physics_steps == max_physics_steps) break;
+          if (physics_budget > 0 && physics_steps != 0) {
+            float elapsed = std::chrono::duration<float>(clock::now() - start).count();
+            if (elapsed >= physics_budget) break;
+          }
+
+          // keep the previous state for interpolation
+          if (transforms) {
+            transforms->save_prev_transforms(0, transforms->size());
+          }
+          if (!transforms || transforms->get_num_bodies() != (unsigned)array.size()) {
+            for (int i = 0; i != array.size(); ++i) {
+              scene_node *node = (scene_node *)array[i]->getUserPointer();
+              if (node && (!transforms || node->get_transform_store() != transforms)) {
+                node->set_prev_transform(array[i]->getWorldTransform());
+              }
+            }
+          }
+
+          world->stepSimulation(physics_step, 0, physics_step);
+          physics_accumulator -= physics_step;
+          physics_steps++;
+        }
+
+        // over budget: drop the time we could not simulate rather than catching up later.
+        if (physics_accumulator >= physics_step) {
+          physics_accumulator = fmodf(physics_accumulator, physics_step);
+        }
+      }
+    #endif
+
     /// render using specific shaders.
     /// call OpenGL to draw all the mesh instances (scene_node + mesh + material)
     void render(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Depth reduction shader for occlusion culling
+//
+// Each output pixel is the furthest depth of a reduce x reduce block of a
+// depth texture, so the CPU only reads back a small image.
+// Needs OpenGL 3.1 (texelFetch and float render targets).
+//
+
+namespace octet { namespace shaders {
+  class depth_reduce_shader : public shader {
+    // index for the depth texture sampler
+    GLint samplerIndex_;
+
+    // index for the size of the depth texture in texels
+    GLint depthSizeIndex_;
+
+    // index for the block size
+    GLint reduceIndex_;
+  public:
+    void init() {
+      // draws one triangle that covers the whole target.
+      const char vertex_shader[] = "#version 140\n" SHADER_STR(
+        in vec4 pos;
+
+        void main() { gl_Position = pos; }
+      );
+
+      // furthest depth of the block under this pixel, clamped to the edge of the texture.
+      const char fragment_shader[] = "#version 140\n" SHADER_STR(
+        uniform sampler2D depth;
+        uniform ivec2 depth_size;
+        uniform int reduce;
+        out vec4 frag_color;
+
+        void main() {
+          ivec2 base = ivec2(gl_FragCoord.xy) * reduce;
+          ivec2 last = depth_size - ivec2(1, 1);
+          float furthest = 0.0;
+          for (int j = 0; j != reduce; ++j) {
+            for (int i = 0; i != reduce; ++i) {
+              furthest = max(furthest, texelFetch(depth, min(base + ivec2(i, j), last), 0).r);
+            }
+          }
+          frag_color = vec4(furthest, 0.0, 0.0, 1.0);
+        }
+      );
+
+      shader::init(vertex_shader, fragment_shader);
+
+      samplerIndex_ = glGetUniformLocation(program(), "depth");
+      depthSizeIndex_ = glGetUniformLocation(program(), "depth_size");
+      reduceIndex_ = glGetUniformLocation(program(), "reduce");
+    }
+
+    void render(int sampler, int depth_width, int depth_height, int reduce) {
+      shader::render();
+
+      glUniform1i(samplerIndex_, sampler);
+      glUniform2i(depthSizeIndex_, depth_width, depth_height);
+      glUniform1i(reduceIndex_, reduce);
+    }
+  };
+}}
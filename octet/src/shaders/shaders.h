@@ -32,5 +32,6 @@
   #include "../shaders/phong_shader.h"
   #include "../shaders/bump_shader.h"
   #include "../shaders/compute_shader.h"
+  #include "../shaders/depth_reduce_shader.h"
 
 #endif